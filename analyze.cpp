@@ -0,0 +1,488 @@
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <regex>
+#include <set>
+#include <thread>
+#include <unistd.h>
+
+#include "./ccomp.hpp"
+#include "includes/file_utils/file_utils.hpp"
+#include "includes/scan_utils/scan_utils.hpp"
+
+namespace {
+
+struct HeaderStats {
+  fs::path header;
+  size_t directTUs = 0;
+  size_t transitiveTUs = 0;
+  size_t preprocessedBytes = 0;
+};
+
+/**
+ * @brief An #include the including file compiles without, and what dropping
+ * it saves: preprocessed bytes per compile of the file, times the TUs that
+ * compile it (1 for a source, the TUs reaching a header).
+ */
+struct UnusedInclude {
+  fs::path file;
+  size_t line = 0;
+  std::string include; // * As written, e.g. "util/log.hpp"
+  size_t savedBytes = 0;
+  size_t includers = 1;
+};
+
+/**
+ * @brief Options shared by the include analysis modes.
+ */
+struct AnalysisOptions {
+  std::vector<std::string> compiler; // * Compiler command (-c)
+  std::vector<std::string> flags;    // * Trailing compiler flags
+  size_t jobs = 1;
+
+  std::vector<std::string> compilerArgs() const {
+    auto args = compiler;
+    args.insert(args.end(), flags.begin(), flags.end());
+    return args;
+  }
+};
+
+void add_analysis_arguments(argparse::ArgumentParser &program,
+                            const std::string &jobsHelp) {
+  program.add_argument("compiler_flags")
+      .help("Flags used when preprocessing headers (e.g., -Iinclude).")
+      .remaining();
+  program.add_argument("-c", "--compiler")
+      .help("Compiler used to measure preprocessed sizes.")
+      .default_value(std::string("g++"));
+  program.add_argument("-j", "--jobs")
+      .help(jobsHelp)
+      .default_value(static_cast<int>(
+          std::max(1u, std::thread::hardware_concurrency())))
+      .scan<'i', int>();
+}
+
+/**
+ * @brief Parses the command line; throws on invalid arguments.
+ */
+AnalysisOptions parse_analysis_arguments(argparse::ArgumentParser &program,
+                                         int argc, char **argv) {
+  AnalysisOptions options;
+  options.flags = program.parse_known_args(argc, argv);
+  try {
+    const auto remaining =
+        program.get<std::vector<std::string>>("compiler_flags");
+    options.flags.insert(options.flags.end(), remaining.begin(),
+                         remaining.end());
+  } catch (const std::exception &e) {
+  }
+  options.compiler =
+      splitCommand(resolveCompilerArg(program.get<std::string>("-c")));
+  options.jobs = std::max(1, program.get<int>("--jobs"));
+  return options;
+}
+
+std::vector<fs::path> find_translation_units(const fs::path &rootDir,
+                                             size_t jobs) {
+  std::vector<fs::path> units;
+  for (const auto &source : listSourceFiles(rootDir, jobs)) {
+    units.push_back(normalizePath(source));
+  }
+  std::sort(units.begin(), units.end());
+  return units;
+}
+
+std::set<fs::path> reachable_headers(const IncludeGraph &graph,
+                                     const fs::path &unit) {
+  std::set<fs::path> reached;
+  std::vector<fs::path> pending{unit};
+  while (!pending.empty()) {
+    const auto current = pending.back();
+    pending.pop_back();
+    const auto edges = graph.edges.find(current);
+    if (edges == graph.edges.end()) {
+      continue;
+    }
+    for (const auto &header : edges->second) {
+      if (header != unit && reached.insert(header).second) {
+        pending.push_back(header);
+      }
+    }
+  }
+  return reached;
+}
+
+/**
+ * @brief Scans the include graph of every unit, evaluating conditionals
+ * with the compiler's macros.
+ */
+IncludeGraph scan_units(const std::vector<fs::path> &units,
+                        const AnalysisOptions &options,
+                        const fs::path &rootDir) {
+  const auto compilerArgs = options.compilerArgs();
+  const auto probe = queryCompiler(compilerArgs);
+  setScanMacros(probe.macros, probe.includeDirs);
+  IncludeGraph graph;
+  addToIncludeGraph(graph, units, includeSearchDirs(compilerArgs, rootDir),
+                    options.jobs);
+  return graph;
+}
+
+/**
+ * @brief Direct and transitive includer counts of every file the units
+ * reach. Units that couldn't be scanned are reported and left out.
+ */
+std::map<fs::path, HeaderStats>
+include_stats(IncludeGraph &graph, const std::vector<fs::path> &units) {
+  std::map<fs::path, HeaderStats> stats;
+  for (const auto &unit : units) {
+    if (const auto error = graph.errors.find(unit);
+        error != graph.errors.end()) {
+      std::cerr << "- Skipping " << unit.string() << ": " << error->second
+                << '\n';
+      continue;
+    }
+    for (const auto &header : graph.edges[unit]) {
+      ++stats[header].directTUs;
+    }
+    for (const auto &header : reachable_headers(graph, unit)) {
+      ++stats[header].transitiveTUs;
+    }
+  }
+  for (auto &[header, headerStats] : stats) {
+    headerStats.header = header;
+  }
+  return stats;
+}
+
+/**
+ * @brief Size of the header after preprocessing, i.e. what every including
+ * TU has to parse again when it changes.
+ */
+size_t preprocessed_size(const std::vector<std::string> &compilerArgs,
+                         const fs::path &header) {
+  auto args = compilerArgs;
+  args.insert(args.end(), {"-E", "-P", "-w", "-x", "c++", header.string()});
+
+  size_t bytes = 0;
+  ProcessOptions options;
+  options.onOutput = [&bytes](const char *, size_t size) { bytes += size; };
+  const auto result = runProcess(args, options);
+  return result.exitCode == 0 ? bytes : 0;
+}
+
+bool compiles(const std::vector<std::string> &compilerArgs,
+              const fs::path &file) {
+  auto args = compilerArgs;
+  args.insert(args.end(), {"-fsyntax-only", "-w", "-x", "c++", file.string()});
+  ProcessOptions options;
+  options.onOutput = [](const char *, size_t) {};
+  options.mergeStderr = true;
+  return runProcess(args, options).exitCode == 0;
+}
+
+/**
+ * @brief The lines of a file including one of the project headers it's
+ * known to reach (an edge of the include graph), except a source's own
+ * header: it's kept even when the definitions compile without it.
+ */
+struct IncludeLine {
+  size_t line = 0;
+  size_t begin = 0; // * Offsets of the line in the file
+  size_t end = 0;
+  std::string include;
+};
+
+std::vector<IncludeLine>
+project_include_lines(const std::string &text, const fs::path &file,
+                      const std::vector<fs::path> &edges,
+                      const std::vector<fs::path> &searchDirs) {
+  static const std::regex includeLine(R"re(^\s*#\s*include\s*"([^"]+)")re");
+  std::vector<IncludeLine> lines;
+  size_t lineNumber = 1;
+  for (size_t begin = 0; begin < text.size(); ++lineNumber) {
+    size_t end = text.find('\n', begin);
+    end = end == std::string::npos ? text.size() : end;
+    std::smatch match;
+    const std::string line = text.substr(begin, end - begin);
+    if (std::regex_search(line, match, includeLine)) {
+      const auto resolved = resolveInclude(match[1], file, searchDirs);
+      const auto header =
+          resolved ? normalizePath(resolved.value()) : fs::path();
+      const auto pairedSource =
+          resolved ? findPairedSource(header, searchDirs) : std::nullopt;
+      if (resolved &&
+          std::find(edges.begin(), edges.end(), header) != edges.end() &&
+          !(pairedSource && normalizePath(pairedSource.value()) == file)) {
+        lines.push_back({lineNumber, begin, end, match[1]});
+      }
+    }
+    begin = end + 1;
+  }
+  return lines;
+}
+
+/**
+ * @brief Tries each project include of `file` without it: a copy with the
+ * line blanked out is compiled (-fsyntax-only, quoted includes still
+ * searched next to the original) and, if it compiles, preprocessed to
+ * measure what it saves. Includes saving nothing (guarded repeats,
+ * commented-out lines) aren't reported.
+ */
+std::vector<UnusedInclude>
+find_unused_includes(const fs::path &file, const std::vector<fs::path> &edges,
+                     const AnalysisOptions &options,
+                     const std::vector<fs::path> &searchDirs,
+                     const fs::path &scratchDir, std::string &skipReason) {
+  std::ifstream in(file, std::ios::binary);
+  const std::string text((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+  const auto lines = project_include_lines(text, file, edges, searchDirs);
+  if (lines.empty()) {
+    return {};
+  }
+
+  // * Copies live in scratchDir, so the original's directory is searched
+  // * for quoted includes first (as it is for the original).
+  auto compilerArgs = options.compiler;
+  compilerArgs.insert(compilerArgs.end(),
+                      {"-iquote", file.parent_path().string()});
+  compilerArgs.insert(compilerArgs.end(), options.flags.begin(),
+                      options.flags.end());
+  if (!compiles(compilerArgs, file)) {
+    skipReason = "doesn't compile on its own";
+    return {};
+  }
+  const size_t baseline = preprocessed_size(compilerArgs, file);
+
+  std::vector<UnusedInclude> unused;
+  const auto copy = scratchDir / file.filename();
+  for (const auto &line : lines) {
+    {
+      std::ofstream out(copy, std::ios::binary | std::ios::trunc);
+      out << std::string_view(text).substr(0, line.begin)
+          << std::string_view(text).substr(line.end);
+    }
+    if (!compiles(compilerArgs, copy)) {
+      continue;
+    }
+    const size_t without = preprocessed_size(compilerArgs, copy);
+    if (without > 0 && without < baseline) {
+      unused.push_back({file, line.line, line.include, baseline - without});
+    }
+  }
+  // * A copy left behind would shadow quoted includes of the same name
+  // * in the files checked after this one.
+  std::error_code ec;
+  fs::remove(copy, ec);
+  return unused;
+}
+
+} // namespace
+
+/**
+ * @brief `ccomp analyze`: reports, for every project header, how many TUs
+ * include it directly and transitively, its preprocessed size and the number
+ * of TUs a change to it recompiles.
+ */
+int run_analyze(int argc, char **argv) {
+  argparse::ArgumentParser program("ccomp analyze");
+  program.add_description(
+      "Reports the include cost of every project header: direct and "
+      "transitive includers, preprocessed size and rebuild fan-out.");
+
+  add_analysis_arguments(program,
+                         "Number of headers to preprocess in parallel.");
+  program.add_argument("--skip-preprocess")
+      .help("Don't measure preprocessed sizes (graph only, much faster).")
+      .flag();
+
+  AnalysisOptions options;
+  bool skipPreprocess = false;
+  try {
+    options = parse_analysis_arguments(program, argc, argv);
+    skipPreprocess = program.get<bool>("--skip-preprocess");
+  } catch (const std::exception &e) {
+    return exitError(ErrorType::ARGUMENT_PARSING_ERROR, e.what());
+  }
+  const auto compilerArgs = options.compilerArgs();
+  const size_t jobs = options.jobs;
+
+  const fs::path rootDir = getRootDir();
+  const auto units = find_translation_units(rootDir, jobs);
+  const std::set<fs::path> unitSet(units.begin(), units.end());
+
+  auto graph = scan_units(units, options, rootDir);
+  std::vector<HeaderStats> headers;
+  for (const auto &[header, headerStats] : include_stats(graph, units)) {
+    if (!unitSet.count(header)) {
+      headers.push_back(headerStats);
+    }
+  }
+
+  if (!skipPreprocess) {
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+      for (size_t i = next++; i < headers.size(); i = next++) {
+        headers[i].preprocessedBytes =
+            preprocessed_size(compilerArgs, headers[i].header);
+      }
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < std::min(jobs, headers.size()); ++i) {
+      workers.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : workers) {
+      thread.join();
+    }
+  }
+
+  std::sort(headers.begin(), headers.end(),
+            [](const HeaderStats &a, const HeaderStats &b) {
+              if (a.transitiveTUs != b.transitiveTUs)
+                return a.transitiveTUs > b.transitiveTUs;
+              if (a.preprocessedBytes != b.preprocessedBytes)
+                return a.preprocessedBytes > b.preprocessedBytes;
+              return a.header < b.header;
+            });
+
+  std::cout << units.size() << " translation unit(s), " << headers.size()
+            << " project header(s)\n\n";
+  std::cout << std::setw(8) << "direct" << std::setw(8) << "trans"
+            << std::setw(14) << "preprocessed"
+            << "  header (touching it recompiles <trans> TUs)\n";
+  for (const auto &header : headers) {
+    std::cout << std::setw(8) << header.directTUs << std::setw(8)
+              << header.transitiveTUs << std::setw(11) << std::fixed
+              << std::setprecision(1);
+    if (skipPreprocess) {
+      std::cout << "-";
+    } else {
+      std::cout << header.preprocessedBytes / 1024.0;
+    }
+    std::cout << " KB  " << header.header.lexically_relative(rootDir).string()
+              << '\n';
+  }
+  return 0;
+}
+
+/**
+ * @brief `ccomp lint-includes`: finds the project includes each source and
+ * header compiles without, ranked by the preprocessed bytes removing them
+ * saves across the TUs that compile the including file.
+ */
+int run_lint_includes(int argc, char **argv) {
+  argparse::ArgumentParser program("ccomp lint-includes");
+  program.add_description(
+      "Reports project includes a file compiles without, ranked by the "
+      "preprocessed bytes removing them saves.");
+  add_analysis_arguments(program, "Number of files to check in parallel.");
+
+  AnalysisOptions options;
+  try {
+    options = parse_analysis_arguments(program, argc, argv);
+  } catch (const std::exception &e) {
+    return exitError(ErrorType::ARGUMENT_PARSING_ERROR, e.what());
+  }
+
+  const fs::path rootDir = getRootDir();
+  const auto units = find_translation_units(rootDir, options.jobs);
+  auto graph = scan_units(units, options, rootDir);
+  const auto stats = include_stats(graph, units);
+  const auto searchDirs =
+      includeSearchDirs(options.compilerArgs(), rootDir);
+
+  // * Sources and the headers they reach; module units need module flags
+  // * to compile, so they're left out.
+  std::vector<fs::path> files;
+  for (const auto &unit : units) {
+    if (!graph.errors.count(unit) &&
+        !isModuleInterfaceName(unit.filename().string()) &&
+        !graph.modules.count(unit)) {
+      files.push_back(unit);
+    }
+  }
+  for (const auto &[header, headerStats] : stats) {
+    if (!std::binary_search(units.begin(), units.end(), header)) {
+      files.push_back(header);
+    }
+  }
+
+  // * Looked up before the workers start: graph.edges[] would insert into
+  // * the shared map for a file it doesn't have.
+  std::vector<std::vector<fs::path>> edges(files.size());
+  for (size_t i = 0; i < files.size(); ++i) {
+    if (const auto fileEdges = graph.edges.find(files[i]);
+        fileEdges != graph.edges.end()) {
+      edges[i] = fileEdges->second;
+    }
+  }
+
+  const auto scratchDir = fs::temp_directory_path() /
+                          ("ccomp-lint-" + std::to_string(getpid()));
+  std::vector<std::vector<UnusedInclude>> found(files.size());
+  std::vector<std::string> skipped(files.size());
+  std::atomic<size_t> next{0};
+  auto worker = [&](size_t id) {
+    const auto workerDir = scratchDir / std::to_string(id);
+    fs::create_directories(workerDir);
+    for (size_t i = next++; i < files.size(); i = next++) {
+      found[i] = find_unused_includes(files[i], edges[i], options, searchDirs,
+                                      workerDir, skipped[i]);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < std::min(options.jobs, files.size()); ++i) {
+    workers.emplace_back(worker, i);
+  }
+  worker(0);
+  for (auto &thread : workers) {
+    thread.join();
+  }
+  std::error_code ec;
+  fs::remove_all(scratchDir, ec);
+
+  std::vector<UnusedInclude> unused;
+  size_t skippedCount = 0;
+  for (size_t i = 0; i < files.size(); ++i) {
+    if (!skipped[i].empty()) {
+      std::cerr << "- Skipping " << files[i].string() << ": " << skipped[i]
+                << '\n';
+      ++skippedCount;
+    }
+    const auto fileStats = stats.find(files[i]);
+    for (auto &include : found[i]) {
+      if (fileStats != stats.end()) {
+        include.includers = std::max<size_t>(1, fileStats->second.transitiveTUs);
+      }
+      unused.push_back(include);
+    }
+  }
+  std::sort(unused.begin(), unused.end(),
+            [](const UnusedInclude &a, const UnusedInclude &b) {
+              const size_t aTotal = a.savedBytes * a.includers;
+              const size_t bTotal = b.savedBytes * b.includers;
+              if (aTotal != bTotal)
+                return aTotal > bTotal;
+              if (a.file != b.file)
+                return a.file < b.file;
+              return a.line < b.line;
+            });
+
+  std::cout << files.size() - skippedCount << " file(s) checked, "
+            << unused.size() << " unused include(s)\n\n";
+  std::cout << std::setw(9) << "KB/TU" << std::setw(6) << "TUs"
+            << std::setw(11) << "total KB"
+            << "  file:line  include (compiles without it)\n";
+  for (const auto &include : unused) {
+    std::cout << std::fixed << std::setprecision(1) << std::setw(9)
+              << include.savedBytes / 1024.0 << std::setw(6)
+              << include.includers << std::setw(11)
+              << include.savedBytes * include.includers / 1024.0 << "  "
+              << include.file.lexically_relative(rootDir).string() << ':'
+              << include.line << "  \"" << include.include << "\"\n";
+  }
+  return 0;
+}
@@ -1,10 +1,25 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <ctime>
 #include <cstdlib>
 #include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <set>
+#include <sstream>
 #include <string>
+#include <thread>
 
 #include "./ccomp.hpp"
 #include "includes/file_utils/file_utils.hpp"
-#include "includes/system_utils/system_utils.hpp"
+#include "includes/git_utils/git_utils.hpp"
+#include "includes/jobserver_utils/jobserver_utils.hpp"
+#include "includes/json_utils/json_utils.hpp"
+#include "includes/profile_utils/profile_utils.hpp"
+#include "includes/scan_utils/scan_utils.hpp"
+#include "includes/trace_utils/trace_utils.hpp"
 
 /**
  * @brief Parses command line arguments and builds the ProgramConfig.
@@ -16,7 +31,8 @@ std::optional<ProgramConfig> parse_args(int argc, char **argv) {
       "and execution of C++ source files on Unix-like systems.");
 
   program.add_argument("sourceFilePath")
-      .help("c++ source file to be processed.")
+      .help("c++ source file(s) to be processed; each one (or glob, e.g. "
+            "'tools/*.cpp') becomes its own program.")
       .required();
 
   program.add_argument("compiler_flags")
@@ -24,8 +40,47 @@ std::optional<ProgramConfig> parse_args(int argc, char **argv) {
             "-Iinclude).")
       .remaining();
 
+  program.add_epilog("Arguments after a '--' separator are passed to the "
+                     "executed program instead of the compiler.");
+
   program.add_argument("-r", "--run").flag();
   program.add_argument("-rv", "--runValgrind").flag();
+  program.add_argument("-t", "--tests")
+      .help("Runs the compiled binary once per <case>.in in the given "
+            "directory and compares its output against <case>.out.");
+  program.add_argument("--timeout")
+      .help("Kills the executed program after this many wall-clock seconds.")
+      .scan<'g', double>();
+  program.add_argument("--cpu-limit")
+      .help("Limits the executed program's CPU time, in seconds.")
+      .scan<'i', long>();
+  program.add_argument("--memory-limit")
+      .help("Limits the executed program's memory, in bytes or with a K/M/G "
+            "suffix (e.g., 512M, 2G).");
+  program.add_argument("-j", "--jobs")
+      .help("Number of translation units to compile (or test cases to run) in "
+            "parallel. Defaults to make's -j under a make jobserver, "
+            "otherwise the number of cores.")
+      .scan<'i', int>();
+  program.add_argument("--report")
+      .help("Writes a machine-readable record of the build and run.")
+      .choices("json");
+  program.add_argument("--report-file")
+      .help("Where --report writes to (default: <output>/ccomp-report.json).");
+  program.add_argument("--compile-profile")
+      .help("Profiles every translation unit (clang -ftime-trace, gcc "
+            "-ftime-report) and ranks headers, templates and TUs by cost.")
+      .flag();
+  program.add_argument("--workers")
+      .help("Comma-separated compile workers started with 'ccomp worker' "
+            "(unix:/path, tcp:host:port). Sources are preprocessed locally.");
+  program.add_argument("--scan-preamble")
+      .help("Only scans each file's leading block of comments and directives "
+            "for includes, without evaluating conditionals (faster on big "
+            "sources; misses later includes).")
+      .flag();
+  program.add_argument("--trace")
+      .help("Writes a Chrome trace-event file of ccomp's own phases.");
   program.add_argument("-o", "--output")
       .default_value(std::string("./out"))
       .required();
@@ -36,45 +91,130 @@ std::optional<ProgramConfig> parse_args(int argc, char **argv) {
       .required();
 
   try {
-    program.parse_args(argc, argv);
+    // * Everything after "--" belongs to the executed program.
+    const std::vector<std::string> arguments(argv, argv + argc);
+    const auto separator = std::find(arguments.begin(), arguments.end(), "--");
+    // * Unknown dash-prefixed arguments (e.g. -Wall) are compiler flags.
+    const auto unknownFlags =
+        program.parse_known_args({arguments.begin(), separator});
 
     ProgramConfig config;
-    config.sourceFilePath = program.get<std::string>("sourceFilePath");
-
-    if (!std::regex_match(config.sourceFilePath.string(),
-                          SOURCE_FILE_PATH_REGEX)) {
-      throw std::invalid_argument(program.get<std::string>("sourceFilePath") +
-                                  " is not a valid cplusplus file.");
+    if (separator != arguments.end()) {
+      config.programArgs.assign(std::next(separator), arguments.end());
+    }
+    // * Further .cpp paths (or globs) among the trailing arguments are
+    // * additional programs, not compiler flags.
+    std::vector<std::string> sourceArgs{
+        program.get<std::string>("sourceFilePath")};
+    std::vector<std::string> trailingFlags;
+    try {
+      for (const auto &arg :
+           program.get<std::vector<std::string>>("compiler_flags")) {
+        if (arg[0] != '-' && std::regex_match(arg, SOURCE_FILE_PATH_REGEX)) {
+          sourceArgs.push_back(arg);
+        } else {
+          trailingFlags.push_back(arg);
+        }
+      }
+    } catch (const std::exception &e) {
     }
-    if (!fileExists(config.sourceFilePath)) {
-      throw std::ios::failure(config.sourceFilePath.string() +
-                              " could not be found.");
+
+    std::set<fs::path> seenSources;
+    std::map<std::string, fs::path> seenBinaries;
+    for (const auto &sourceArg : sourceArgs) {
+      if (!std::regex_match(sourceArg, SOURCE_FILE_PATH_REGEX)) {
+        throw std::invalid_argument(sourceArg +
+                                    " is not a valid cplusplus file.");
+      }
+      std::vector<fs::path> matches{sourceArg};
+      if (isGlobPattern(sourceArg) && !fileExists(sourceArg)) {
+        matches = expandGlob(sourceArg);
+        if (matches.empty()) {
+          throw std::ios::failure(sourceArg + " matched no source files.");
+        }
+      }
+      for (const auto &source : matches) {
+        if (!fileExists(source)) {
+          throw std::ios::failure(source.string() + " could not be found.");
+        }
+        if (!seenSources.insert(normalizePath(source)).second) {
+          continue;
+        }
+        const std::string binaryName =
+            fs::path(source).filename().replace_extension("");
+        const auto [binary, inserted] =
+            seenBinaries.emplace(binaryName, source);
+        if (!inserted) {
+          throw std::invalid_argument(
+              source.string() + " and " + binary->second.string() +
+              " would both build " + binaryName + ".");
+        }
+        config.sourceFilePaths.push_back(source);
+      }
     }
 
     config.outputPath = program.get<std::string>("--output");
     config.outputFileName =
-        config.sourceFilePath.filename().replace_extension("");
+        config.sourceFilePaths.front().filename().replace_extension("");
     config.run = program.get<bool>("--run");
     config.runValgrind = program.get<bool>("--runValgrind");
-
-    try {
-      config.extraCompilerFlags =
-          program.get<std::vector<std::string>>("compiler_flags");
-    } catch (const std::exception &e) {
+    if (auto testsPath = program.present("--tests")) {
+      config.testsPath = testsPath.value();
+      if (!directoryExists(config.testsPath)) {
+        throw std::ios::failure(config.testsPath.string() +
+                                " is not a directory.");
+      }
     }
-
-    const std::string compilerArg = program.get<std::string>("--compiler");
-    if (std::regex_match(compilerArg, COMPILER_REGEX)) {
-      const auto preferredCompiler =
-          constructPreferredCompilerPath(compilerArg);
-      if (!preferredCompiler) {
-        throw std::runtime_error(
-            "Invalid compiler format. Expected 'gnu-XX' or 'clang-XX'");
+    if (config.sourceFilePaths.size() > 1 &&
+        (config.run || config.runValgrind || !config.testsPath.empty())) {
+      throw std::invalid_argument("-r, -rv and -t need a single source file.");
+    }
+    const char *makeflags = std::getenv("MAKEFLAGS");
+    const auto jobserver = parseJobserverAuth(makeflags ? makeflags : "");
+    const int defaultJobs =
+        jobserver && jobserver->slots > 0
+            ? static_cast<int>(jobserver->slots)
+            : static_cast<int>(
+                  std::max(1u, std::thread::hardware_concurrency()));
+    config.jobs =
+        std::max(1, program.present<int>("--jobs").value_or(defaultJobs));
+    config.reportFormat = program.present("--report").value_or("");
+    config.reportPath = program.present("--report-file").value_or(
+        (config.outputPath / "ccomp-report.json").string());
+    config.tracePath = program.present("--trace").value_or("");
+    config.compileProfile = program.get<bool>("--compile-profile");
+    config.scanPreambleOnly = program.get<bool>("--scan-preamble");
+    if (auto workers = program.present("--workers")) {
+      for (const auto &worker : splitString(workers.value(), ',')) {
+        if (!worker.empty())
+          config.workers.push_back(worker);
       }
-      config.compilerPath = preferredCompiler.value();
-    } else {
-      config.compilerPath = compilerArg;
     }
+    if (auto timeout = program.present<double>("--timeout")) {
+      if (!(timeout.value() > 0)) {
+        throw std::invalid_argument(
+            "--timeout must be a positive number of seconds");
+      }
+      config.timeoutSeconds = timeout.value();
+    }
+    if (auto cpuLimit = program.present<long>("--cpu-limit")) {
+      if (cpuLimit.value() <= 0) {
+        throw std::invalid_argument(
+            "--cpu-limit must be a positive number of seconds");
+      }
+      config.cpuLimitSeconds = cpuLimit.value();
+    }
+    if (auto memoryLimit = program.present("--memory-limit")) {
+      config.memoryLimitBytes = parseByteSize(memoryLimit.value());
+    }
+
+    config.extraCompilerFlags = unknownFlags;
+    config.extraCompilerFlags.insert(config.extraCompilerFlags.end(),
+                                     trailingFlags.begin(),
+                                     trailingFlags.end());
+
+    config.compilerPath =
+        resolveCompilerArg(program.get<std::string>("--compiler"));
 
     return config;
 
@@ -110,123 +250,1154 @@ bool prepare_environment(const ProgramConfig &config) {
   return true;
 }
 
+namespace {
+
 /**
- * @brief Builds the full compilation command string.
+ * @brief The units (by job index) providing the modules a unit imports.
  */
-std::string build_compile_command(const ProgramConfig &config) {
+std::vector<size_t>
+module_dependencies(const ModuleInfo &module,
+                    const std::map<std::string, size_t> &providers) {
+  std::vector<size_t> dependencies;
+  for (const auto &imported : module.imports) {
+    const auto provider = providers.find(imported);
+    if (provider != providers.end() &&
+        std::find(dependencies.begin(), dependencies.end(),
+                  provider->second) == dependencies.end()) {
+      dependencies.push_back(provider->second);
+    }
+  }
+  return dependencies;
+}
 
-  std::string command =
-      (config.compilerPath + " " + config.sourceFilePath.string() + " -o " +
-       (config.outputPath / config.outputFileName).string() + " ");
+/**
+ * @brief Orders the module units: every job importing a module depends on
+ * the job building its interface, which writes it to the BMI directory.
+ * GCC finds the interfaces through a module mapper file; clang is given
+ * each one it needs with -fmodule-file. Imports of std and std.compat
+ * (unless the project declares them) use the prebuilt standard modules,
+ * whose objects are linked into the programs that reach them.
+ */
+void add_module_flags(const ProgramConfig &config,
+                      const std::map<fs::path, ModuleInfo> &modules,
+                      const std::map<fs::path, size_t> &unitIndex,
+                      std::vector<CompileJob> &jobs,
+                      std::vector<BuildTarget> &targets) {
+  const bool clang = isClangCompiler(config.compilerPath);
+  const auto bmiDir =
+      fs::absolute(config.outputPath / BMI_DIR_NAME).lexically_normal();
+  fs::create_directories(bmiDir);
 
-  for (const auto &flag : config.extraCompilerFlags) {
-    command += flag + " ";
+  std::map<std::string, size_t> providers; // * Module name to job
+  std::map<std::string, fs::path> bmis;
+  for (const auto &[unit, module] : modules) {
+    if (!module.importable()) {
+      continue;
+    }
+    auto fileName = module.name;
+    std::replace(fileName.begin(), fileName.end(), ':', '-');
+    const size_t job = unitIndex.at(unit);
+    providers[module.name] = job;
+    bmis[module.name] = bmiDir / (fileName + (clang ? ".pcm" : ".gcm"));
+    jobs[job].bmi = bmis[module.name];
+  }
+  std::set<size_t> importsStd; // * Jobs importing a standard module
+  for (const auto &[unit, module] : modules) {
+    const size_t job = unitIndex.at(unit);
+    jobs[job].dependencies = module_dependencies(module, providers);
+    for (const auto &imported : module.imports) {
+      if (isStdModuleName(imported) && !providers.count(imported)) {
+        importsStd.insert(job);
+      }
+    }
+  }
+
+  // * Import cycles can't be built in any order.
+  std::vector<int> state(jobs.size()); // * 0 new, 1 on the path, 2 done
+  std::vector<size_t> path;
+  std::function<void(size_t)> visit = [&](size_t job) {
+    if (state[job] == 2) {
+      return;
+    }
+    path.push_back(job);
+    if (state[job] == 1) {
+      std::string cycle;
+      for (auto it = std::find(path.begin(), path.end(), job);
+           it != path.end(); ++it) {
+        cycle += (cycle.empty() ? "" : " -> ") + jobs[*it].source.string();
+      }
+      throw std::runtime_error("Module import cycle: " + cycle);
+    }
+    state[job] = 1;
+    for (const size_t dependency : jobs[job].dependencies) {
+      visit(dependency);
+    }
+    state[job] = 2;
+    path.pop_back();
+  };
+  for (size_t job = 0; job < jobs.size(); ++job) {
+    visit(job);
+  }
+
+  // * Built with the flags the module units share (not their own module
+  // * flags), so every project using the same compiler and flags reuses them.
+  StdModules stdModules;
+  std::vector<bool> reachesStd(jobs.size());
+  if (!importsStd.empty()) {
+    auto stdArgs = splitCommand(config.compilerPath);
+    stdArgs.insert(stdArgs.end(), config.extraCompilerFlags.begin(),
+                   config.extraCompilerFlags.end());
+    if (std::none_of(stdArgs.begin(), stdArgs.end(),
+                     [](const std::string &arg) {
+                       return arg.rfind("-std=", 0) == 0;
+                     })) {
+      stdArgs.push_back("-std=c++20");
+    }
+    TraceScope stdScope("std module", "setup");
+    stdModules =
+        prebuiltStdModules(stdArgs, clang, userCacheDir() / STD_MODULE_DIR);
+    bmis.insert(stdModules.bmis.begin(), stdModules.bmis.end());
+
+    // * Jobs reaching a standard module directly or through other modules
+    // * (the imports were checked for cycles above).
+    std::vector<bool> checked(jobs.size());
+    std::function<bool(size_t)> reaches = [&](size_t job) -> bool {
+      if (!checked[job]) {
+        checked[job] = true;
+        reachesStd[job] =
+            importsStd.count(job) ||
+            std::any_of(jobs[job].dependencies.begin(),
+                        jobs[job].dependencies.end(), reaches);
+      }
+      return reachesStd[job];
+    };
+    for (size_t job = 0; job < jobs.size(); ++job) {
+      reaches(job);
+    }
+    for (auto &target : targets) {
+      if (std::any_of(target.units.begin(), target.units.end(),
+                      [&](size_t unit) { return reachesStd[unit]; })) {
+        target.prebuiltObjects = stdModules.objects;
+      }
+    }
   }
 
-  const auto includePaths = ExtractHeaderSourcePairs(config.sourceFilePath);
-  for (const auto &[hppPath, cppPath] : includePaths) {
-    if (fileExists(cppPath)) {
-      command += (cppPath.string() + " ");
+  const auto mapperPath = bmiDir / "module.map";
+  if (!clang) {
+    std::ofstream mapper(mapperPath, std::ios::trunc);
+    for (const auto &[name, bmi] : bmis) {
+      if (!stdModules.bmis.count(name)) {
+        mapper << name << ' ' << bmi.string() << '\n';
+      }
+    }
+    for (const auto &line : stdModules.mapperLines) {
+      mapper << line << '\n';
+    }
+  }
+
+  for (const auto &[unit, module] : modules) {
+    auto &job = jobs[unitIndex.at(unit)];
+    std::vector<std::string> flags;
+    if (std::none_of(job.compilerArgs.begin(), job.compilerArgs.end(),
+                     [](const std::string &arg) {
+                       return arg.rfind("-std=", 0) == 0;
+                     })) {
+      flags.push_back("-std=c++20");
+    }
+    if (clang) {
+      // * Clang needs every interface the unit reaches, not just its own
+      // * imports.
+      std::set<std::string> reached;
+      std::vector<std::string> stack = module.imports;
+      while (!stack.empty()) {
+        const auto name = stack.back();
+        stack.pop_back();
+        if (!bmis.count(name) || !reached.insert(name).second) {
+          continue;
+        }
+        const auto provider = providers.find(name);
+        if (provider == providers.end()) {
+          continue; // * A standard module
+        }
+        const auto imported = modules.find(jobs[provider->second].source);
+        if (imported != modules.end()) {
+          stack.insert(stack.end(), imported->second.imports.begin(),
+                       imported->second.imports.end());
+        }
+      }
+      for (const auto &name : reached) {
+        flags.push_back("-fmodule-file=" + name + "=" + bmis[name].string());
+      }
+      if (!job.bmi.empty()) {
+        flags.push_back("-fmodule-output=" + job.bmi.string());
+      }
     } else {
-      throw std::ios::failure("Could not find required source file: " +
-                              cppPath.string());
+      flags.insert(flags.end(), {"-fmodules-ts",
+                                 "-fmodule-mapper=" + mapperPath.string()});
+    }
+    if (reachesStd[unitIndex.at(unit)]) {
+      for (const auto &[name, bmi] : stdModules.bmis) {
+        job.inputs.push_back(bmi);
+      }
+    }
+    // * Not for module units: nothing may precede their module declaration.
+    if (reachesStd[unitIndex.at(unit)] && module.name.empty() &&
+        !importsStd.count(unitIndex.at(unit))) {
+      flags.insert(flags.end(), stdModules.importerFlags.begin(),
+                   stdModules.importerFlags.end());
+    }
+    job.compilerArgs.insert(job.compilerArgs.end(), flags.begin(),
+                            flags.end());
+    const auto compile =
+        std::find(job.args.begin(), job.args.end(), "-c") - job.args.begin();
+    job.args.insert(job.args.begin() + compile, flags.begin(), flags.end());
+    // * Interface files don't have an extension compilers know as C++.
+    if (isModuleInterfaceName(job.source.filename().string())) {
+      job.args.insert(job.args.begin() + compile +
+                          static_cast<std::ptrdiff_t>(flags.size()) + 1,
+                      {"-x", clang ? "c++-module" : "c++"});
     }
   }
-  return command;
 }
 
+} // namespace
+
+/**
+ * @brief Builds one compile job per translation unit: every source file plus
+ * every paired source found through its includes. Helpers shared by several
+ * programs are compiled once and linked into each (targets[i].units).
+ */
+std::vector<CompileJob> build_compile_jobs(const ProgramConfig &config,
+                                           std::vector<BuildTarget> &targets) {
+  const auto searchDirs =
+      includeSearchDirs(config.extraCompilerFlags, getRootDir());
+
+  std::vector<fs::path> sources;
+  std::map<fs::path, size_t> unitIndex;
+  std::map<fs::path, ModuleInfo> modules;
+  auto addUnit = [&](const fs::path &source) {
+    const auto [it, inserted] =
+        unitIndex.emplace(normalizePath(source), sources.size());
+    if (inserted) {
+      sources.push_back(source);
+    }
+    return it->second;
+  };
+
+  for (const auto &sourceFilePath : config.sourceFilePaths) {
+    BuildTarget target;
+    target.sourceFilePath = sourceFilePath;
+    target.binaryPath = config.outputPath / fs::path(sourceFilePath)
+                                                .filename()
+                                                .replace_extension("");
+    target.units.push_back(addUnit(sourceFilePath));
+    std::map<fs::path, ModuleInfo> targetModules;
+    const auto includePaths = ExtractHeaderSourcePairs(
+        sourceFilePath, searchDirs, config.jobs, targetModules);
+    auto addTargetUnit = [&](const fs::path &source) {
+      const size_t unit = addUnit(source);
+      if (std::find(target.units.begin(), target.units.end(), unit) ==
+          target.units.end()) {
+        target.units.push_back(unit);
+      }
+    };
+    for (const auto &[hppPath, cppPath] : includePaths) {
+      if (!fileExists(cppPath)) {
+        throw std::ios::failure("Could not find required source file: " +
+                                cppPath.string());
+      }
+      addTargetUnit(cppPath);
+    }
+    for (const auto &[unit, module] : targetModules) {
+      addTargetUnit(unit);
+      modules.emplace(normalizePath(unit), module);
+    }
+    targets.push_back(target);
+  }
+
+  const auto objectDir = config.outputPath / OBJECT_DIR_NAME;
+  std::vector<CompileJob> jobs;
+  for (const auto &source : sources) {
+    CompileJob job;
+    job.source = source;
+    job.object = objectPathFor(source, objectDir);
+    job.compilerArgs = splitCommand(config.compilerPath);
+    job.compilerArgs.insert(job.compilerArgs.end(),
+                            config.extraCompilerFlags.begin(),
+                            config.extraCompilerFlags.end());
+    if (config.compileProfile) {
+      job.compilerArgs.push_back(isClangCompiler(config.compilerPath)
+                                     ? "-ftime-trace"
+                                     : "-ftime-report");
+    }
+    job.args = job.compilerArgs;
+    job.args.insert(job.args.end(),
+                    {"-c", source.string(), "-o", job.object.string(), "-MMD",
+                     "-MF", fs::path(job.object).concat(".d").string()});
+    jobs.push_back(job);
+  }
+  if (!modules.empty()) {
+    add_module_flags(config, modules, unitIndex, jobs, targets);
+  }
+  return jobs;
+}
+
+namespace {
+
+bool has_limits(const ProgramConfig &config) {
+  return config.timeoutSeconds > 0 || config.cpuLimitSeconds > 0 ||
+         config.memoryLimitBytes > 0;
+}
+
+/**
+ * @brief Builds the options every executed program runs under (limits).
+ */
+ProcessOptions make_process_options(const ProgramConfig &config) {
+  ProcessOptions options;
+  options.timeoutSeconds = config.timeoutSeconds;
+  options.cpuLimitSeconds = config.cpuLimitSeconds;
+  options.memoryLimitBytes = config.memoryLimitBytes;
+  return options;
+}
+
+std::string describe_usage(const ProcessResult &result) {
+  std::ostringstream usage;
+  usage << std::fixed << std::setprecision(2) << "wall " << result.wallSeconds
+        << " s, cpu " << result.cpuSeconds << " s, peak memory "
+        << result.maxRssKb << " KB";
+  return usage.str();
+}
+
+/**
+ * @brief Helper objects linked into more than one program, collected into a
+ * thin archive (it only references the objects in the object dir).
+ */
+struct SharedArchive {
+  fs::path path;
+  std::set<size_t> units;
+};
+
+/**
+ * @brief (Re)builds the shared archive when its members or any member object
+ * changed. If ar fails the programs simply link the objects directly.
+ */
+SharedArchive archive_shared_units(const ProgramConfig &config,
+                                   const std::vector<BuildTarget> &targets,
+                                   const std::vector<CompileJob> &jobs) {
+  std::map<size_t, size_t> users;
+  for (const auto &target : targets) {
+    // * units[0] is the program's own main source.
+    for (size_t i = 1; i < target.units.size(); ++i) {
+      ++users[target.units[i]];
+    }
+  }
+  SharedArchive archive;
+  for (const auto &[unit, count] : users) {
+    if (count > 1) {
+      archive.units.insert(unit);
+    }
+  }
+  if (archive.units.empty()) {
+    return archive;
+  }
+
+  const auto objectDir = config.outputPath / OBJECT_DIR_NAME;
+  const auto archivePath = objectDir / SHARED_ARCHIVE_NAME;
+  std::vector<std::string> arArgs{"ar", "rcsT", archivePath.string()};
+  for (const size_t unit : archive.units) {
+    arArgs.push_back(jobs[unit].object.string());
+  }
+  const auto commandPath = fs::path(archivePath).concat(".cmd");
+
+  std::error_code ec;
+  bool upToDate = false;
+  const auto archiveTime = fs::last_write_time(archivePath, ec);
+  if (!ec) {
+    std::ifstream commandFile(commandPath);
+    std::string previousCommand;
+    std::getline(commandFile, previousCommand);
+    upToDate = previousCommand == joinCommand(arArgs);
+    for (const size_t unit : archive.units) {
+      const auto objectTime = fs::last_write_time(jobs[unit].object, ec);
+      upToDate = upToDate && !ec && objectTime <= archiveTime;
+    }
+  }
+
+  if (!upToDate) {
+    TraceScope archiveScope("archive", "link", archivePath.string());
+    // * 'ar r' keeps members that are gone from the list, so start over.
+    fs::remove(archivePath, ec);
+    ProcessOptions options;
+    options.onOutput = [](const char *, size_t) {};
+    options.mergeStderr = true;
+    if (runProcess(arArgs, options).exitCode != 0) {
+      return {};
+    }
+    std::ofstream(commandPath) << joinCommand(arArgs);
+  }
+  archive.path = archivePath;
+  return archive;
+}
+
+std::vector<std::string> link_command(const ProgramConfig &config,
+                                      const BuildTarget &target,
+                                      const std::vector<CompileJob> &jobs,
+                                      const SharedArchive &archive) {
+  std::vector<std::string> linkArgs = splitCommand(config.compilerPath);
+  // * The archive is linked whole (a plain archive would drop helpers only
+  // * reachable through static initializers), so only a program made of
+  // * every member can use it; others link their objects directly.
+  size_t archivedUnits = 0;
+  for (const size_t unit : target.units) {
+    archivedUnits += archive.units.count(unit);
+  }
+  const bool usesArchive =
+      !archive.path.empty() && archivedUnits == archive.units.size();
+  for (const size_t unit : target.units) {
+    if (!usesArchive || !archive.units.count(unit)) {
+      linkArgs.push_back(jobs[unit].object.string());
+    }
+  }
+  if (usesArchive) {
+    linkArgs.insert(linkArgs.end(), {"-Wl,--whole-archive",
+                                     archive.path.string(),
+                                     "-Wl,--no-whole-archive"});
+  }
+  for (const auto &object : target.prebuiltObjects) {
+    linkArgs.push_back(object.string());
+  }
+  linkArgs.insert(linkArgs.end(), config.extraCompilerFlags.begin(),
+                  config.extraCompilerFlags.end());
+  linkArgs.insert(linkArgs.end(), {"-o", target.binaryPath.string()});
+  return linkArgs;
+}
+
+bool is_link_up_to_date(const BuildTarget &target,
+                        const fs::path &linkCommandPath,
+                        const std::vector<std::string> &linkArgs,
+                        const std::vector<CompileJob> &compileJobs) {
+  std::error_code ec;
+  const auto binaryTime = fs::last_write_time(target.binaryPath, ec);
+  if (ec) {
+    return false;
+  }
+  std::ifstream commandFile(linkCommandPath);
+  std::string previousCommand;
+  std::getline(commandFile, previousCommand);
+  if (previousCommand != joinCommand(linkArgs)) {
+    return false;
+  }
+  for (const size_t unit : target.units) {
+    const auto objectTime = fs::last_write_time(compileJobs[unit].object, ec);
+    if (ec || objectTime > binaryTime) {
+      return false;
+    }
+  }
+  for (const auto &object : target.prebuiltObjects) {
+    const auto objectTime = fs::last_write_time(object, ec);
+    if (ec || objectTime > binaryTime) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Links one program, unless its binary is already newer than every
+ * object it's made of. Linker diagnostics are collected in output.
+ */
+void link_target(const ProgramConfig &config, BuildTarget &target,
+                 const std::vector<CompileJob> &compileJobs,
+                 const SharedArchive &archive, std::string &output) {
+  const auto linkArgs = link_command(config, target, compileJobs, archive);
+  const auto linkCommandPath =
+      config.outputPath / OBJECT_DIR_NAME /
+      fs::path(target.binaryPath.filename()).concat(".link");
+  target.linkCached = is_link_up_to_date(target, linkCommandPath, linkArgs,
+                                         compileJobs);
+  if (!target.linkCached) {
+    JobToken slot;
+    TraceScope linkScope("link", "link", target.binaryPath.string());
+    ProcessOptions options;
+    options.mergeStderr = true;
+    options.onOutput = [&output](const char *data, size_t size) {
+      output.append(data, size);
+    };
+    shareJobserver(options);
+    const auto result = runProcess(linkArgs, options);
+    target.linkSeconds = result.wallSeconds;
+    if (result.exitCode != 0) {
+      return;
+    }
+    std::ofstream(linkCommandPath) << joinCommand(linkArgs);
+  }
+  std::error_code ec;
+  target.binarySize = fs::file_size(target.binaryPath, ec);
+  target.linked = true;
+}
+
+} // namespace
+
 /**
  * @brief Executes the compile command and (if successful) the run/valgrind
- * command.
+ * command. Returns 0 on success, the failure's ErrorType code otherwise.
  */
 int execute_commands(const ProgramConfig &config,
-                     const std::string &compileCommand) {
+                     const std::vector<CompileJob> &compileJobs,
+                     BuildReport &report) {
+
+  // * Run compilation (one job per translation unit)
+  // * gcc prints -ftime-report to stderr; report_compile_profile() splits it
+  // * from the diagnostics, so don't echo it here.
+  const bool profileGcc =
+      config.compileProfile && !isClangCompiler(config.compilerPath);
+  CompileOptions compileOptions;
+  compileOptions.jobs = config.jobs;
+  compileOptions.echoOutput = !profileGcc;
+  compileOptions.stateTable = config.outputPath / FILE_STATE_NAME;
+  // * Profiles are written next to the object, so profiling stays local.
+  if (!config.compileProfile) {
+    compileOptions.workers = config.workers;
+  }
+  report.compiles = runCompileJobs(compileJobs, compileOptions);
+  if (config.compileProfile) {
+    report_compile_profile(config, compileJobs, report.compiles);
+  }
+  for (size_t i = 0; i < compileJobs.size(); ++i) {
+    if (!report.compiles[i].succeeded) {
+      return exitError(ErrorType::COMPILATION_FAIL, "Compilation Failed",
+                       joinCommand(compileJobs[i].args));
+    }
+  }
 
-  // * Run compilation
-  if (safeSystemCall(compileCommand) != 0) {
-    return exitError(ErrorType::COMPILATION_FAIL, "Compilation Failed",
-                     compileCommand);
+  // * Link every program (in parallel when there are several), with the
+  // * helpers they share taken from one archive
+  const auto archive =
+      archive_shared_units(config, report.targets, compileJobs);
+  std::atomic<size_t> nextTarget{0};
+  std::mutex outputMutex;
+  auto linker = [&]() {
+    for (size_t i = nextTarget++; i < report.targets.size();
+         i = nextTarget++) {
+      std::string output;
+      link_target(config, report.targets[i], compileJobs, archive, output);
+      if (!output.empty()) {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        std::cerr << output << std::flush;
+      }
+    }
+  };
+  const size_t linkerCount =
+      std::max<size_t>(1, std::min(config.jobs, report.targets.size()));
+  std::vector<std::thread> linkers;
+  for (size_t i = 1; i < linkerCount; ++i) {
+    linkers.emplace_back([&linker, i]() {
+      traceNameThread("link worker " + std::to_string(i));
+      linker();
+    });
+  }
+  linker();
+  for (auto &thread : linkers) {
+    thread.join();
+  }
+  for (const auto &target : report.targets) {
+    if (!target.linked) {
+      return exitError(
+          ErrorType::COMPILATION_FAIL, "Linking Failed",
+          joinCommand(link_command(config, target, compileJobs, archive)));
+    }
   }
 
   // * Run execution (if requested)
   if (config.run || config.runValgrind) {
-    std::string runCommand{};
+    std::vector<std::string> runArgs;
     if (config.runValgrind) {
-      runCommand = "valgrind ";
+      runArgs.push_back("valgrind");
     }
-    runCommand += (config.outputPath / config.outputFileName).string();
+    runArgs.push_back((config.outputPath / config.outputFileName).string());
+    runArgs.insert(runArgs.end(), config.programArgs.begin(),
+                   config.programArgs.end());
 
-    if (safeSystemCall(runCommand) != 0) {
+    std::string runCommand{};
+    for (const auto &arg : runArgs) {
+      runCommand += (runCommand.empty() ? "" : " ") + arg;
+    }
+
+    // * stdin/stdout/stderr are inherited, so the program talks to the
+    // * terminal (or pipes) directly instead of through a buffer.
+    const auto runStart = TraceClock::now();
+    const auto result = runProcess(runArgs, make_process_options(config));
+    traceRecord("run", "run", runStart, TraceClock::now(), runCommand);
+    report.run = result;
+    if (result.limitHit != ResourceLimit::NONE) {
+      return exitError(ErrorType::LIMIT_EXCEEDED,
+                       "Execution stopped: " + limitName(result.limitHit) +
+                           " exceeded (" + describe_usage(result) + ")",
+                       runCommand);
+    }
+    if (has_limits(config)) {
+      std::cerr << "- " << describe_usage(result) << '\n';
+    }
+    if (result.exitCode != 0) {
       return exitError(ErrorType::EXECUTION_FAIL, "Execution Failed",
                        runCommand);
     }
   }
 
-  return true;
+  // * Run test cases (if requested)
+  if (!config.testsPath.empty()) {
+    return run_tests(config, report);
+  }
+
+  return 0;
 }
 
-int main(int argc, char **argv) {
+namespace {
 
+/**
+ * @brief Compares a stream of output chunks against an expected-output file
+ * without buffering either side. Trailing whitespace is ignored.
+ */
+class OutputComparer {
+public:
+  explicit OutputComparer(const fs::path &expectedPath)
+      : expected(expectedPath, std::ios::binary) {}
+
+  void feed(const char *data, size_t size) {
+    for (size_t i = 0; i < size && !mismatch; ++i) {
+      if (diverged) {
+        mismatch = !isSpace(data[i]);
+        continue;
+      }
+      const int next = expected.get();
+      if (next == std::char_traits<char>::eof() ||
+          static_cast<char>(next) != data[i]) {
+        // * Diverging is fine only if both remaining sides are whitespace.
+        diverged = true;
+        mismatch = !isSpace(data[i]) ||
+                   (next != std::char_traits<char>::eof() &&
+                    !isSpace(static_cast<char>(next)));
+      }
+    }
+  }
+
+  bool matched() {
+    if (mismatch) {
+      return false;
+    }
+    int next;
+    while ((next = expected.get()) != std::char_traits<char>::eof()) {
+      if (!isSpace(static_cast<char>(next))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool isOpen() const { return expected.is_open(); }
+
+private:
+  static bool isSpace(char c) {
+    return std::isspace(static_cast<unsigned char>(c));
+  }
+
+  std::ifstream expected;
+  bool diverged = false;
+  bool mismatch = false;
+};
+
+} // namespace
+
+/**
+ * @brief Runs the compiled binary against every <case>.in file in the tests
+ * directory in parallel and reports verdict, time and memory per case.
+ * Returns 0 when every case passes, an ErrorType code otherwise.
+ */
+int run_tests(const ProgramConfig &config, BuildReport &report) {
+  std::vector<TestCase> cases;
+  for (const auto &entry : fs::directory_iterator(config.testsPath)) {
+    if (entry.is_regular_file() && entry.path().extension() == ".in") {
+      TestCase testCase;
+      testCase.inputPath = entry.path();
+      testCase.expectedPath = fs::path(entry.path()).replace_extension(".out");
+      cases.push_back(testCase);
+    }
+  }
+  if (cases.empty()) {
+    return exitError(ErrorType::FILE_IO_ERROR, "No test cases (*.in) found",
+                     config.testsPath.string());
+  }
+  std::sort(cases.begin(), cases.end(),
+            [](const TestCase &a, const TestCase &b) {
+              return a.inputPath < b.inputPath;
+            });
+
+  std::vector<std::string> runArgs{config.outputPath / config.outputFileName};
+  runArgs.insert(runArgs.end(), config.programArgs.begin(),
+                 config.programArgs.end());
+  std::atomic<size_t> nextCase{0};
+  auto worker = [&]() {
+    for (size_t i = nextCase++; i < cases.size(); i = nextCase++) {
+      auto &testCase = cases[i];
+      OutputComparer comparer(testCase.expectedPath);
+      if (!comparer.isOpen()) {
+        testCase.error = "missing " + testCase.expectedPath.filename().string();
+        continue;
+      }
+
+      JobToken slot;
+      ProcessOptions options = make_process_options(config);
+      options.stdinPath = testCase.inputPath;
+      options.onOutput = [&](const char *data, size_t size) {
+        comparer.feed(data, size);
+      };
+      try {
+        TraceScope caseScope("test " + testCase.inputPath.stem().string(),
+                             "run", testCase.inputPath.string());
+        testCase.result = runProcess(runArgs, options);
+      } catch (const std::exception &e) {
+        testCase.error = e.what();
+        continue;
+      }
+
+      if (testCase.result.limitHit != ResourceLimit::NONE) {
+        testCase.error = limitName(testCase.result.limitHit) + " exceeded";
+      } else if (testCase.result.exitCode != 0) {
+        testCase.error =
+            "exit code " + std::to_string(testCase.result.exitCode);
+      } else {
+        testCase.passed = comparer.matched();
+        if (!testCase.passed)
+          testCase.error = "wrong answer";
+      }
+    }
+  };
+
+  const size_t workerCount = std::min<size_t>(cases.size(), config.jobs);
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < workerCount; ++i) {
+    workers.emplace_back([&worker, i]() {
+      traceNameThread("test worker " + std::to_string(i + 1));
+      worker();
+    });
+  }
+  for (auto &thread : workers) {
+    thread.join();
+  }
+
+  size_t passedCount = 0;
+  for (const auto &testCase : cases) {
+    passedCount += testCase.passed;
+    std::cout << (testCase.passed ? "\033[32m[PASS]\033[0m "
+                                  : "\033[31m[FAIL]\033[0m ")
+              << std::left << std::setw(16)
+              << testCase.inputPath.stem().string() << std::right
+              << std::fixed << std::setprecision(1) << std::setw(9)
+              << testCase.result.wallSeconds * 1000 << " ms" << std::setw(9)
+              << testCase.result.maxRssKb << " KB";
+    if (!testCase.passed) {
+      std::cout << "  (" << testCase.error << ")";
+    }
+    std::cout << '\n';
+  }
+  std::cout << passedCount << "/" << cases.size() << " test cases passed\n";
+  report.tests = cases;
+
+  if (passedCount != cases.size()) {
+    return exitError(ErrorType::TESTS_FAILED, "Some test cases failed",
+                     config.testsPath.string());
+  }
+  return 0;
+}
+
+/**
+ * @brief Aggregates the per-TU compile profiles and prints the rankings.
+ * Reports are kept next to the objects so cached TUs still contribute.
+ */
+void report_compile_profile(const ProgramConfig &config,
+                            const std::vector<CompileJob> &compileJobs,
+                            const std::vector<CompileOutcome> &outcomes) {
+  const bool clang = isClangCompiler(config.compilerPath);
+  const std::string reportMarker = "\nTime variable";
+  CompileProfile profile;
+
+  for (size_t i = 0; i < compileJobs.size(); ++i) {
+    const auto &job = compileJobs[i];
+    const auto &outcome = outcomes[i];
+    try {
+      if (clang) {
+        // * clang writes the trace next to the object: x.cpp.o -> x.cpp.json
+        addClangTimeTrace(profile, job.source,
+                          fs::path(job.object).replace_extension(".json"));
+        continue;
+      }
+
+      const auto reportPath = fs::path(job.object).concat(".time-report");
+      if (!outcome.cached) {
+        const auto markerPos = outcome.output.find(reportMarker);
+        std::cerr << outcome.output.substr(0, markerPos);
+        if (markerPos != std::string::npos) {
+          std::ofstream(reportPath) << outcome.output.substr(markerPos);
+        }
+      }
+      std::ifstream reportFile(reportPath);
+      std::stringstream content;
+      content << reportFile.rdbuf();
+      addGccTimeReport(profile, job.source, content.str());
+    } catch (const std::exception &e) {
+      std::cerr << "- Skipping profile of " << job.source.string() << ": "
+                << e.what() << '\n';
+    }
+  }
+
+  if (!clang) {
+    std::cout << "\nNote: gcc only reports per-phase totals; use a clang "
+                 "compiler (-c clang-XX) for header and template rankings.\n";
+  }
+  printCompileProfile(std::cout, profile, PROFILE_REPORT_LIMIT);
+}
+
+namespace {
+
+void write_process_result(JsonWriter &json, const ProcessResult &result) {
+  json.field("exitCode", result.exitCode)
+      .field("signal", result.termSignal)
+      .field("wallSeconds", result.wallSeconds)
+      .field("cpuSeconds", result.cpuSeconds)
+      .field("maxRssKb", result.maxRssKb)
+      .field("limitHit", result.limitHit == ResourceLimit::NONE
+                             ? std::string()
+                             : limitName(result.limitHit));
+}
+
+} // namespace
+
+/**
+ * @brief Writes the build/run record as a single JSON document.
+ */
+bool write_report(const ProgramConfig &config, const BuildReport &report) {
+  std::ofstream file(config.reportPath);
+  if (!file.is_open()) {
+    return false;
+  }
+
+  const auto now = std::chrono::system_clock::to_time_t(
+      std::chrono::system_clock::now());
+  char timestamp[32];
+  std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ",
+                std::gmtime(&now));
+
+  JsonWriter json(file);
+  json.beginObject()
+      .field("timestamp", timestamp)
+      .field("workingDirectory", getRootDir())
+      .field("compiler", config.compilerPath);
+
+  json.key("flags").beginArray();
+  for (const auto &flag : config.extraCompilerFlags) {
+    json.value(flag);
+  }
+  json.endArray();
+
+  json.key("sources").beginArray();
+  for (const auto &source : report.sources) {
+    json.value(source.string());
+  }
+  json.endArray();
+
+  json.key("compiles").beginArray();
+  for (const auto &compile : report.compiles) {
+    json.beginObject()
+        .field("source", compile.source.string())
+        .field("cached", compile.cached)
+        .field("executor", compile.executor)
+        .field("succeeded", compile.succeeded)
+        .field("seconds", compile.seconds)
+        .endObject();
+  }
+  json.endArray();
+
+  json.key("targets").beginArray();
+  for (const auto &target : report.targets) {
+    json.beginObject()
+        .field("source", target.sourceFilePath.string())
+        .field("binary", target.binaryPath.string());
+    json.key("link")
+        .beginObject()
+        .field("cached", target.linkCached)
+        .field("seconds", target.linkSeconds)
+        .field("binarySize", static_cast<long long>(target.binarySize))
+        .endObject();
+    json.endObject();
+  }
+  json.endArray();
+
+  if (report.run) {
+    json.key("run").beginObject();
+    write_process_result(json, report.run.value());
+    json.endObject();
+  }
+
+  if (!report.tests.empty()) {
+    json.key("tests").beginArray();
+    for (const auto &testCase : report.tests) {
+      json.beginObject()
+          .field("name", testCase.inputPath.stem().string())
+          .field("passed", testCase.passed)
+          .field("error", testCase.error);
+      write_process_result(json, testCase.result);
+      json.endObject();
+    }
+    json.endArray();
+  }
+
+  json.field("exitStatus", report.exitStatus).endObject();
+  file << '\n';
+  return static_cast<bool>(file);
+}
+
+/**
+ * @brief The regular compile (and run) flow for one invocation.
+ */
+int run_ccomp(int argc, char **argv) {
+
+  const auto parseStart = TraceClock::now();
   auto config_opt = parse_args(argc, argv);
   if (!config_opt) {
     return static_cast<int>(ErrorType::ARGUMENT_PARSING_ERROR);
   }
 
   auto config = config_opt.value();
+  if (!config.tracePath.empty()) {
+    traceEnable();
+    traceRecord("parse arguments", "setup", parseStart, TraceClock::now());
+  }
   if (!prepare_environment(config)) {
     return static_cast<int>(ErrorType::PROCESS_ABORTED);
   }
+  // * Before any worker thread or child process starts.
+  jobserverSetup(config.jobs);
+  setScanPreambleOnly(config.scanPreambleOnly);
+  if (!config.scanPreambleOnly) {
+    TraceScope probeScope("probe compiler", "setup");
+    auto compilerArgs = splitCommand(config.compilerPath);
+    compilerArgs.insert(compilerArgs.end(), config.extraCompilerFlags.begin(),
+                        config.extraCompilerFlags.end());
+    const auto probe = queryCompiler(compilerArgs);
+    setScanMacros(probe.macros, probe.includeDirs);
+  }
 
-  std::string compile_command;
+  BuildReport report;
+  std::vector<CompileJob> compile_jobs;
   try {
-    compile_command = build_compile_command(config);
+    TraceScope planScope("plan build", "setup");
+    compile_jobs = build_compile_jobs(config, report.targets);
   } catch (const std::exception &e) {
     return exitError(ErrorType::FILE_IO_ERROR, e.what());
   }
-
-  if (!execute_commands(config, compile_command)) {
-    return 1;
+  for (const auto &job : compile_jobs) {
+    report.sources.push_back(job.source);
   }
 
-  return 0;
+  report.exitStatus = execute_commands(config, compile_jobs, report);
+
+  if (!config.reportFormat.empty() && !write_report(config, report)) {
+    return exitError(ErrorType::FILE_IO_ERROR, "Could not write report",
+                     config.reportPath.string());
+  }
+  if (!config.tracePath.empty() && !traceWrite(config.tracePath)) {
+    return exitError(ErrorType::FILE_IO_ERROR, "Could not write trace",
+                     config.tracePath.string());
+  }
+  return report.exitStatus;
 }
 
-std::map<fs::path, fs::path>
-ExtractHeaderSourcePairs(const fs::path &sourceFilePath) {
-  // ... (Your Tier 2 refactored logic goes here)
-  std::ifstream file(sourceFilePath);
-  if (!file.is_open()) {
-    throw std::runtime_error("Unable to open file: " + sourceFilePath.string());
+int main(int argc, char **argv) {
+
+  if (argc > 1 && std::string(argv[1]) == "analyze") {
+    return run_analyze(argc - 1, argv + 1);
+  }
+  if (argc > 1 && std::string(argv[1]) == "lint-includes") {
+    return run_lint_includes(argc - 1, argv + 1);
+  }
+  if (argc > 1 && std::string(argv[1]) == "daemon") {
+    return run_daemon(argc - 1, argv + 1);
+  }
+  if (argc > 1 && std::string(argv[1]) == "worker") {
+    return run_worker(argc - 1, argv + 1);
+  }
+  if (const auto status = run_via_daemon(argc, argv)) {
+    return status.value();
   }
 
-  // * Find all available .cpp files in the project ONCE.
-  std::map<std::string, fs::path> availableSources;
+  return run_ccomp(argc, argv);
+}
+
+/**
+ * @brief Maps every project header reachable from the source file (through
+ * its includes and the includes of paired sources) to its paired .cpp file.
+ * Includes resolve like the compiler's quoted includes (see
+ * includeSearchDirs) and the pair is probed next to the header (see
+ * findPairedSource); only includes that resolve nowhere fall back to
+ * matching a .cpp with a unique file name, listed from the git index (then,
+ * for untracked files, a directory walk).
+ * Imported C++20 modules are followed to the project source declaring them;
+ * every module unit reached ends up in `modules`.
+ * Includes are scanned on up to `threads` threads.
+ */
+std::map<fs::path, fs::path>
+ExtractHeaderSourcePairs(const fs::path &sourceFilePath,
+                         const std::vector<fs::path> &searchDirs,
+                         size_t threads,
+                         std::map<fs::path, ModuleInfo> &modules) {
+  using SourcesByName = std::map<std::string, std::vector<fs::path>>;
+  const auto mainFile = normalizePath(sourceFilePath);
   const auto rootDir = getRootDir(); // * Uses fs::current_path()
+  std::optional<SourcesByName> trackedByName;
+  std::optional<SourcesByName> walkedByName;
+  auto uniqueMatch = [](const SourcesByName &sources,
+                        const fs::path &sourceName) -> std::optional<fs::path> {
+    const auto match = sources.find(sourceName.string());
+    if (match == sources.end() || match->second.size() != 1 ||
+        !fileExists(match->second.front())) {
+      return std::nullopt;
+    }
+    return normalizePath(match->second.front());
+  };
+  // * Tracked sources come from the git index; the tree is only walked for
+  // * names the index can't settle (untracked files, or no checkout at all).
+  auto findByName = [&](const fs::path &sourceName) -> std::optional<fs::path> {
+    if (!trackedByName) {
+      TraceScope indexScope("git index", "discovery", rootDir);
+      trackedByName.emplace();
+      for (const auto &source :
+           listTrackedFiles(rootDir, ".cpp").value_or(std::vector<fs::path>{})) {
+        (*trackedByName)[source.filename().string()].push_back(source);
+      }
+    }
+    if (const auto source = uniqueMatch(*trackedByName, sourceName)) {
+      return source;
+    }
+    if (!walkedByName) {
+      TraceScope walkScope("directory walk", "discovery", rootDir);
+      walkedByName.emplace();
+      for (const auto &source : listSourceFiles(rootDir, threads)) {
+        (*walkedByName)[source.filename().string()].push_back(source);
+      }
+    }
+    return uniqueMatch(*walkedByName, sourceName);
+  };
 
-  for (const auto &entry : fs::recursive_directory_iterator(rootDir)) {
-    if (entry.is_regular_file() && entry.path().extension() == ".cpp") {
-      availableSources[entry.path().filename().string()] = entry.path();
+  // * Module name to the units declaring it: interfaces (and partitions)
+  // * import from, and implementation units linked along with them.
+  using UnitsByModule = std::map<std::string, std::vector<fs::path>>;
+  std::optional<std::pair<UnitsByModule, UnitsByModule>> moduleUnits;
+  std::set<fs::path> queuedUnits{mainFile};
+  auto findProvider = [&](const std::string &name,
+                          const fs::path &importer) -> std::optional<fs::path> {
+    if (!name.empty() && (name.front() == '<' || name.front() == '"')) {
+      throw std::runtime_error("Header units aren't supported: import " +
+                               name + " (in " + importer.string() + ")");
     }
-  }
+    if (!moduleUnits) {
+      TraceScope moduleScope("module units", "discovery", rootDir);
+      moduleUnits.emplace();
+      for (const auto &[unit, module] : listModuleUnits(rootDir, threads)) {
+        (module.importable() ? moduleUnits->first
+                             : moduleUnits->second)[module.name]
+            .push_back(unit);
+      }
+    }
+    const auto &providers = moduleUnits->first;
+    const auto found = providers.find(name);
+    if (found == providers.end() && isStdModuleName(name)) {
+      return std::nullopt; // * Prebuilt (see add_module_flags)
+    }
+    if (found == providers.end()) {
+      throw std::runtime_error("No project source provides module '" + name +
+                               "' (imported by " + importer.string() + ")");
+    }
+    if (found->second.size() > 1) {
+      throw std::runtime_error("Module '" + name + "' is declared by both " +
+                               found->second[0].string() + " and " +
+                               found->second[1].string());
+    }
+    return normalizePath(found->second.front());
+  };
 
   std::map<fs::path, fs::path> headerToSourceMap;
-  std::smatch match;
-  std::string line;
-  const std::string mainFileName = sourceFilePath.filename().string();
+  TraceScope scanScope("include scan", "discovery", sourceFilePath.string());
+  IncludeGraph graph;
+  // * A later round can add includes to a file already seen (another
+  // * unit's macros enable more of it), so pairing goes by include.
+  std::set<fs::path> pairedHeaders;
+  std::set<std::pair<fs::path, std::string>> pairedNames;
+  std::vector<fs::path> pending{sourceFilePath};
+  auto pair = [&](const fs::path &header, const fs::path &source) {
+    if (source == mainFile) {
+      return;
+    }
+    if (headerToSourceMap.emplace(header, source).second) {
+      pending.push_back(source);
+    }
+  };
 
-  while (std::getline(file, line)) {
-    if (std::regex_match(line, match, HEADER_REGEX)) {
-      fs::path headerFile = match[1].str();
-      fs::path cppFile = headerFile.replace_extension("cpp");
-      std::string cppFileName = cppFile.filename().string();
+  // * Each round scans the newly paired sources (in parallel) and pairs the
+  // * headers they reach; files are visited in sorted order, so the result
+  // * doesn't depend on scheduling.
+  while (!pending.empty()) {
+    addToIncludeGraph(graph, pending, searchDirs, threads);
+    if (!graph.errors.empty()) {
+      throw std::runtime_error(graph.errors.begin()->second);
+    }
+    pending.clear();
 
-      if (cppFileName == mainFileName)
+    for (const auto &[file, includes] : graph.edges) {
+      for (const auto &header : includes) {
+        if (!pairedHeaders.insert(header).second) {
+          continue;
+        }
+        if (const auto source = findPairedSource(header, searchDirs)) {
+          pair(header, source.value());
+        }
+      }
+      const auto unresolved = graph.unresolved.find(file);
+      if (unresolved == graph.unresolved.end()) {
         continue;
+      }
+      for (const auto &includeName : unresolved->second) {
+        if (!pairedNames.emplace(file, includeName).second) {
+          continue;
+        }
+        const auto sourceName =
+            fs::path(includeName).filename().replace_extension("cpp");
+        if (const auto source = findByName(sourceName)) {
+          pair(file.parent_path() / includeName, source.value());
+        }
+      }
+    }
 
-      if (availableSources.count(cppFileName)) {
-        fs::path fullHeaderPath = rootDir / headerFile;
-        headerToSourceMap[fullHeaderPath.replace_extension("hpp")] =
-            availableSources[cppFileName];
+    // * Imports pull in the unit providing each module, scanned next round.
+    for (const auto &[unit, module] : graph.modules) {
+      if (modules.count(unit)) {
+        continue;
+      }
+      modules.emplace(unit, module);
+      for (const auto &imported : module.imports) {
+        const auto provider = findProvider(imported, unit);
+        if (!provider || !queuedUnits.insert(provider.value()).second) {
+          continue;
+        }
+        pending.push_back(provider.value());
+        const auto implementations = moduleUnits->second.find(imported);
+        if (implementations == moduleUnits->second.end()) {
+          continue;
+        }
+        for (const auto &implementation : implementations->second) {
+          if (queuedUnits.insert(implementation).second) {
+            pending.push_back(implementation);
+          }
+        }
       }
     }
   }
@@ -245,6 +1416,32 @@ std::vector<std::string> splitString(const std::string &str, char delimiter) {
   return result;
 }
 
+/**
+ * @brief Parses a byte count with an optional K/M/G suffix (e.g. 512M); a
+ * bare number is a count of bytes.
+ */
+size_t parseByteSize(const std::string &text) {
+  size_t suffixPos = 0;
+  const double value = std::stod(text, &suffixPos);
+  const std::string suffix = text.substr(suffixPos);
+  double multiplier = 1;
+  if (suffix.empty() || suffix == "B") {
+    multiplier = 1;
+  } else if (suffix == "K" || suffix == "k" || suffix == "KB") {
+    multiplier = 1024;
+  } else if (suffix == "M" || suffix == "m" || suffix == "MB") {
+    multiplier = 1024 * 1024;
+  } else if (suffix == "G" || suffix == "g" || suffix == "GB") {
+    multiplier = 1024.0 * 1024 * 1024;
+  } else {
+    throw std::invalid_argument("Invalid size: " + text);
+  }
+  if (value <= 0) {
+    throw std::invalid_argument("Invalid size: " + text);
+  }
+  return static_cast<size_t>(value * multiplier);
+}
+
 int exitError(const ErrorType &errorType, const std::string &message,
               const std::string &source) {
   int errorCode = static_cast<int>(errorType);
@@ -267,6 +1464,69 @@ constructPreferredCompilerPath(const std::string &compilerName) {
   return constructCompilerPath(selectedCompiler, tokens[1]);
 }
 
+/**
+ * @brief Turns a --compiler value into a compiler command: 'gnu-XX' and
+ * 'clang-XX' select the compiler and standard, anything else is used as is.
+ */
+std::string resolveCompilerArg(const std::string &compilerArg) {
+  if (!std::regex_match(compilerArg, COMPILER_REGEX)) {
+    return compilerArg;
+  }
+  const auto preferredCompiler = constructPreferredCompilerPath(compilerArg);
+  if (!preferredCompiler) {
+    throw std::runtime_error(
+        "Invalid compiler format. Expected 'gnu-XX' or 'clang-XX'");
+  }
+  return preferredCompiler.value();
+}
+
+bool isClangCompiler(const std::string &compilerPath) {
+  const auto args = splitCommand(compilerPath);
+  return !args.empty() &&
+         fs::path(args.front()).filename().string().find("clang") !=
+             std::string::npos;
+}
+
+/**
+ * @brief What a compile with these arguments starts with (see
+ * probeCompiler; probes are shared by all projects through the user
+ * cache). If the compiler can't be run, only the -D and -U flags are known.
+ */
+CompilerProbe queryCompiler(const std::vector<std::string> &compilerArgs) {
+  if (auto probe =
+          probeCompiler(compilerArgs, userCacheDir() / COMPILER_PROBE_DIR)) {
+    return probe.value();
+  }
+
+  CompilerProbe probe;
+  auto &defines = probe.macros;
+  for (size_t i = 0; i < compilerArgs.size(); ++i) {
+    const auto &arg = compilerArgs[i];
+    if (arg.rfind("-D", 0) != 0 && arg.rfind("-U", 0) != 0) {
+      continue;
+    }
+    std::string macro = arg.substr(2);
+    if (macro.empty() && i + 1 < compilerArgs.size()) {
+      macro = compilerArgs[++i];
+    }
+    const auto name = macro.substr(0, macro.find_first_of("=("));
+    defines.erase(std::remove_if(defines.begin(), defines.end(),
+                                 [&name](const std::string &define) {
+                                   return define.substr(0, define.find_first_of(
+                                                               " (")) == name;
+                                 }),
+                  defines.end());
+    if (arg[1] == 'D') {
+      const auto equals = macro.find('=');
+      defines.push_back(equals == std::string::npos
+                            ? macro + " 1"
+                            : macro.substr(0, equals) + ' ' +
+                                  macro.substr(equals + 1));
+    }
+  }
+  return probe;
+}
+
 std::string constructCompilerPath(const std::string &compilerName,
                                   const std::string &compilerVersion) {
   return compilerName + " -std=c++" + compilerVersion;
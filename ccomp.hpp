@@ -7,13 +7,25 @@
 #include <vector>
 
 #include "includes/argparse/include/argparse/argparse.hpp"
+#include "includes/build_utils/build_utils.hpp"
+#include "includes/module_utils/module_utils.hpp"
+#include "includes/probe_utils/probe_utils.hpp"
+#include "includes/scan_utils/scan_utils.hpp"
+#include "includes/system_utils/system_utils.hpp"
 
 namespace Constants {
-inline const std::regex HEADER_REGEX(R"(^\s*#include\s*\"([^\"]+)\"\s*$)");
 inline const std::regex COMPILER_REGEX("^(gnu|clang)-[0-9]{2}$");
 inline const std::regex SOURCE_FILE_PATH_REGEX("^.+\\.cpp$");
 
 inline const std::string DEFAULT_OUTPUT_PATH = "./out";
+inline const std::string OBJECT_DIR_NAME = ".ccomp/obj";
+inline const std::string BMI_DIR_NAME = ".ccomp/bmi";
+inline const std::string SHARED_ARCHIVE_NAME = "libshared.a";
+inline const std::string FILE_STATE_NAME = ".ccomp/file-state";
+// * Under the user cache (see userCacheDir).
+inline const std::string COMPILER_PROBE_DIR = "compilers";
+inline const std::string STD_MODULE_DIR = "std-modules";
+inline const size_t PROFILE_REPORT_LIMIT = 15;
 }; // namespace Constants
 
 namespace fs = std::filesystem;
@@ -26,26 +38,94 @@ enum class ErrorType {
   PROCESS_ABORTED,
   FILE_IO_ERROR,
   COMPILATION_FAIL,
-  EXECUTION_FAIL
+  EXECUTION_FAIL,
+  TESTS_FAILED,
+  LIMIT_EXCEEDED
 };
 
 struct ProgramConfig {
-  fs::path sourceFilePath;
+  std::vector<fs::path> sourceFilePaths;
   fs::path outputPath;
-  std::string outputFileName;
+  std::string outputFileName; // * Binary of the first source (run by -r/-t)
   std::string compilerPath;
   bool run;
   bool runValgrind;
+  fs::path testsPath;
+  double timeoutSeconds = 0;
+  long cpuLimitSeconds = 0;
+  size_t memoryLimitBytes = 0;
   std::vector<std::string> extraCompilerFlags;
+  std::vector<std::string> programArgs;
+  size_t jobs = 1;
+  std::string reportFormat;
+  fs::path reportPath;
+  fs::path tracePath;
+  bool compileProfile = false;
+  bool scanPreambleOnly = false;
+  std::vector<std::string> workers;
+};
+
+struct TestCase {
+  fs::path inputPath;
+  fs::path expectedPath;
+  bool passed = false;
+  std::string error;
+  ProcessResult result;
+};
+
+/**
+ * @brief One program built by an invocation: its main source, the compile
+ * jobs it links (shared helpers appear in several targets) and link results.
+ */
+struct BuildTarget {
+  fs::path sourceFilePath;
+  fs::path binaryPath;
+  std::vector<size_t> units;
+  // * Objects built outside the project it links (the std module's).
+  std::vector<fs::path> prebuiltObjects;
+  bool linkCached = false;
+  bool linked = false;
+  double linkSeconds = 0;
+  std::uintmax_t binarySize = 0;
+};
+
+struct BuildReport {
+  std::vector<fs::path> sources;
+  std::vector<CompileOutcome> compiles;
+  std::vector<BuildTarget> targets;
+  std::optional<ProcessResult> run;
+  std::vector<TestCase> tests;
+  int exitStatus = 0;
 };
 
 std::vector<std::string> splitString(const std::string &, char);
-std::map<fs::path, fs::path> ExtractHeaderSourcePairs(const fs::path &);
+size_t parseByteSize(const std::string &);
+std::map<fs::path, fs::path>
+ExtractHeaderSourcePairs(const fs::path &,
+                         const std::vector<fs::path> &searchDirs,
+                         size_t threads,
+                         std::map<fs::path, ModuleInfo> &modules);
 int exitError(const ErrorType &, const std::string &, const std::string & = "");
 std::optional<std::string> constructPreferredCompilerPath(const std::string &);
 std::string constructCompilerPath(const std::string &, const std::string &);
+std::string resolveCompilerArg(const std::string &);
+bool isClangCompiler(const std::string &);
+CompilerProbe queryCompiler(const std::vector<std::string> &compilerArgs);
 std::optional<ProgramConfig> parse_args(int argc, char **argv);
 bool prepare_environment(const ProgramConfig &config);
-std::string build_compile_command(const ProgramConfig &config);
+std::vector<CompileJob> build_compile_jobs(const ProgramConfig &config,
+                                           std::vector<BuildTarget> &targets);
 int execute_commands(const ProgramConfig &config,
-                     const std::string &compileCommand);
\ No newline at end of file
+                     const std::vector<CompileJob> &compileJobs,
+                     BuildReport &report);
+int run_tests(const ProgramConfig &config, BuildReport &report);
+bool write_report(const ProgramConfig &config, const BuildReport &report);
+int run_ccomp(int argc, char **argv);
+int run_analyze(int argc, char **argv);
+int run_lint_includes(int argc, char **argv);
+int run_daemon(int argc, char **argv);
+int run_worker(int argc, char **argv);
+std::optional<int> run_via_daemon(int argc, char **argv);
+void report_compile_profile(const ProgramConfig &config,
+                            const std::vector<CompileJob> &compileJobs,
+                            const std::vector<CompileOutcome> &outcomes);
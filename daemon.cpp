@@ -0,0 +1,402 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+#include "./ccomp.hpp"
+#include "includes/file_utils/file_utils.hpp"
+#include "includes/jobserver_utils/jobserver_utils.hpp"
+#include "includes/scan_utils/scan_utils.hpp"
+#include "includes/socket_utils/socket_utils.hpp"
+
+extern char **environ;
+
+namespace {
+
+const std::string DAEMON_PROTOCOL = "ccomp-daemon/1";
+// * How long a connected client may take to send its request.
+const int REQUEST_TIMEOUT_MS = 5000;
+
+fs::path daemon_socket_directory() {
+  const char *runtimeDir = std::getenv("XDG_RUNTIME_DIR");
+  if (runtimeDir && *runtimeDir) {
+    return runtimeDir;
+  }
+  const fs::path directory = "/tmp/ccomp-" + std::to_string(getuid());
+  mkdir(directory.c_str(), 0700);
+  return directory;
+}
+
+/**
+ * @brief Where the daemon listens, or "" when the directory isn't private to
+ * us: a real directory (not a symlink) we own with mode 0700. Otherwise
+ * another user who created /tmp/ccomp-UID first could swap the socket and
+ * receive our stdio and environment.
+ */
+std::string daemon_socket_path() {
+  const fs::path directory = daemon_socket_directory();
+  struct stat info {};
+  if (lstat(directory.c_str(), &info) != 0 || !S_ISDIR(info.st_mode) ||
+      info.st_uid != getuid() || (info.st_mode & 0777) != 0700) {
+    return "";
+  }
+  return (directory / "ccomp.sock").string();
+}
+
+/**
+ * @brief Parses a decimal count from a message field; nullopt if it isn't one.
+ */
+std::optional<size_t> parse_count(const std::string &field) {
+  if (field.empty() ||
+      !std::all_of(field.begin(), field.end(),
+                   [](unsigned char c) { return std::isdigit(c); })) {
+    return std::nullopt;
+  }
+  try {
+    return std::stoul(field);
+  } catch (const std::exception &) {
+    return std::nullopt;
+  }
+}
+
+/**
+ * @brief Identifies the ccomp binary, so a daemon started from an older build
+ * never serves a newer client (or the other way around).
+ */
+std::string executable_stamp() {
+  const auto stamp = statFile("/proc/self/exe");
+  if (!stamp) {
+    return "";
+  }
+  return std::to_string(stamp->mtimeNs) + ":" + std::to_string(stamp->size);
+}
+
+/**
+ * @brief Starts `ccomp daemon --foreground` fully detached (double fork).
+ */
+void spawn_daemon() {
+  const pid_t pid = fork();
+  if (pid == 0) {
+    setsid();
+    if (fork() == 0) {
+      const int devNull = open("/dev/null", O_RDWR);
+      dup2(devNull, STDIN_FILENO);
+      dup2(devNull, STDOUT_FILENO);
+      dup2(devNull, STDERR_FILENO);
+      execl("/proc/self/exe", "ccomp", "daemon", "--foreground", nullptr);
+    }
+    _exit(0);
+  }
+  if (pid > 0) {
+    waitpid(pid, nullptr, 0);
+  }
+}
+
+int connect_or_spawn(const std::string &socketPath) {
+  int fd = connectUnix(socketPath);
+  if (fd >= 0) {
+    return fd;
+  }
+  spawn_daemon();
+  for (int attempt = 0; attempt < 100 && fd < 0; ++attempt) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    fd = connectUnix(socketPath);
+  }
+  return fd;
+}
+
+/**
+ * @brief Runs one client request in a forked child: the child adopts the
+ * client's cwd, environment and stdio, runs the normal ccomp flow against the
+ * daemon's warm caches, and ships newly scanned files back over deltaFd.
+ */
+[[noreturn]] void serve_request(int clientFd, const std::vector<int> &stdio,
+                                const std::vector<std::string> &fields,
+                                int deltaFd) {
+  signal(SIGPIPE, SIG_DFL);
+  for (size_t i = 0; i < stdio.size() && i < 3; ++i) {
+    dup2(stdio[i], static_cast<int>(i));
+  }
+
+  const std::string &cwd = fields[2];
+  const size_t argc = parse_count(fields[3]).value();
+  std::vector<std::string> arguments(fields.begin() + 4,
+                                     fields.begin() + 4 + argc);
+  clearenv();
+  for (size_t i = 4 + argc; i < fields.size(); ++i) {
+    putenv(strdup(fields[i].c_str()));
+  }
+
+  int status = static_cast<int>(ErrorType::FILE_IO_ERROR);
+  if (chdir(cwd.c_str()) == 0) {
+    std::vector<char *> argv;
+    for (auto &argument : arguments) {
+      argv.push_back(argument.data());
+    }
+    argv.push_back(nullptr);
+    status = run_ccomp(static_cast<int>(arguments.size()), argv.data());
+  }
+  std::cout.flush();
+  std::cerr.flush();
+
+  const std::string delta = exportScanCache(true);
+  for (size_t written = 0; written < delta.size();) {
+    const ssize_t count =
+        write(deltaFd, delta.data() + written, delta.size() - written);
+    if (count <= 0)
+      break;
+    written += static_cast<size_t>(count);
+  }
+  sendMessage(clientFd, joinFields({"exit", std::to_string(status)}));
+  _exit(0);
+}
+
+} // namespace
+
+/**
+ * @brief Forwards this invocation to the background daemon when CCOMP_DAEMON
+ * is set, starting the daemon if needed. Returns nullopt if the invocation
+ * should run locally instead.
+ */
+std::optional<int> run_via_daemon(int argc, char **argv) {
+  const char *enabled = std::getenv("CCOMP_DAEMON");
+  if (!enabled || std::string(enabled).empty() ||
+      std::string(enabled) == "0") {
+    return std::nullopt;
+  }
+  // * A pipe-based make jobserver lives in inherited fds the daemon can't
+  // * reach, so join it from this process instead.
+  const char *makeflags = std::getenv("MAKEFLAGS");
+  const auto jobserver = parseJobserverAuth(makeflags ? makeflags : "");
+  if (jobserver && jobserver->fifoPath.empty()) {
+    return std::nullopt;
+  }
+
+  const std::string socketPath = daemon_socket_path();
+  if (socketPath.empty()) {
+    return std::nullopt;
+  }
+  const int fd = connect_or_spawn(socketPath);
+  if (fd < 0) {
+    return std::nullopt;
+  }
+  if (peerUid(fd) != getuid()) {
+    close(fd);
+    return std::nullopt;
+  }
+
+  std::vector<std::string> fields{DAEMON_PROTOCOL, executable_stamp(),
+                                  getRootDir(), std::to_string(argc)};
+  fields.insert(fields.end(), argv, argv + argc);
+  for (char **variable = environ; *variable; ++variable) {
+    fields.emplace_back(*variable);
+  }
+
+  std::optional<std::string> reply;
+  if (sendMessageWithFds(fd, joinFields(fields),
+                         {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO})) {
+    reply = receiveMessage(fd);
+  }
+  close(fd);
+  if (!reply) {
+    return std::nullopt;
+  }
+
+  const auto replyFields = splitFields(reply.value());
+  if (replyFields.size() == 2 && replyFields[0] == "exit") {
+    const auto status = parse_count(replyFields[1]);
+    return status ? static_cast<int>(status.value())
+                  : static_cast<int>(ErrorType::PROCESS_ABORTED);
+  }
+  // * "stale": the daemon belongs to another ccomp build and is exiting.
+  spawn_daemon();
+  return std::nullopt;
+}
+
+/**
+ * @brief `ccomp daemon`: keeps the source index and include scans of every
+ * project it has served in memory, so repeated builds skip the directory
+ * walk and rescans of unchanged files.
+ */
+int run_daemon(int argc, char **argv) {
+  argparse::ArgumentParser program("ccomp daemon");
+  program.add_description(
+      "Background compile server. Clients use it when CCOMP_DAEMON=1 is set "
+      "(it is started automatically).");
+  program.add_argument("--foreground")
+      .help("Don't detach from the terminal.")
+      .flag();
+  program.add_argument("--stop").help("Stops the running daemon.").flag();
+  program.add_argument("--idle-timeout")
+      .help("Exit after this many idle minutes.")
+      .default_value(30)
+      .scan<'i', int>();
+
+  try {
+    program.parse_args(argc, argv);
+  } catch (const std::exception &e) {
+    return exitError(ErrorType::ARGUMENT_PARSING_ERROR, e.what());
+  }
+
+  const std::string socketPath = daemon_socket_path();
+  if (socketPath.empty()) {
+    return exitError(ErrorType::FILE_IO_ERROR,
+                     "The daemon's socket directory must be a directory "
+                     "owned by you with mode 0700",
+                     daemon_socket_directory().string());
+  }
+  if (program.get<bool>("--stop")) {
+    const int fd = connectUnix(socketPath);
+    if (fd < 0) {
+      return exitError(ErrorType::FILE_IO_ERROR, "No daemon is running",
+                       socketPath);
+    }
+    sendMessageWithFds(fd, joinFields({"stop"}), {});
+    close(fd);
+    return 0;
+  }
+
+  const int probe = connectUnix(socketPath);
+  if (probe >= 0) {
+    close(probe);
+    return exitError(ErrorType::PROCESS_ABORTED, "A daemon is already running",
+                     socketPath);
+  }
+  unlink(socketPath.c_str());
+  // * Create the socket 0600 from the start, so nobody else can connect
+  // * between bind() and a later chmod().
+  const mode_t previousMask = umask(0177);
+  const int listenFd = listenUnix(socketPath);
+  umask(previousMask);
+  if (listenFd < 0) {
+    return exitError(ErrorType::FILE_IO_ERROR, "Could not listen on socket",
+                     socketPath);
+  }
+
+  if (!program.get<bool>("--foreground")) {
+    std::cout << "ccomp daemon listening on " << socketPath << '\n';
+    std::cout.flush();
+    if (fork() != 0) {
+      return 0;
+    }
+    setsid();
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  const std::string ownStamp = executable_stamp();
+  const auto idleTimeout = std::chrono::minutes(program.get<int>("--idle-timeout"));
+  auto lastActivity = std::chrono::steady_clock::now();
+  std::map<int, std::string> pendingDeltas;
+  size_t runningChildren = 0;
+
+  while (true) {
+    while (waitpid(-1, nullptr, WNOHANG) > 0) {
+      --runningChildren;
+      lastActivity = std::chrono::steady_clock::now();
+    }
+    if (runningChildren == 0 && pendingDeltas.empty() &&
+        std::chrono::steady_clock::now() - lastActivity > idleTimeout) {
+      break;
+    }
+
+    std::vector<pollfd> pollFds{{listenFd, POLLIN, 0}};
+    for (const auto &[fd, buffer] : pendingDeltas) {
+      pollFds.push_back({fd, POLLIN, 0});
+    }
+    if (poll(pollFds.data(), pollFds.size(), 1000) <= 0) {
+      continue;
+    }
+
+    for (size_t i = 1; i < pollFds.size(); ++i) {
+      if (!pollFds[i].revents)
+        continue;
+      char buffer[65536];
+      const ssize_t count = read(pollFds[i].fd, buffer, sizeof(buffer));
+      if (count > 0) {
+        pendingDeltas[pollFds[i].fd].append(buffer, count);
+      } else if (count == 0 || errno != EINTR) {
+        // * The child refreshed the project's directory listings and
+        // * scans lazily; keep what it read for the next request.
+        importScanCache(pendingDeltas[pollFds[i].fd]);
+        pendingDeltas.erase(pollFds[i].fd);
+        close(pollFds[i].fd);
+      }
+    }
+
+    if (!(pollFds[0].revents & POLLIN)) {
+      continue;
+    }
+    const int clientFd = acceptConnection(listenFd);
+    if (clientFd < 0) {
+      continue;
+    }
+    if (peerUid(clientFd) != getuid()) {
+      close(clientFd);
+      continue;
+    }
+    lastActivity = std::chrono::steady_clock::now();
+
+    // * Don't let a client that connects but never sends stall the loop.
+    std::vector<int> stdio;
+    setReceiveTimeout(clientFd, REQUEST_TIMEOUT_MS);
+    const auto request = receiveMessageWithFds(clientFd, stdio, 3);
+    const auto fields =
+        request ? splitFields(request.value()) : std::vector<std::string>{};
+    const auto closeRequest = [&]() {
+      for (const int fd : stdio)
+        close(fd);
+      close(clientFd);
+    };
+
+    if (!fields.empty() && fields[0] == "stop") {
+      closeRequest();
+      break;
+    }
+    const auto argumentCount =
+        fields.size() >= 4 ? parse_count(fields[3]) : std::nullopt;
+    if (!argumentCount || fields[0] != DAEMON_PROTOCOL ||
+        argumentCount.value() > fields.size() - 4) {
+      closeRequest();
+      continue;
+    }
+    if (fields[1] != ownStamp) {
+      sendMessage(clientFd, joinFields({"stale"}));
+      closeRequest();
+      break;
+    }
+
+    int deltaPipe[2];
+    if (pipe2(deltaPipe, O_CLOEXEC) != 0) {
+      closeRequest();
+      continue;
+    }
+    const pid_t pid = fork();
+    if (pid == 0) {
+      close(listenFd);
+      close(deltaPipe[0]);
+      serve_request(clientFd, stdio, fields, deltaPipe[1]);
+    }
+    close(deltaPipe[1]);
+    if (pid > 0) {
+      ++runningChildren;
+      pendingDeltas[deltaPipe[0]];
+    } else {
+      close(deltaPipe[0]);
+    }
+    closeRequest();
+  }
+
+  close(listenFd);
+  unlink(socketPath.c_str());
+  return 0;
+}
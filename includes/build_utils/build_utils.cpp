@@ -0,0 +1,423 @@
+#include "./build_utils.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "../jobserver_utils/jobserver_utils.hpp"
+#include "../remote_utils/remote_utils.hpp"
+#include "../state_utils/state_utils.hpp"
+#include "../system_utils/system_utils.hpp"
+#include "../trace_utils/trace_utils.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+fs::path commandFileFor(const fs::path &object) {
+  return fs::path(object).concat(".cmd");
+}
+
+fs::path depFileFor(const fs::path &object) {
+  return fs::path(object).concat(".d");
+}
+
+// * Written for dependencies that changed while the object was compiled:
+// * never matches, so the next run rebuilds it.
+const std::string UNKNOWN_HASH = "-";
+
+struct Fingerprint {
+  fs::path file;
+  std::string hash;
+};
+
+std::string hashString(uint64_t hash) {
+  std::ostringstream out;
+  out << std::hex << std::setw(16) << std::setfill('0') << hash;
+  return out.str();
+}
+
+/**
+ * @brief The command file holds the command line, then one
+ * "hash\tdependency" line per file the object was built from.
+ */
+std::vector<Fingerprint> readFingerprints(std::istream &commandFile) {
+  std::vector<Fingerprint> fingerprints;
+  std::string line;
+  while (std::getline(commandFile, line)) {
+    const auto tab = line.find('\t');
+    if (tab != std::string::npos) {
+      fingerprints.push_back({line.substr(tab + 1), line.substr(0, tab)});
+    }
+  }
+  return fingerprints;
+}
+
+/**
+ * @brief Records the command line and the content hash of every dependency
+ * of a freshly built object. Files modified after the compile started are
+ * recorded as unknown, since the object may predate their contents.
+ */
+void writeCommandFile(const CompileJob &job, int64_t compileStartNs) {
+  std::ofstream commandFile(commandFileFor(job.object));
+  commandFile << joinCommand(job.args) << '\n';
+  auto deps = parseDepFile(depFileFor(job.object));
+  deps.insert(deps.end(), job.inputs.begin(), job.inputs.end());
+  for (const auto &dep : deps) {
+    const auto state = fileState(dep);
+    commandFile << (state && state->mtimeNs < compileStartNs
+                        ? hashString(state->hash)
+                        : UNKNOWN_HASH)
+                << '\t' << dep.string() << '\n';
+  }
+}
+
+int64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+/**
+ * @brief Preprocesses the job locally (writing its depfile) and has a worker
+ * compile the result. Returns false if the worker couldn't be used at all.
+ */
+bool compileOnWorker(const CompileJob &job, const std::string &worker,
+                     CompileOutcome &outcome) {
+  const auto command = remoteCommandFor(job.compilerArgs);
+  if (!command) {
+    return false;
+  }
+  auto preprocessArgs = job.compilerArgs;
+  preprocessArgs.insert(preprocessArgs.end(),
+                        {"-E", job.source.string(), "-MMD", "-MF",
+                         depFileFor(job.object).string()});
+  std::string preprocessed;
+  ProcessOptions options;
+  options.onOutput = [&preprocessed](const char *data, size_t size) {
+    preprocessed.append(data, size);
+  };
+  const auto start = std::chrono::steady_clock::now();
+  if (runProcess(preprocessArgs, options).exitCode != 0) {
+    // * Let the local compile report the preprocessing error.
+    return false;
+  }
+
+  const auto result = compileRemotely(worker, command.value(), preprocessed);
+  if (!result) {
+    return false;
+  }
+  if (result->exitCode == 0) {
+    // * A missing or truncated object must not be recorded as built.
+    std::ofstream objectFile(job.object, std::ios::binary);
+    if (result->object.empty() ||
+        !(objectFile << result->object << std::flush)) {
+      objectFile.close();
+      std::error_code ec;
+      fs::remove(job.object, ec);
+      return false;
+    }
+  }
+  outcome.executor = worker;
+  outcome.output = result->output;
+  outcome.succeeded = result->exitCode == 0;
+  outcome.seconds = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+  return true;
+}
+
+} // namespace
+
+std::vector<std::string> splitCommand(const std::string &command) {
+  std::vector<std::string> args;
+  std::istringstream ss(command);
+  std::string token;
+  while (ss >> token) {
+    args.push_back(token);
+  }
+  return args;
+}
+
+std::string joinCommand(const std::vector<std::string> &args) {
+  std::string command;
+  for (const auto &arg : args) {
+    command += (command.empty() ? "" : " ") + arg;
+  }
+  return command;
+}
+
+/**
+ * @brief Maps a source file to its object file inside objectDir, mirroring
+ * the source's path relative to the working directory.
+ */
+fs::path objectPathFor(const fs::path &source, const fs::path &objectDir) {
+  fs::path relative = source.lexically_normal();
+  if (relative.is_absolute()) {
+    relative = relative.lexically_relative(fs::current_path());
+  }
+  if (relative.empty() || *relative.begin() == "..") {
+    // * Sources outside the project get a flat, collision-free name.
+    const auto hash = std::hash<std::string>{}(source.string());
+    relative = fs::path("_external") /
+               (std::to_string(hash) + "_" + source.filename().string());
+  }
+  return (objectDir / relative).concat(".o");
+}
+
+/**
+ * @brief Reads the prerequisites of a make-style depfile (as written by
+ * -MMD -MF).
+ */
+std::vector<fs::path> parseDepFile(const fs::path &depFile) {
+  std::ifstream file(depFile);
+  std::stringstream content;
+  content << file.rdbuf();
+  const std::string text = content.str();
+
+  std::vector<fs::path> deps;
+  const auto colon = text.find(": ");
+  if (colon == std::string::npos) {
+    return deps;
+  }
+
+  std::string current;
+  for (size_t i = colon + 2; i < text.size(); ++i) {
+    const char c = text[i];
+    if (c == '\\' && i + 1 < text.size()) {
+      if (text[i + 1] == '\n') {
+        ++i;
+        continue;
+      }
+      if (text[i + 1] == ' ') {
+        current += ' ';
+        ++i;
+        continue;
+      }
+    }
+    if (c == ' ' || c == '\n' || c == '\t') {
+      if (!current.empty())
+        deps.emplace_back(current);
+      current.clear();
+      if (c == '\n' && (i + 1 >= text.size() || text[i + 1] != ' '))
+        break;
+      continue;
+    }
+    current += c;
+  }
+  if (!current.empty())
+    deps.emplace_back(current);
+  return deps;
+}
+
+/**
+ * @brief An object is up to date when it was built with the same command
+ * line and every file it was built from still has the recorded content
+ * hash. Command files without hashes fall back to comparing mtimes with
+ * the files listed in the depfile.
+ */
+bool isObjectUpToDate(const CompileJob &job) {
+  std::error_code ec;
+  const auto objectTime = fs::last_write_time(job.object, ec);
+  if (ec) {
+    return false;
+  }
+
+  std::ifstream commandFile(commandFileFor(job.object));
+  std::string previousCommand;
+  std::getline(commandFile, previousCommand);
+  if (previousCommand != joinCommand(job.args)) {
+    return false;
+  }
+
+  const auto fingerprints = readFingerprints(commandFile);
+  if (!fingerprints.empty()) {
+    for (const auto &fingerprint : fingerprints) {
+      const auto state = fileState(fingerprint.file);
+      if (!state || hashString(state->hash) != fingerprint.hash) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  auto deps = parseDepFile(depFileFor(job.object));
+  if (deps.empty()) {
+    return false;
+  }
+  deps.insert(deps.end(), job.inputs.begin(), job.inputs.end());
+  for (const auto &dep : deps) {
+    const auto depTime = fs::last_write_time(dep, ec);
+    if (ec || depTime > objectTime) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Runs the compile jobs on up to options.jobs threads, skipping
+ * up-to-date objects. Jobs with dependencies (module imports) run in waves:
+ * each wave holds the jobs whose dependencies all finished in earlier ones.
+ * Each compile holds a jobserver slot while it runs. Jobs without module
+ * dependencies go to the remote workers round-robin when any are configured,
+ * falling back to a local compile if a worker is unreachable.
+ * Diagnostics of each job are printed as one block once it finishes (unless
+ * echoOutput is false, in which case the caller reports them).
+ */
+std::vector<CompileOutcome> runCompileJobs(const std::vector<CompileJob> &jobs,
+                                           const CompileOptions &options) {
+  std::vector<CompileOutcome> outcomes(jobs.size());
+  if (!options.stateTable.empty()) {
+    // * Check every known dependency up front, in parallel, so deciding
+    // * what's up to date is answered from memory.
+    TraceScope stateScope("file states", "compile");
+    loadFileStates(options.stateTable);
+    std::vector<fs::path> deps;
+    for (const auto &job : jobs) {
+      std::ifstream commandFile(commandFileFor(job.object));
+      std::string command;
+      std::getline(commandFile, command);
+      for (const auto &fingerprint : readFingerprints(commandFile)) {
+        deps.push_back(fingerprint.file);
+      }
+    }
+    std::sort(deps.begin(), deps.end());
+    deps.erase(std::unique(deps.begin(), deps.end()), deps.end());
+    refreshFileStates(deps, options.jobs);
+  }
+
+  // * Wave of each job: one past the latest of its dependencies (the
+  // * caller guarantees there are no cycles).
+  std::vector<size_t> waveOf(jobs.size(), SIZE_MAX);
+  std::function<size_t(size_t)> wave = [&](size_t i) {
+    if (waveOf[i] == SIZE_MAX) {
+      waveOf[i] = 0;
+      for (const size_t dependency : jobs[i].dependencies) {
+        waveOf[i] = std::max(waveOf[i], wave(dependency) + 1);
+      }
+    }
+    return waveOf[i];
+  };
+  std::vector<std::vector<size_t>> waves;
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    const size_t index = wave(i);
+    if (waves.size() <= index) {
+      waves.resize(index + 1);
+    }
+    waves[index].push_back(i);
+  }
+
+  const std::vector<size_t> *currentWave = nullptr;
+  std::atomic<size_t> nextJob{0};
+  std::atomic<size_t> nextWorker{0};
+  std::mutex outputMutex;
+
+  auto worker = [&]() {
+    for (size_t w = nextJob++; w < currentWave->size(); w = nextJob++) {
+      const size_t i = (*currentWave)[w];
+      const auto &job = jobs[i];
+      auto &outcome = outcomes[i];
+      outcome.source = job.source;
+      TraceScope jobScope("compile " + job.source.filename().string(),
+                          "compile", job.source.string());
+
+      bool dependencyRebuilt = false;
+      bool dependencyFailed = false;
+      for (const size_t dependency : job.dependencies) {
+        dependencyRebuilt = dependencyRebuilt || !outcomes[dependency].cached;
+        dependencyFailed =
+            dependencyFailed || !outcomes[dependency].succeeded;
+      }
+      if (dependencyFailed) {
+        outcome.output = "Not compiled: a module it imports failed to build (" +
+                         job.source.string() + ")\n";
+        std::lock_guard<std::mutex> lock(outputMutex);
+        if (options.echoOutput) {
+          std::cerr << outcome.output << std::flush;
+        }
+        continue;
+      }
+      if (!dependencyRebuilt && (job.bmi.empty() || fs::exists(job.bmi)) &&
+          isObjectUpToDate(job)) {
+        outcome.cached = true;
+        outcome.succeeded = true;
+        continue;
+      }
+
+      std::error_code ec;
+      fs::create_directories(job.object.parent_path(), ec);
+      JobToken slot;
+      const int64_t compileStartNs = nowNs();
+
+      bool compiled = false;
+      if (!options.workers.empty() && job.bmi.empty() &&
+          job.dependencies.empty()) {
+        const auto &worker =
+            options.workers[nextWorker++ % options.workers.size()];
+        try {
+          compiled = compileOnWorker(job, worker, outcome);
+        } catch (const std::exception &) {
+        }
+      }
+
+      if (!compiled) {
+        ProcessOptions processOptions;
+        processOptions.mergeStderr = true;
+        processOptions.onOutput = [&](const char *data, size_t size) {
+          outcome.output.append(data, size);
+        };
+        shareJobserver(processOptions);
+        try {
+          const auto result = runProcess(job.args, processOptions);
+          outcome.seconds = result.wallSeconds;
+          outcome.succeeded = result.exitCode == 0;
+        } catch (const std::exception &e) {
+          outcome.output += e.what();
+        }
+      }
+
+      if (outcome.succeeded && !options.stateTable.empty()) {
+        writeCommandFile(job, compileStartNs);
+      } else if (outcome.succeeded) {
+        std::ofstream(commandFileFor(job.object)) << joinCommand(job.args);
+      } else {
+        fs::remove(commandFileFor(job.object), ec);
+      }
+      if (options.echoOutput && !outcome.output.empty()) {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        std::cerr << outcome.output << std::flush;
+      }
+    }
+  };
+
+  for (const auto &jobsInWave : waves) {
+    currentWave = &jobsInWave;
+    nextJob = 0;
+    const size_t workerCount =
+        std::max<size_t>(1, std::min(options.jobs, jobsInWave.size()));
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < workerCount; ++i) {
+      workers.emplace_back([&worker, i]() {
+        traceNameThread("compile worker " + std::to_string(i));
+        worker();
+      });
+    }
+    worker();
+    for (auto &thread : workers) {
+      thread.join();
+    }
+  }
+  if (!options.stateTable.empty()) {
+    saveFileStates(options.stateTable);
+  }
+  return outcomes;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+struct CompileJob {
+  std::filesystem::path source;
+  std::filesystem::path object;
+  // * Compiler and flags only (what a remote worker needs).
+  std::vector<std::string> compilerArgs;
+  // * Full compiler command line, including -c/-o and the depfile flags.
+  std::vector<std::string> args;
+  // * C++20 modules: the interface this job compiles (empty otherwise), and
+  // * the jobs (by index) building the interfaces it imports. A job runs
+  // * after its dependencies and is rebuilt whenever one of them is.
+  std::filesystem::path bmi;
+  std::vector<size_t> dependencies;
+  // * Files it's built from that the depfile doesn't list (prebuilt module
+  // * interfaces), tracked like its other dependencies.
+  std::vector<std::filesystem::path> inputs;
+};
+
+struct CompileOptions {
+  size_t jobs = 1;
+  // * Print each job's diagnostics as it finishes.
+  bool echoOutput = true;
+  // * Remote workers to spread jobs over (see remote_utils).
+  std::vector<std::string> workers;
+  // * File-state table kept between runs (see state_utils); objects are
+  // * then checked against content hashes instead of mtimes.
+  std::filesystem::path stateTable;
+};
+
+struct CompileOutcome {
+  std::filesystem::path source;
+  bool cached = false;
+  bool succeeded = false;
+  double seconds = 0;
+  std::string output;
+  // * "local" or the address of the worker that compiled it.
+  std::string executor = "local";
+};
+
+std::vector<std::string> splitCommand(const std::string &);
+std::string joinCommand(const std::vector<std::string> &);
+std::filesystem::path objectPathFor(const std::filesystem::path &,
+                                    const std::filesystem::path &);
+std::vector<std::filesystem::path> parseDepFile(const std::filesystem::path &);
+bool isObjectUpToDate(const CompileJob &);
+std::vector<CompileOutcome> runCompileJobs(const std::vector<CompileJob> &,
+                                           const CompileOptions &);
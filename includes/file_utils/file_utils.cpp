@@ -1,5 +1,10 @@
 #include "./file_utils.hpp"
 
+#include <cstdlib>
+#include <glob.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 bool fileExists(const std::filesystem::path &filePath) {
   return std::filesystem::exists(filePath) &&
          std::filesystem::is_regular_file(filePath);
@@ -13,3 +18,57 @@ bool directoryExists(const std::filesystem::path &directoryPath) {
 std::string getRootDir() {
   return std::filesystem::current_path().string();
 }
+
+/**
+ * @brief Cheap change detector for a file or directory (one stat call).
+ */
+std::optional<FileStamp> statFile(const std::filesystem::path &path) {
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0) {
+    return std::nullopt;
+  }
+  FileStamp stamp;
+  stamp.mtimeNs =
+      static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 +
+      info.st_mtim.tv_nsec;
+  stamp.size = info.st_size;
+  return stamp;
+}
+
+/**
+ * @brief Per-user cache shared by every project ($XDG_CACHE_HOME/ccomp, or
+ * ~/.cache/ccomp), created on first use.
+ */
+std::filesystem::path userCacheDir() {
+  std::filesystem::path directory;
+  const char *cacheHome = std::getenv("XDG_CACHE_HOME");
+  const char *home = std::getenv("HOME");
+  if (cacheHome && *cacheHome) {
+    directory = std::filesystem::path(cacheHome) / "ccomp";
+  } else if (home && *home) {
+    directory = std::filesystem::path(home) / ".cache" / "ccomp";
+  } else {
+    directory = "/tmp/ccomp-" + std::to_string(getuid()) + "-cache";
+  }
+  std::error_code ec;
+  std::filesystem::create_directories(directory, ec);
+  return directory;
+}
+
+bool isGlobPattern(const std::string &pattern) {
+  return pattern.find_first_of("*?[") != std::string::npos;
+}
+
+/**
+ * @brief Expands a shell-style pattern (for quoted globs the shell didn't
+ * expand). Matches are sorted; no match yields an empty list.
+ */
+std::vector<std::filesystem::path> expandGlob(const std::string &pattern) {
+  std::vector<std::filesystem::path> matches;
+  glob_t result;
+  if (glob(pattern.c_str(), 0, nullptr, &result) == 0) {
+    matches.assign(result.gl_pathv, result.gl_pathv + result.gl_pathc);
+  }
+  globfree(&result);
+  return matches;
+}
@@ -1,8 +1,26 @@
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
 #include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct FileStamp {
+  int64_t mtimeNs = 0;
+  int64_t size = 0;
+
+  bool operator==(const FileStamp &other) const {
+    return mtimeNs == other.mtimeNs && size == other.size;
+  }
+  bool operator!=(const FileStamp &other) const { return !(*this == other); }
+};
 
 std::string getRootDir();
 bool fileExists(const std::filesystem::path &);
-bool directoryExists(const std::filesystem::path &);
\ No newline at end of file
+bool directoryExists(const std::filesystem::path &);
+std::optional<FileStamp> statFile(const std::filesystem::path &);
+std::filesystem::path userCacheDir();
+bool isGlobPattern(const std::string &);
+std::vector<std::filesystem::path> expandGlob(const std::string &);
@@ -0,0 +1,270 @@
+#include "./git_utils.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+#include "../file_utils/file_utils.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr size_t HEADER_SIZE = 12;
+// * ctime, mtime, dev, ino, mode, uid, gid and size, 4 bytes each (ctime
+// * and mtime take two); the object hash and the flags follow.
+constexpr size_t STAT_FIELDS_SIZE = 40;
+constexpr size_t MODE_OFFSET = 24;
+constexpr uint16_t FLAG_EXTENDED = 0x4000;
+constexpr uint16_t FLAG_SKIP_WORKTREE = 0x4000;
+constexpr uint32_t MODE_TYPE_MASK = 0170000;
+constexpr uint32_t MODE_REGULAR = 0100000;
+constexpr uint32_t MODE_SYMLINK = 0120000;
+
+struct IndexCacheEntry {
+  FileStamp stamp;
+  std::vector<std::string> paths;
+};
+
+std::mutex indexCacheMutex;
+std::map<fs::path, IndexCacheEntry> indexCache;
+
+uint32_t readU32(const unsigned char *data) {
+  return (static_cast<uint32_t>(data[0]) << 24) |
+         (static_cast<uint32_t>(data[1]) << 16) |
+         (static_cast<uint32_t>(data[2]) << 8) | data[3];
+}
+
+uint16_t readU16(const unsigned char *data) {
+  return static_cast<uint16_t>((data[0] << 8) | data[1]);
+}
+
+std::string readText(const fs::path &filePath) {
+  std::ifstream file(filePath, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error("Unable to open file: " + filePath.string());
+  }
+  return std::string(std::istreambuf_iterator<char>(file), {});
+}
+
+std::string trim(const std::string &text) {
+  const auto begin = text.find_first_not_of(" \t\r\n");
+  if (begin == std::string::npos) {
+    return "";
+  }
+  return text.substr(begin, text.find_last_not_of(" \t\r\n") - begin + 1);
+}
+
+fs::path absoluteDirectory(const fs::path &directory) {
+  auto absolute = fs::absolute(directory).lexically_normal();
+  if (absolute.filename().empty() && absolute != absolute.root_path()) {
+    absolute = absolute.parent_path(); // * Drop the trailing separator
+  }
+  return absolute;
+}
+
+struct Checkout {
+  fs::path workTree;
+  fs::path gitDir;
+};
+
+/**
+ * @brief The checkout containing directory: the nearest ancestor with a
+ * .git directory, or a .git file pointing elsewhere (worktrees, submodules).
+ */
+std::optional<Checkout> findCheckout(const fs::path &directory) {
+  for (auto current = absoluteDirectory(directory);;
+       current = current.parent_path()) {
+    const auto dotGit = current / ".git";
+    if (directoryExists(dotGit)) {
+      return Checkout{current, dotGit};
+    }
+    if (fileExists(dotGit)) {
+      const auto text = trim(readText(dotGit));
+      const std::string prefix = "gitdir:";
+      if (text.rfind(prefix, 0) != 0) {
+        return std::nullopt;
+      }
+      return Checkout{current, current / trim(text.substr(prefix.size()))};
+    }
+    if (current == current.root_path()) {
+      return std::nullopt;
+    }
+  }
+}
+
+/**
+ * @brief Size of an object name in the repository: 32 bytes once
+ * extensions.objectFormat is sha256, 20 (SHA-1) otherwise.
+ */
+size_t objectHashSize(const fs::path &gitDir) {
+  auto commonDir = gitDir;
+  if (fileExists(gitDir / "commondir")) {
+    commonDir = gitDir / trim(readText(gitDir / "commondir"));
+  }
+  if (!fileExists(commonDir / "config")) {
+    return 20;
+  }
+  std::istringstream config(readText(commonDir / "config"));
+  std::string line;
+  while (std::getline(config, line)) {
+    std::transform(line.begin(), line.end(), line.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    if (line.find("objectformat") != std::string::npos &&
+        line.find("sha256") != std::string::npos) {
+      return 32;
+    }
+  }
+  return 20;
+}
+
+} // namespace
+
+std::vector<std::string> parseGitIndex(std::string_view data,
+                                       size_t hashSize) {
+  const auto *bytes = reinterpret_cast<const unsigned char *>(data.data());
+  const size_t size = data.size();
+  if (size < HEADER_SIZE + hashSize || data.substr(0, 4) != "DIRC") {
+    throw std::runtime_error("Not a git index");
+  }
+  const uint32_t version = readU32(bytes + 4);
+  if (version < 2 || version > 4) {
+    throw std::runtime_error("Unsupported git index version " +
+                             std::to_string(version));
+  }
+  const uint32_t count = readU32(bytes + 8);
+  const size_t end = size - hashSize; // * The trailing checksum
+  const size_t fixedSize = STAT_FIELDS_SIZE + hashSize + 2;
+
+  std::vector<std::string> paths;
+  std::string previous;
+  size_t pos = HEADER_SIZE;
+  for (uint32_t i = 0; i < count; ++i) {
+    const size_t entryStart = pos;
+    if (pos + fixedSize > end) {
+      throw std::runtime_error("Truncated git index");
+    }
+    const uint32_t mode = readU32(bytes + pos + MODE_OFFSET);
+    const uint16_t flags = readU16(bytes + pos + STAT_FIELDS_SIZE + hashSize);
+    pos += fixedSize;
+    uint16_t extendedFlags = 0;
+    if (flags & FLAG_EXTENDED) {
+      if (version < 3 || pos + 2 > end) {
+        throw std::runtime_error("Malformed git index entry");
+      }
+      extendedFlags = readU16(bytes + pos);
+      pos += 2;
+    }
+
+    // * Version 4 stores each path as the number of bytes to drop from the
+    // * end of the previous one, then the suffix to append.
+    size_t strip = 0;
+    if (version == 4) {
+      if (pos >= end) {
+        throw std::runtime_error("Truncated git index");
+      }
+      unsigned char byte = bytes[pos++];
+      strip = byte & 0x7f;
+      while (byte & 0x80) {
+        if (pos >= end) {
+          throw std::runtime_error("Truncated git index");
+        }
+        byte = bytes[pos++];
+        strip = ((strip + 1) << 7) | (byte & 0x7f);
+      }
+      if (strip > previous.size()) {
+        throw std::runtime_error("Malformed git index entry");
+      }
+    }
+    const auto *nameEnd = static_cast<const unsigned char *>(
+        std::memchr(bytes + pos, '\0', end - pos));
+    if (!nameEnd) {
+      throw std::runtime_error("Truncated git index");
+    }
+    const std::string_view suffix(data.data() + pos,
+                                  static_cast<size_t>(nameEnd - bytes) - pos);
+    std::string name;
+    if (version == 4) {
+      name = previous.substr(0, previous.size() - strip);
+      name += suffix;
+      pos = static_cast<size_t>(nameEnd - bytes) + 1;
+    } else {
+      name = suffix;
+      // * Entries are NUL-padded to a multiple of 8 bytes.
+      pos = entryStart +
+            ((static_cast<size_t>(nameEnd - bytes) - entryStart + 8) & ~7ul);
+    }
+    if (pos > end) {
+      throw std::runtime_error("Truncated git index");
+    }
+
+    const uint32_t type = mode & MODE_TYPE_MASK;
+    // * Conflicted paths appear once per stage, next to each other.
+    if ((type == MODE_REGULAR || type == MODE_SYMLINK) &&
+        !(extendedFlags & FLAG_SKIP_WORKTREE) &&
+        (paths.empty() || paths.back() != name)) {
+      paths.push_back(name);
+    }
+    previous = std::move(name);
+  }
+
+  while (pos + 8 <= end) {
+    if (data.substr(pos, 4) == "link") {
+      throw std::runtime_error("Split git index");
+    }
+    pos += 8 + readU32(bytes + pos + 4);
+  }
+  return paths;
+}
+
+std::optional<std::vector<fs::path>>
+listTrackedFiles(const fs::path &directory, const std::string &extension) {
+  try {
+    const auto checkout = findCheckout(directory);
+    if (!checkout) {
+      return std::nullopt;
+    }
+    const auto indexPath = checkout->gitDir / "index";
+    const auto stamp = statFile(indexPath);
+    if (!stamp) {
+      return std::nullopt;
+    }
+
+    std::vector<std::string> paths;
+    {
+      std::lock_guard<std::mutex> lock(indexCacheMutex);
+      auto cached = indexCache.find(indexPath);
+      if (cached == indexCache.end() || cached->second.stamp != stamp.value()) {
+        IndexCacheEntry entry;
+        entry.stamp = stamp.value();
+        entry.paths = parseGitIndex(readText(indexPath),
+                                    objectHashSize(checkout->gitDir));
+        cached = indexCache.insert_or_assign(indexPath, std::move(entry)).first;
+      }
+      paths = cached->second.paths;
+    }
+
+    const auto relative =
+        absoluteDirectory(directory).lexically_relative(checkout->workTree).string();
+    const std::string prefix = relative == "." ? "" : relative + "/";
+    std::vector<fs::path> files;
+    for (const auto &path : paths) {
+      if (path.size() >= prefix.size() + extension.size() &&
+          path.compare(0, prefix.size(), prefix) == 0 &&
+          path.compare(path.size() - extension.size(), extension.size(),
+                       extension) == 0) {
+        files.push_back(checkout->workTree / path);
+      }
+    }
+    return files;
+  } catch (const std::exception &) {
+    return std::nullopt;
+  }
+}
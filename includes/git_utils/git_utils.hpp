@@ -0,0 +1,27 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Paths (relative to the work tree) of the files tracked in a git
+ * index (`.git/index`, versions 2 to 4). Entries that aren't checked out
+ * (sparse or skip-worktree) and submodules are left out. Throws
+ * std::runtime_error if the index is malformed or split (its entries live
+ * in a shared index).
+ */
+std::vector<std::string> parseGitIndex(std::string_view data,
+                                       size_t hashSize = 20);
+
+/**
+ * @brief Tracked files with the given extension under directory, read from
+ * the index of the git checkout containing it instead of walking the tree.
+ * std::nullopt when directory isn't inside a checkout or its index can't be
+ * used; files that aren't tracked yet are never listed.
+ */
+std::optional<std::vector<std::filesystem::path>>
+listTrackedFiles(const std::filesystem::path &directory,
+                 const std::string &extension);
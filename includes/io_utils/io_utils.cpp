@@ -0,0 +1,375 @@
+#include "./io_utils.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <linux/io_uring.h>
+#include <memory>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr unsigned RING_ENTRIES = 256;
+constexpr unsigned STATX_FIELDS = STATX_BASIC_STATS;
+// * Bigger files (rare among sources) are read the plain way.
+constexpr uint64_t MAX_BATCHED_READ = 1u << 30;
+
+enum class Availability { UNKNOWN, AVAILABLE, UNAVAILABLE };
+std::atomic<Availability> availability{Availability::UNKNOWN};
+
+/**
+ * @brief A minimal io_uring (no liburing): the mapped submission and
+ * completion queues of one ring, used by one thread.
+ */
+class Ring {
+public:
+  /**
+   * @brief Sets up the ring; valid() is false if the kernel refuses it or
+   * lacks one of the operations used here.
+   */
+  Ring() {
+    io_uring_params params{};
+    fd = static_cast<int>(syscall(__NR_io_uring_setup, RING_ENTRIES, &params));
+    if (fd < 0) {
+      return;
+    }
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMap) {
+      sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+    }
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    cqRing = singleMap ? sqRing
+                       : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, fd,
+                              IORING_OFF_CQ_RING);
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe *>(
+        mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+    if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+      return;
+    }
+
+    auto *sq = static_cast<char *>(sqRing);
+    sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    auto *cq = static_cast<char *>(cqRing);
+    cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    entries = params.sq_entries;
+    ready = supports({IORING_OP_STATX, IORING_OP_OPENAT, IORING_OP_READ});
+  }
+
+  ~Ring() {
+    if (sqes && sqes != MAP_FAILED)
+      munmap(sqes, sqesSize);
+    if (cqRing && cqRing != MAP_FAILED && cqRing != sqRing)
+      munmap(cqRing, cqRingSize);
+    if (sqRing && sqRing != MAP_FAILED)
+      munmap(sqRing, sqRingSize);
+    if (fd >= 0)
+      close(fd);
+  }
+
+  Ring(const Ring &) = delete;
+  Ring &operator=(const Ring &) = delete;
+
+  bool valid() const { return ready; }
+
+  /**
+   * @brief Submits `count` operations (prepare fills in the i-th one) in
+   * batches of up to a ring's worth and waits for all of them. Returns
+   * each operation's result (a count, an fd or -errno), or nothing if the
+   * ring stopped working; then `completed`, if given, receives the results
+   * of the operations that did finish (-ECANCELED for the others).
+   */
+  std::optional<std::vector<int>>
+  run(size_t count, const std::function<void(size_t, io_uring_sqe &)> &prepare,
+      std::vector<int> *completed = nullptr) {
+    std::vector<int> results(count, -ECANCELED);
+    for (size_t first = 0; first < count; first += entries) {
+      const unsigned batch =
+          static_cast<unsigned>(std::min<size_t>(entries, count - first));
+      unsigned tail = *sqTail;
+      for (unsigned i = 0; i < batch; ++i) {
+        const unsigned slot = tail & sqMask;
+        io_uring_sqe &sqe = sqes[slot];
+        std::memset(&sqe, 0, sizeof(sqe));
+        prepare(first + i, sqe);
+        sqe.user_data = first + i;
+        sqArray[slot] = slot;
+        ++tail;
+      }
+      __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+
+      unsigned toSubmit = batch;
+      unsigned pending = batch;
+      while (pending > 0) {
+        const int entered = static_cast<int>(
+            syscall(__NR_io_uring_enter, fd, toSubmit, 1,
+                    IORING_ENTER_GETEVENTS, nullptr, 0));
+        if (entered < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          // * The operations already submitted still write into the
+          // * caller's buffers, so they must complete before we return.
+          drain(pending - toSubmit, results);
+          ready = false;
+          if (completed) {
+            *completed = std::move(results);
+          }
+          return std::nullopt;
+        }
+        toSubmit -= std::min<unsigned>(toSubmit, entered);
+        pending -= reap(results);
+      }
+    }
+    return results;
+  }
+
+private:
+  // * Collects the completions posted so far; returns how many there were.
+  unsigned reap(std::vector<int> &results) {
+    unsigned head = *cqHead;
+    const unsigned available = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    unsigned reaped = 0;
+    for (; head != available; ++head, ++reaped) {
+      const io_uring_cqe &cqe = cqes[head & cqMask];
+      results[cqe.user_data] = cqe.res;
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    return reaped;
+  }
+
+  /**
+   * @brief Waits for `inFlight` submitted operations after io_uring_enter
+   * failed. Completions are posted to the mapped queue whether or not
+   * entering works (a batch never exceeds the queue, which is twice the
+   * ring's size, so none overflow), so this polls it when waiting fails.
+   */
+  void drain(unsigned inFlight, std::vector<int> &results) {
+    while ((inFlight -= std::min(inFlight, reap(results))) > 0) {
+      if (syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS,
+                  nullptr, 0) < 0 &&
+          errno != EINTR) {
+        usleep(1000);
+      }
+    }
+  }
+
+  bool supports(std::initializer_list<int> ops) {
+    const size_t probeSize =
+        sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+    std::unique_ptr<char[]> buffer(new char[probeSize]());
+    auto *probe = reinterpret_cast<io_uring_probe *>(buffer.get());
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe,
+                256) < 0) {
+      return false;
+    }
+    for (const int op : ops) {
+      if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  int fd = -1;
+  bool ready = false;
+  unsigned entries = 0;
+  void *sqRing = nullptr;
+  void *cqRing = nullptr;
+  size_t sqRingSize = 0;
+  size_t cqRingSize = 0;
+  size_t sqesSize = 0;
+  io_uring_sqe *sqes = nullptr;
+  unsigned *sqTail = nullptr;
+  unsigned sqMask = 0;
+  unsigned *sqArray = nullptr;
+  unsigned *cqHead = nullptr;
+  unsigned *cqTail = nullptr;
+  unsigned cqMask = 0;
+  io_uring_cqe *cqes = nullptr;
+};
+
+/**
+ * @brief The calling thread's ring, or nullptr when io_uring can't be used
+ * (checked once per process).
+ */
+Ring *threadRing() {
+  if (availability == Availability::UNAVAILABLE) {
+    return nullptr;
+  }
+  if (availability == Availability::UNKNOWN) {
+    const char *mode = std::getenv("CCOMP_IO");
+    if (mode && std::string(mode) == "sync") {
+      availability = Availability::UNAVAILABLE;
+      return nullptr;
+    }
+  }
+  thread_local std::unique_ptr<Ring> ring;
+  if (!ring) {
+    ring = std::make_unique<Ring>();
+    availability =
+        ring->valid() ? Availability::AVAILABLE : Availability::UNAVAILABLE;
+  }
+  return ring->valid() ? ring.get() : nullptr;
+}
+
+std::optional<std::string> readFileSync(const fs::path &path) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return std::nullopt;
+  }
+  std::string content;
+  char buffer[64 * 1024];
+  while (true) {
+    const ssize_t got = read(fd, buffer, sizeof(buffer));
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got < 0) {
+      close(fd);
+      return std::nullopt;
+    }
+    if (got == 0) {
+      break;
+    }
+    content.append(buffer, static_cast<size_t>(got));
+  }
+  close(fd);
+  return content;
+}
+
+} // namespace
+
+std::vector<std::optional<struct statx>>
+statxFiles(const std::vector<fs::path> &paths) {
+  std::vector<struct statx> buffers(paths.size());
+  std::vector<int> results(paths.size());
+  std::optional<std::vector<int>> batched;
+  if (Ring *ring = threadRing()) {
+    batched = ring->run(paths.size(), [&](size_t i, io_uring_sqe &sqe) {
+      sqe.opcode = IORING_OP_STATX;
+      sqe.fd = AT_FDCWD;
+      sqe.addr = reinterpret_cast<uint64_t>(paths[i].c_str());
+      sqe.len = STATX_FIELDS;
+      sqe.off = reinterpret_cast<uint64_t>(&buffers[i]);
+      sqe.statx_flags = AT_STATX_SYNC_AS_STAT;
+    });
+  }
+  if (batched) {
+    results = std::move(batched.value());
+  } else {
+    for (size_t i = 0; i < paths.size(); ++i) {
+      results[i] = statx(AT_FDCWD, paths[i].c_str(), AT_STATX_SYNC_AS_STAT,
+                         STATX_FIELDS, &buffers[i]) == 0
+                       ? 0
+                       : -errno;
+    }
+  }
+
+  std::vector<std::optional<struct statx>> infos(paths.size());
+  for (size_t i = 0; i < paths.size(); ++i) {
+    if (results[i] == 0) {
+      infos[i] = buffers[i];
+    }
+  }
+  return infos;
+}
+
+std::vector<bool> regularFilesExist(const std::vector<fs::path> &paths) {
+  std::vector<bool> exist;
+  exist.reserve(paths.size());
+  for (const auto &info : statxFiles(paths)) {
+    exist.push_back(info && S_ISREG(info->stx_mode));
+  }
+  return exist;
+}
+
+std::vector<std::optional<std::string>>
+readFiles(const std::vector<fs::path> &paths) {
+  std::vector<std::optional<std::string>> contents(paths.size());
+  Ring *ring = threadRing();
+  if (!ring) {
+    for (size_t i = 0; i < paths.size(); ++i) {
+      contents[i] = readFileSync(paths[i]);
+    }
+    return contents;
+  }
+
+  // * Three batches: sizes, then opens, then one read per file.
+  const auto infos = statxFiles(paths);
+  std::vector<int> opened;
+  const auto fds = ring->run(
+      paths.size(),
+      [&](size_t i, io_uring_sqe &sqe) {
+        sqe.opcode = IORING_OP_OPENAT;
+        sqe.fd = AT_FDCWD;
+        sqe.addr = reinterpret_cast<uint64_t>(paths[i].c_str());
+        sqe.open_flags = O_RDONLY | O_CLOEXEC;
+      },
+      &opened);
+  if (!fds) {
+    for (const int fd : opened) {
+      if (fd >= 0)
+        close(fd);
+    }
+    for (size_t i = 0; i < paths.size(); ++i) {
+      contents[i] = readFileSync(paths[i]);
+    }
+    return contents;
+  }
+
+  // * One byte more than the file's size, so a read of exactly that size
+  // * proves the file neither shrank nor grew since the statx.
+  std::vector<std::string> buffers(paths.size());
+  for (size_t i = 0; i < paths.size(); ++i) {
+    if ((*fds)[i] >= 0 && infos[i] && infos[i]->stx_size < MAX_BATCHED_READ) {
+      buffers[i].resize(infos[i]->stx_size + 1);
+    }
+  }
+  const auto reads = ring->run(paths.size(), [&](size_t i, io_uring_sqe &sqe) {
+    sqe.opcode = IORING_OP_READ;
+    sqe.fd = std::max((*fds)[i], -1);
+    sqe.addr = reinterpret_cast<uint64_t>(buffers[i].data());
+    sqe.len = static_cast<uint32_t>(buffers[i].size());
+    sqe.off = 0;
+  });
+
+  for (size_t i = 0; i < paths.size(); ++i) {
+    const int fd = (*fds)[i];
+    if (fd < 0) {
+      continue;
+    }
+    const int got = reads ? (*reads)[i] : -EIO;
+    if (got >= 0 && infos[i] && !buffers[i].empty() &&
+        static_cast<uint64_t>(got) == infos[i]->stx_size) {
+      buffers[i].resize(static_cast<size_t>(got));
+      contents[i] = std::move(buffers[i]);
+    }
+    close(fd);
+    if (!contents[i]) {
+      contents[i] = readFileSync(paths[i]);
+    }
+  }
+  return contents;
+}
+
+const char *ioBackend() { return threadRing() ? "io_uring" : "sync"; }
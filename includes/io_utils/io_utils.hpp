@@ -0,0 +1,35 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+/**
+ * @brief Batched file I/O for discovery and fingerprinting. Each batch is
+ * submitted to io_uring at once (one ring per thread), so the kernel
+ * overlaps the latency of its operations; without io_uring (old kernels,
+ * seccomp filters, or CCOMP_IO=sync) the same calls run one by one.
+ * Results are in request order.
+ */
+std::vector<std::optional<struct statx>>
+statxFiles(const std::vector<std::filesystem::path> &);
+
+/**
+ * @brief Whether each path is a regular file (following symlinks).
+ */
+std::vector<bool>
+regularFilesExist(const std::vector<std::filesystem::path> &);
+
+/**
+ * @brief Whole contents of each file; std::nullopt for those that can't
+ * be read.
+ */
+std::vector<std::optional<std::string>>
+readFiles(const std::vector<std::filesystem::path> &);
+
+/**
+ * @brief "io_uring" or "sync", whichever the calling thread uses.
+ */
+const char *ioBackend();
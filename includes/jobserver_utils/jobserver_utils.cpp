@@ -0,0 +1,202 @@
+#include "./jobserver_utils.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../system_utils/system_utils.hpp"
+
+namespace {
+
+// * Every process under a jobserver owns one implicit slot; the pool only
+// * holds tokens for the slots beyond it.
+constexpr size_t MAX_POOL_TOKENS = 4096;
+constexpr int TOKEN_POLL_MS = 100;
+
+std::atomic<bool> active{false};
+std::atomic<bool> implicitFree{true};
+int readFd = -1;
+int writeFd = -1;
+// * MAKEFLAGS for the children a self-started pool is shared with.
+std::string childMakeflags;
+
+bool isPipe(int fd) {
+  struct stat info;
+  return fd >= 0 && fcntl(fd, F_GETFD) != -1 && fstat(fd, &info) == 0 &&
+         S_ISFIFO(info.st_mode);
+}
+
+bool joinJobserver(const JobserverAuth &auth) {
+  if (!auth.fifoPath.empty()) {
+    // * Our own open file description, so non-blocking reads are safe.
+    const int fd =
+        open(auth.fifoPath.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+      return false;
+    }
+    readFd = writeFd = fd;
+    return true;
+  }
+  if (!isPipe(auth.readFd) || !isPipe(auth.writeFd)) {
+    return false;
+  }
+  readFd = auth.readFd;
+  writeFd = auth.writeFd;
+  return true;
+}
+
+bool startJobserver(size_t jobs) {
+  int fds[2];
+  // * O_CLOEXEC: only children given the pool by shareJobserver() keep it.
+  if (pipe2(fds, O_CLOEXEC) != 0) {
+    return false;
+  }
+  const std::string tokens(std::min(jobs - 1, MAX_POOL_TOKENS), '+');
+  if (write(fds[1], tokens.data(), tokens.size()) !=
+      static_cast<ssize_t>(tokens.size())) {
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+  readFd = fds[0];
+  writeFd = fds[1];
+
+  const char *inherited = std::getenv("MAKEFLAGS");
+  childMakeflags = inherited ? inherited : "";
+  childMakeflags += " -j" + std::to_string(jobs) +
+                    " --jobserver-auth=" + std::to_string(readFd) + "," +
+                    std::to_string(writeFd);
+  return true;
+}
+
+} // namespace
+
+std::optional<JobserverAuth> parseJobserverAuth(const std::string &makeflags) {
+  std::optional<JobserverAuth> auth;
+  size_t slots = 0;
+  std::istringstream words(makeflags);
+  std::string word;
+  // * make may repeat the option when recursing; the last one wins.
+  while (words >> word) {
+    if (word.rfind("-j", 0) == 0 && word.size() > 2 &&
+        std::isdigit(static_cast<unsigned char>(word[2]))) {
+      slots = std::stoul(word.substr(2));
+      continue;
+    }
+    std::string value;
+    for (const std::string prefix :
+         {"--jobserver-auth=", "--jobserver-fds="}) {
+      if (word.rfind(prefix, 0) == 0) {
+        value = word.substr(prefix.size());
+      }
+    }
+    if (value.empty()) {
+      continue;
+    }
+
+    JobserverAuth parsed;
+    if (value.rfind("fifo:", 0) == 0) {
+      parsed.fifoPath = value.substr(5);
+    } else {
+      const auto comma = value.find(',');
+      if (comma == std::string::npos) {
+        continue;
+      }
+      try {
+        parsed.readFd = std::stoi(value.substr(0, comma));
+        parsed.writeFd = std::stoi(value.substr(comma + 1));
+      } catch (const std::exception &) {
+        continue;
+      }
+    }
+    auth = parsed;
+  }
+  if (auth) {
+    auth->slots = slots;
+  }
+  return auth;
+}
+
+void jobserverSetup(size_t jobs) {
+  if (active) {
+    return;
+  }
+  const char *makeflags = std::getenv("MAKEFLAGS");
+  if (const auto auth = parseJobserverAuth(makeflags ? makeflags : "")) {
+    if (joinJobserver(auth.value())) {
+      active = true;
+    } else {
+      // * Same fallback as make: the parent didn't pass us its pool (the
+      // * rule isn't marked '+'), so don't add to its load.
+      std::cerr << "- Jobserver unavailable, running jobs serially. Add '+' "
+                   "to the parent make rule.\n";
+      readFd = writeFd = -1;
+      active = true;
+    }
+    return;
+  }
+  if (jobs > 1 && startJobserver(jobs)) {
+    active = true;
+  }
+}
+
+bool jobserverActive() { return active; }
+
+void shareJobserver(ProcessOptions &options) {
+  if (childMakeflags.empty()) {
+    return;
+  }
+  options.inheritedFds.insert(options.inheritedFds.end(), {readFd, writeFd});
+  options.environment.push_back("MAKEFLAGS=" + childMakeflags);
+}
+
+JobToken::JobToken() : kind(Kind::NONE), token('+') {
+  if (!active) {
+    return;
+  }
+  while (true) {
+    bool expected = true;
+    if (implicitFree.compare_exchange_strong(expected, false)) {
+      kind = Kind::IMPLICIT;
+      return;
+    }
+    if (readFd < 0) {
+      // * Serial fallback: wait for the implicit slot.
+      usleep(TOKEN_POLL_MS * 1000);
+      continue;
+    }
+
+    // * Poll with a timeout so a released implicit slot is noticed too.
+    pollfd pending{readFd, POLLIN, 0};
+    if (poll(&pending, 1, TOKEN_POLL_MS) <= 0) {
+      continue;
+    }
+    const ssize_t got = read(readFd, &token, 1);
+    if (got == 1) {
+      kind = Kind::PIPE;
+      return;
+    }
+    if (got < 0 && (errno == EAGAIN || errno == EINTR)) {
+      continue;
+    }
+    // * The pool is gone; stop throttling rather than deadlock.
+    return;
+  }
+}
+
+JobToken::~JobToken() {
+  if (kind == Kind::IMPLICIT) {
+    implicitFree = true;
+  } else if (kind == Kind::PIPE) {
+    while (write(writeFd, &token, 1) < 0 && errno == EINTR) {
+    }
+  }
+}
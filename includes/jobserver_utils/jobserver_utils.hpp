@@ -0,0 +1,54 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+/**
+ * @brief GNU make jobserver support. Under `make -jN` ccomp joins make's
+ * token pool (from MAKEFLAGS); otherwise it creates its own pool and shares
+ * it with the compilers and linkers it runs, so jobserver-aware ones share
+ * the same job budget instead of oversubscribing the machine.
+ */
+struct ProcessOptions;
+
+struct JobserverAuth {
+  std::string fifoPath; // * make >= 4.4: --jobserver-auth=fifo:PATH
+  int readFd = -1;      // * older makes: --jobserver-auth=R,W
+  int writeFd = -1;
+  size_t slots = 0; // * make's -jN, if given
+};
+
+std::optional<JobserverAuth> parseJobserverAuth(const std::string &makeflags);
+
+/**
+ * @brief Joins the jobserver advertised in MAKEFLAGS or, failing that and
+ * when jobs > 1, starts one with `jobs` slots. Must be called before any
+ * worker threads or child processes are started.
+ */
+void jobserverSetup(size_t jobs);
+bool jobserverActive();
+
+/**
+ * @brief Gives a compiler or linker child the pool ccomp started itself (its
+ * fds and MAKEFLAGS), as make does for its recipes. The programs ccomp runs
+ * for the user (-r, -t) never get it. A no-op under make's pool, which
+ * children inherit from make's environment.
+ */
+void shareJobserver(ProcessOptions &options);
+
+/**
+ * @brief One job slot, held for the duration of a compile or test run.
+ * Blocks until a slot is free; a no-op when no jobserver is active.
+ */
+class JobToken {
+public:
+  JobToken();
+  ~JobToken();
+
+  JobToken(const JobToken &) = delete;
+  JobToken &operator=(const JobToken &) = delete;
+
+private:
+  enum class Kind { NONE, IMPLICIT, PIPE } kind;
+  char token;
+};
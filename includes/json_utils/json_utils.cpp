@@ -0,0 +1,298 @@
+#include "./json_utils.hpp"
+
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+JsonWriter::JsonWriter(std::ostream &out) : out(out) {}
+
+void JsonWriter::separate() {
+  if (afterKey) {
+    afterKey = false;
+    return;
+  }
+  if (!hasItems.empty()) {
+    if (hasItems.back())
+      out << ',';
+    hasItems.back() = true;
+  }
+}
+
+JsonWriter &JsonWriter::beginObject() {
+  separate();
+  out << '{';
+  hasItems.push_back(false);
+  return *this;
+}
+
+JsonWriter &JsonWriter::endObject() {
+  hasItems.pop_back();
+  out << '}';
+  return *this;
+}
+
+JsonWriter &JsonWriter::beginArray() {
+  separate();
+  out << '[';
+  hasItems.push_back(false);
+  return *this;
+}
+
+JsonWriter &JsonWriter::endArray() {
+  hasItems.pop_back();
+  out << ']';
+  return *this;
+}
+
+JsonWriter &JsonWriter::key(const std::string &name) {
+  separate();
+  out << '"' << jsonEscape(name) << "\":";
+  afterKey = true;
+  return *this;
+}
+
+JsonWriter &JsonWriter::value(const std::string &v) {
+  separate();
+  out << '"' << jsonEscape(v) << '"';
+  return *this;
+}
+
+JsonWriter &JsonWriter::value(const char *v) { return value(std::string(v)); }
+
+JsonWriter &JsonWriter::value(double v) {
+  separate();
+  if (!std::isfinite(v)) {
+    out << "null";
+    return *this;
+  }
+  char buffer[32];
+  std::snprintf(buffer, sizeof(buffer), "%.6g", v);
+  out << buffer;
+  return *this;
+}
+
+JsonWriter &JsonWriter::value(long long v) {
+  separate();
+  out << v;
+  return *this;
+}
+
+JsonWriter &JsonWriter::value(bool v) {
+  separate();
+  out << (v ? "true" : "false");
+  return *this;
+}
+
+std::string jsonEscape(const std::string &text) {
+  std::string escaped;
+  escaped.reserve(text.size());
+  for (const char c : text) {
+    switch (c) {
+    case '"':
+      escaped += "\\\"";
+      break;
+    case '\\':
+      escaped += "\\\\";
+      break;
+    case '\n':
+      escaped += "\\n";
+      break;
+    case '\t':
+      escaped += "\\t";
+      break;
+    case '\r':
+      escaped += "\\r";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20) {
+        char buffer[8];
+        std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+        escaped += buffer;
+      } else {
+        escaped += c;
+      }
+    }
+  }
+  return escaped;
+}
+
+const JsonValue *JsonValue::get(const std::string &name) const {
+  for (const auto &[key, member] : object) {
+    if (key == name)
+      return &member;
+  }
+  return nullptr;
+}
+
+double JsonValue::numberOr(const std::string &name, double fallback) const {
+  const auto *member = get(name);
+  return member && member->type == Type::NUMBER ? member->number : fallback;
+}
+
+std::string JsonValue::stringOr(const std::string &name,
+                                const std::string &fallback) const {
+  const auto *member = get(name);
+  return member && member->type == Type::STRING ? member->string : fallback;
+}
+
+namespace {
+
+class JsonParser {
+public:
+  explicit JsonParser(const std::string &text) : text(text) {}
+
+  JsonValue parseDocument() {
+    JsonValue value = parseValue();
+    skipSpace();
+    if (pos != text.size())
+      fail("trailing characters");
+    return value;
+  }
+
+private:
+  [[noreturn]] void fail(const std::string &what) const {
+    throw std::runtime_error("Invalid JSON (" + what + ") at offset " +
+                             std::to_string(pos));
+  }
+
+  void skipSpace() {
+    while (pos < text.size() && std::isspace(static_cast<unsigned char>(
+                                    text[pos]))) {
+      ++pos;
+    }
+  }
+
+  bool consume(char c) {
+    skipSpace();
+    if (pos < text.size() && text[pos] == c) {
+      ++pos;
+      return true;
+    }
+    return false;
+  }
+
+  void expect(char c) {
+    if (!consume(c))
+      fail(std::string("expected '") + c + "'");
+  }
+
+  JsonValue parseValue() {
+    skipSpace();
+    if (pos >= text.size())
+      fail("unexpected end");
+
+    JsonValue value;
+    const char c = text[pos];
+    if (c == '{') {
+      ++pos;
+      value.type = JsonValue::Type::OBJECT;
+      if (consume('}'))
+        return value;
+      do {
+        skipSpace();
+        std::string key = parseString();
+        expect(':');
+        value.object.emplace_back(std::move(key), parseValue());
+      } while (consume(','));
+      expect('}');
+    } else if (c == '[') {
+      ++pos;
+      value.type = JsonValue::Type::ARRAY;
+      if (consume(']'))
+        return value;
+      do {
+        value.array.push_back(parseValue());
+      } while (consume(','));
+      expect(']');
+    } else if (c == '"') {
+      value.type = JsonValue::Type::STRING;
+      value.string = parseString();
+    } else if (text.compare(pos, 4, "true") == 0) {
+      pos += 4;
+      value.type = JsonValue::Type::BOOLEAN;
+      value.boolean = true;
+    } else if (text.compare(pos, 5, "false") == 0) {
+      pos += 5;
+      value.type = JsonValue::Type::BOOLEAN;
+    } else if (text.compare(pos, 4, "null") == 0) {
+      pos += 4;
+    } else {
+      char *end = nullptr;
+      value.type = JsonValue::Type::NUMBER;
+      value.number = std::strtod(text.c_str() + pos, &end);
+      if (end == text.c_str() + pos)
+        fail("unexpected character");
+      pos = end - text.c_str();
+    }
+    return value;
+  }
+
+  std::string parseString() {
+    if (pos >= text.size() || text[pos] != '"')
+      fail("expected string");
+    ++pos;
+    std::string result;
+    while (pos < text.size() && text[pos] != '"') {
+      char c = text[pos++];
+      if (c != '\\') {
+        result += c;
+        continue;
+      }
+      if (pos >= text.size())
+        fail("unterminated escape");
+      c = text[pos++];
+      switch (c) {
+      case 'n':
+        result += '\n';
+        break;
+      case 't':
+        result += '\t';
+        break;
+      case 'r':
+        result += '\r';
+        break;
+      case 'b':
+        result += '\b';
+        break;
+      case 'f':
+        result += '\f';
+        break;
+      case 'u': {
+        if (pos + 4 > text.size())
+          fail("bad unicode escape");
+        const unsigned code = std::stoul(text.substr(pos, 4), nullptr, 16);
+        pos += 4;
+        // * Only the BMP is needed for paths and symbol names; encode UTF-8.
+        if (code < 0x80) {
+          result += static_cast<char>(code);
+        } else if (code < 0x800) {
+          result += static_cast<char>(0xC0 | (code >> 6));
+          result += static_cast<char>(0x80 | (code & 0x3F));
+        } else {
+          result += static_cast<char>(0xE0 | (code >> 12));
+          result += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+          result += static_cast<char>(0x80 | (code & 0x3F));
+        }
+        break;
+      }
+      default:
+        result += c;
+      }
+    }
+    if (pos >= text.size())
+      fail("unterminated string");
+    ++pos;
+    return result;
+  }
+
+  const std::string &text;
+  size_t pos = 0;
+};
+
+} // namespace
+
+JsonValue parseJson(const std::string &text) {
+  return JsonParser(text).parseDocument();
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Minimal streaming JSON writer. Commas and nesting are tracked
+ * internally; callers only open/close containers and emit keys and values.
+ */
+class JsonWriter {
+public:
+  explicit JsonWriter(std::ostream &out);
+
+  JsonWriter &beginObject();
+  JsonWriter &endObject();
+  JsonWriter &beginArray();
+  JsonWriter &endArray();
+  JsonWriter &key(const std::string &);
+
+  JsonWriter &value(const std::string &);
+  JsonWriter &value(const char *);
+  JsonWriter &value(double);
+  JsonWriter &value(long long);
+  JsonWriter &value(int v) { return value(static_cast<long long>(v)); }
+  JsonWriter &value(long v) { return value(static_cast<long long>(v)); }
+  JsonWriter &value(size_t v) { return value(static_cast<long long>(v)); }
+  JsonWriter &value(bool);
+
+  template <typename T>
+  JsonWriter &field(const std::string &name, const T &v) {
+    key(name);
+    return value(v);
+  }
+
+private:
+  void separate();
+
+  std::ostream &out;
+  std::vector<bool> hasItems;
+  bool afterKey = false;
+};
+
+/**
+ * @brief Parsed JSON document node. Objects keep their members in source
+ * order; lookups are linear, which is fine for the small objects we read.
+ */
+struct JsonValue {
+  enum class Type { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT };
+
+  Type type = Type::NUL;
+  bool boolean = false;
+  double number = 0;
+  std::string string;
+  std::vector<JsonValue> array;
+  std::vector<std::pair<std::string, JsonValue>> object;
+
+  const JsonValue *get(const std::string &) const;
+  double numberOr(const std::string &, double) const;
+  std::string stringOr(const std::string &, const std::string &) const;
+};
+
+std::string jsonEscape(const std::string &);
+JsonValue parseJson(const std::string &);
@@ -0,0 +1,342 @@
+#include "./module_utils.hpp"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <regex>
+#include <stdexcept>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include "../build_utils/build_utils.hpp"
+#include "../file_utils/file_utils.hpp"
+#include "../probe_utils/probe_utils.hpp"
+#include "../system_utils/system_utils.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const std::string INDEX_HEADER = "ccomp-std-modules 1";
+const std::string INDEX_NAME = "modules";
+
+// * Standard headers the fallback std module re-exports (each only if the
+// * library has it). <execution> is left out: libstdc++ needs TBB for it
+// * and it breaks header-unit builds in older GCCs.
+const std::vector<std::string> STD_HEADERS = {
+    "algorithm", "any", "array", "atomic", "barrier", "bit", "bitset",
+    "charconv", "chrono", "codecvt", "compare", "complex", "concepts",
+    "condition_variable", "coroutine", "deque", "exception", "expected",
+    "filesystem", "format", "forward_list", "fstream", "functional",
+    "future", "generator", "initializer_list", "iomanip", "ios", "iosfwd",
+    "iostream", "istream", "iterator", "latch", "limits", "list", "locale",
+    "map", "mdspan", "memory", "memory_resource", "mutex", "new", "numbers",
+    "numeric", "optional", "ostream", "print", "queue", "random", "ranges",
+    "ratio", "regex", "scoped_allocator", "semaphore", "set", "shared_mutex",
+    "source_location", "span", "spanstream", "sstream", "stack",
+    "stacktrace", "stdexcept", "stop_token", "streambuf", "string",
+    "string_view", "syncstream", "system_error", "thread", "tuple",
+    "type_traits", "typeindex", "typeinfo", "unordered_map",
+    "unordered_set", "utility", "valarray", "variant", "vector", "version",
+    "cassert", "cctype", "cerrno", "cfenv", "cfloat", "cinttypes",
+    "climits", "clocale", "cmath", "csetjmp", "csignal", "cstdarg",
+    "cstddef", "cstdint", "cstdio", "cstdlib", "cstring", "ctime", "cuchar",
+    "cwchar", "cwctype"};
+
+std::mutex modulesMutex;
+std::map<std::string, StdModules> builtModules; // * By cache key
+
+bool runQuietly(const std::vector<std::string> &args, std::string &output) {
+  ProcessOptions options;
+  options.mergeStderr = true;
+  options.onOutput = [&output](const char *data, size_t size) {
+    output.append(data, size);
+  };
+  return runProcess(args, options).exitCode == 0;
+}
+
+void run(const std::vector<std::string> &args) {
+  std::string output;
+  if (!runQuietly(args, output)) {
+    throw std::runtime_error("Building the std module failed:\n" +
+                             joinCommand(args) + "\n" + output);
+  }
+}
+
+/**
+ * @brief Sources of std and std.compat listed by the standard library's
+ * modules manifest, if the compiler has one.
+ */
+std::map<std::string, fs::path>
+shippedModuleSources(const std::vector<std::string> &compilerArgs,
+                     bool clang) {
+  auto args = compilerArgs;
+  args.push_back(std::string("-print-file-name=") +
+                 (clang ? "libc++" : "libstdc++") + ".modules.json");
+  std::string output;
+  if (!runQuietly(args, output)) {
+    return {};
+  }
+  output.erase(output.find_last_not_of("\r\n") + 1);
+  const fs::path manifest = output;
+  std::ifstream file(manifest);
+  if (!manifest.is_absolute() || !file) {
+    return {};
+  }
+  const std::string text((std::istreambuf_iterator<char>(file)),
+                         std::istreambuf_iterator<char>());
+
+  // * Entries look like {"logical-name": "std", "source-path": "..."}.
+  std::map<std::string, fs::path> sources;
+  const std::regex nameField("\"logical-name\"\\s*:\\s*\"([^\"]+)\"");
+  const std::regex pathField("\"source-path\"\\s*:\\s*\"([^\"]+)\"");
+  for (std::sregex_iterator it(text.begin(), text.end(), nameField), end;
+       it != end; ++it) {
+    std::smatch path;
+    const auto from = text.begin() + it->position() + it->length();
+    if (isStdModuleName((*it)[1]) &&
+        std::regex_search(from, text.end(), path, pathField)) {
+      sources[(*it)[1]] =
+          (manifest.parent_path() / path[1].str()).lexically_normal();
+    }
+  }
+  return sources;
+}
+
+std::optional<StdModules> loadIndex(const fs::path &file,
+                                    const std::string &key) {
+  std::ifstream in(file);
+  std::string line;
+  if (!std::getline(in, line) || line != INDEX_HEADER ||
+      !std::getline(in, line) || line != "key\t" + key) {
+    return std::nullopt;
+  }
+  // * Lines of "bmi\t<name>\t<path>", "object\t<path>", "mapper\t<line>"
+  // * and "importer\t<flag>".
+  StdModules modules;
+  while (std::getline(in, line)) {
+    const auto tab = line.find('\t');
+    if (tab == std::string::npos) {
+      continue;
+    }
+    const auto field = line.substr(0, tab);
+    auto value = line.substr(tab + 1);
+    if (field == "bmi") {
+      const auto nameEnd = value.find('\t');
+      if (nameEnd != std::string::npos) {
+        modules.bmis[value.substr(0, nameEnd)] = value.substr(nameEnd + 1);
+      }
+    } else if (field == "object") {
+      modules.objects.emplace_back(std::move(value));
+    } else if (field == "mapper") {
+      modules.mapperLines.push_back(std::move(value));
+    } else if (field == "importer") {
+      modules.importerFlags.push_back(std::move(value));
+    }
+  }
+  for (const auto &[name, bmi] : modules.bmis) {
+    if (!fileExists(bmi)) {
+      return std::nullopt;
+    }
+  }
+  for (const auto &object : modules.objects) {
+    if (!fileExists(object)) {
+      return std::nullopt;
+    }
+  }
+  if (modules.bmis.empty()) {
+    return std::nullopt;
+  }
+  return modules;
+}
+
+void saveIndex(const fs::path &file, const std::string &key,
+               const StdModules &modules) {
+  const auto temporary =
+      fs::path(file).concat(".tmp" + std::to_string(getpid()));
+  {
+    std::ofstream out(temporary, std::ios::trunc);
+    out << INDEX_HEADER << '\n' << "key\t" << key << '\n';
+    for (const auto &[name, bmi] : modules.bmis) {
+      out << "bmi\t" << name << '\t' << bmi.string() << '\n';
+    }
+    for (const auto &object : modules.objects) {
+      out << "object\t" << object.string() << '\n';
+    }
+    for (const auto &line : modules.mapperLines) {
+      out << "mapper\t" << line << '\n';
+    }
+    for (const auto &flag : modules.importerFlags) {
+      out << "importer\t" << flag << '\n';
+    }
+    if (!out) {
+      return;
+    }
+  }
+  std::error_code ec;
+  fs::rename(temporary, file, ec);
+  if (ec) {
+    fs::remove(temporary, ec);
+  }
+}
+
+StdModules buildWithClang(const std::vector<std::string> &compilerArgs,
+                          const std::map<std::string, fs::path> &sources,
+                          const fs::path &dir) {
+  if (!sources.count("std")) {
+    throw std::runtime_error(
+        "import std needs a standard library that ships its module sources "
+        "(libc++ 17 or later: pass -stdlib=libc++)");
+  }
+  StdModules modules;
+  // * std.compat imports std, so std goes first.
+  for (const std::string name : {"std", "std.compat"}) {
+    const auto source = sources.find(name);
+    if (source == sources.end()) {
+      continue;
+    }
+    const auto bmi = dir / (name + ".pcm");
+    const auto object = dir / (name + ".o");
+    auto args = compilerArgs;
+    args.insert(args.end(),
+                {"-Wno-reserved-module-identifier", "-isystem",
+                 source->second.parent_path().string()});
+    for (const auto &[built, builtBmi] : modules.bmis) {
+      args.push_back("-fmodule-file=" + built + "=" + builtBmi.string());
+    }
+    auto precompile = args;
+    precompile.insert(precompile.end(),
+                      {"--precompile", "-x", "c++-module",
+                       source->second.string(), "-o", bmi.string()});
+    run(precompile);
+    auto compile = compilerArgs;
+    compile.insert(compile.end(),
+                   {"-c", bmi.string(), "-o", object.string()});
+    run(compile);
+    modules.bmis[name] = bmi;
+    modules.objects.push_back(object);
+  }
+  return modules;
+}
+
+StdModules buildWithGcc(const std::vector<std::string> &compilerArgs,
+                        const std::map<std::string, fs::path> &sources,
+                        const fs::path &dir) {
+  StdModules modules;
+  std::map<std::string, fs::path> interfaces = sources;
+  if (!interfaces.count("std")) {
+    // * No shipped module: a header unit holding every standard header,
+    // * re-exported by std and std.compat (the C headers declare the
+    // * global names too).
+    const auto header = dir / "std.h";
+    {
+      std::ofstream out(header, std::ios::trunc);
+      for (const auto &name : STD_HEADERS) {
+        out << "#if __has_include(<" << name << ">)\n#include <" << name
+            << ">\n#endif\n";
+      }
+    }
+    modules.mapperLines.push_back(header.string() + ' ' +
+                                  (dir / "std.h.gcm").string());
+    // * GCC 12 can't instantiate some std templates (typeid in
+    // * shared_ptr) in a unit that only reaches the header unit through
+    // * another module's import, so those units import std too.
+    const auto importStd = dir / "import-std.h";
+    std::ofstream(importStd, std::ios::trunc) << "import std;\n";
+    modules.importerFlags = {"-include", importStd.string()};
+    for (const std::string name : {"std", "std.compat"}) {
+      interfaces[name] = dir / (name + ".cppm");
+      std::ofstream(interfaces[name], std::ios::trunc)
+          << "export module " << name << ";\nexport import \""
+          << header.string() << "\";\n";
+    }
+  }
+  for (const auto &[name, source] : interfaces) {
+    modules.bmis[name] = dir / (name + ".gcm");
+    modules.mapperLines.push_back(name + ' ' + modules.bmis[name].string());
+  }
+  const auto mapper = dir / "module.map";
+  {
+    std::ofstream out(mapper, std::ios::trunc);
+    for (const auto &line : modules.mapperLines) {
+      out << line << '\n';
+    }
+  }
+
+  auto args = compilerArgs;
+  args.insert(args.end(), {"-fmodules-ts", "-fmodule-mapper=" + mapper.string()});
+  if (!sources.count("std")) {
+    auto headerUnit = args;
+    headerUnit.insert(headerUnit.end(),
+                      {"-x", "c++-header", (dir / "std.h").string()});
+    run(headerUnit);
+  }
+  for (const std::string name : {"std", "std.compat"}) {
+    const auto source = interfaces.find(name);
+    if (source == interfaces.end()) {
+      continue;
+    }
+    const auto object = dir / (name + ".o");
+    auto compile = args;
+    compile.insert(compile.end(), {"-x", "c++", "-c", source->second.string(),
+                                   "-o", object.string()});
+    run(compile);
+    modules.objects.push_back(object);
+  }
+  return modules;
+}
+
+} // namespace
+
+bool isStdModuleName(const std::string &name) {
+  return name == "std" || name == "std.compat";
+}
+
+StdModules prebuiltStdModules(const std::vector<std::string> &compilerArgs,
+                              bool clang, const fs::path &cacheDir) {
+  const auto cacheKey = compilerCacheKey(compilerArgs);
+  if (!cacheKey) {
+    throw std::runtime_error("Can't find the compiler to build the std "
+                             "module with: " +
+                             (compilerArgs.empty() ? "" : compilerArgs[0]));
+  }
+  const auto &key = cacheKey.value();
+  std::lock_guard<std::mutex> lock(modulesMutex);
+  if (const auto known = builtModules.find(key); known != builtModules.end()) {
+    return known->second;
+  }
+  const auto dir = cacheDir / cacheKeyName(key);
+  const auto index = dir / INDEX_NAME;
+  if (auto modules = loadIndex(index, key)) {
+    return builtModules[key] = std::move(modules.value());
+  }
+
+  // * Other ccomp processes may be building the same entry: wait for them
+  // * and use theirs.
+  fs::create_directories(dir);
+  const int lockFd = open(fs::path(dir).concat(".lock").c_str(),
+                          O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (lockFd >= 0) {
+    flock(lockFd, LOCK_EX);
+  }
+  try {
+    auto modules = loadIndex(index, key);
+    if (!modules) {
+      const auto sources = shippedModuleSources(compilerArgs, clang);
+      modules = clang ? buildWithClang(compilerArgs, sources, dir)
+                      : buildWithGcc(compilerArgs, sources, dir);
+      saveIndex(index, key, modules.value());
+    }
+    if (lockFd >= 0) {
+      close(lockFd);
+    }
+    return builtModules[key] = std::move(modules.value());
+  } catch (...) {
+    if (lockFd >= 0) {
+      close(lockFd);
+    }
+    throw;
+  }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * @brief The standard library modules (std and std.compat), built for one
+ * compiler and set of flags.
+ */
+struct StdModules {
+  // * BMI of each module, by name.
+  std::map<std::string, std::filesystem::path> bmis;
+  // * Objects every program importing them links (module initializers).
+  std::vector<std::filesystem::path> objects;
+  // * GCC module-mapper lines for the modules and what they re-export.
+  std::vector<std::string> mapperLines;
+  // * Flags for non-module units that reach the modules only through other
+  // * modules: GCC's header-unit fallback needs std visible there as well.
+  std::vector<std::string> importerFlags;
+};
+
+bool isStdModuleName(const std::string &name);
+
+/**
+ * @brief Builds std and std.compat for a compiler command line (compiler
+ * plus flags, without -c/-o), or returns the copy already in `cacheDir`:
+ * entries are keyed like compiler probes (see compilerCacheKey), so each
+ * compiler and flag set builds them once per machine. The sources the
+ * standard library ships are used when the compiler lists them
+ * (-print-file-name=lib{c,stdc}++.modules.json); GCCs without them get a
+ * std module re-exporting a header unit of the standard headers. Throws
+ * std::runtime_error with the compiler output if the build fails.
+ */
+StdModules prebuiltStdModules(const std::vector<std::string> &compilerArgs,
+                              bool clang,
+                              const std::filesystem::path &cacheDir);
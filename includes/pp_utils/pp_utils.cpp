@@ -0,0 +1,1056 @@
+#include "./pp_utils.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+
+namespace {
+
+// * Nested expansions past this depth are left unexpanded.
+constexpr size_t MAX_EXPANSION_DEPTH = 256;
+
+bool isBlank(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+
+bool isIdentStart(char c) {
+  return std::isalpha(static_cast<unsigned char>(c)) || c == '_' ||
+         static_cast<unsigned char>(c) >= 0x80;
+}
+
+bool isIdentChar(char c) {
+  return isIdentStart(c) || std::isdigit(static_cast<unsigned char>(c));
+}
+
+std::string_view trim(std::string_view text) {
+  while (!text.empty() && (isBlank(text.front()) || text.front() == '\n')) {
+    text.remove_prefix(1);
+  }
+  while (!text.empty() && (isBlank(text.back()) || text.back() == '\n')) {
+    text.remove_suffix(1);
+  }
+  return text;
+}
+
+std::string_view leadingIdentifier(std::string_view text) {
+  text = trim(text);
+  size_t end = 0;
+  while (end < text.size() && isIdentChar(text[end])) {
+    ++end;
+  }
+  return text.substr(0, end);
+}
+
+// * Length of a backslash-newline at `i`, or 0.
+size_t spliceLength(std::string_view text, size_t i) {
+  if (text[i] != '\\') {
+    return 0;
+  }
+  if (i + 1 < text.size() && text[i + 1] == '\n') {
+    return 2;
+  }
+  if (i + 2 < text.size() && text[i + 1] == '\r' && text[i + 2] == '\n') {
+    return 3;
+  }
+  return 0;
+}
+
+// * Returns the index of the newline ending a // comment (or the end).
+size_t skipLineComment(std::string_view text, size_t i) {
+  while (true) {
+    const size_t newline = text.find('\n', i);
+    if (newline == std::string_view::npos) {
+      return text.size();
+    }
+    size_t before = newline;
+    if (before > 0 && text[before - 1] == '\r') {
+      --before;
+    }
+    if (before == 0 || text[before - 1] != '\\') {
+      return newline;
+    }
+    i = newline + 1; // * Continued onto the next line
+  }
+}
+
+// * Returns the index just past a /* */ comment (or the end).
+size_t skipBlockComment(std::string_view text, size_t i) {
+  const size_t end = text.find("*/", i + 2);
+  return end == std::string_view::npos ? text.size() : end + 2;
+}
+
+// * Returns the index just past a "..." or '...' literal; an unterminated
+// * one ends at the newline.
+size_t skipQuoted(std::string_view text, size_t i) {
+  const char quote = text[i];
+  for (size_t j = i + 1; j < text.size(); ++j) {
+    if (text[j] == '\\') {
+      ++j;
+    } else if (text[j] == quote) {
+      return j + 1;
+    } else if (text[j] == '\n') {
+      return j;
+    }
+  }
+  return text.size();
+}
+
+// * The identifier-like token ending right before `i`.
+std::string_view tokenBefore(std::string_view text, size_t i,
+                             bool withSeparators) {
+  size_t start = i;
+  while (start > 0 && (isIdentChar(text[start - 1]) ||
+                       (withSeparators && text[start - 1] == '\''))) {
+    --start;
+  }
+  return text.substr(start, i - start);
+}
+
+bool isRawPrefix(std::string_view prefix) {
+  return prefix == "R" || prefix == "LR" || prefix == "uR" ||
+         prefix == "UR" || prefix == "u8R";
+}
+
+// * Returns the index just past R"delim(...)delim" starting at the quote.
+size_t skipRawString(std::string_view text, size_t quote) {
+  const size_t open = text.find('(', quote + 1);
+  if (open == std::string_view::npos || open - quote - 1 > 16) {
+    return skipQuoted(text, quote);
+  }
+  std::string terminator = ")";
+  terminator.append(text.substr(quote + 1, open - quote - 1));
+  terminator += '"';
+  const size_t end = text.find(terminator, open + 1);
+  return end == std::string_view::npos ? text.size()
+                                       : end + terminator.size();
+}
+
+std::optional<DirectiveKind> directiveKind(std::string_view name) {
+  static const std::unordered_map<std::string_view, DirectiveKind> kinds = {
+      {"define", DirectiveKind::DEFINE},
+      {"undef", DirectiveKind::UNDEF},
+      {"if", DirectiveKind::IF},
+      {"ifdef", DirectiveKind::IFDEF},
+      {"ifndef", DirectiveKind::IFNDEF},
+      {"elif", DirectiveKind::ELIF},
+      {"elifdef", DirectiveKind::ELIFDEF},
+      {"elifndef", DirectiveKind::ELIFNDEF},
+      {"else", DirectiveKind::ELSE},
+      {"endif", DirectiveKind::ENDIF},
+      {"include", DirectiveKind::INCLUDE},
+      {"import", DirectiveKind::INCLUDE},
+      {"include_next", DirectiveKind::INCLUDE_NEXT},
+      {"pragma", DirectiveKind::PRAGMA_ONCE},
+  };
+  const auto kind = kinds.find(name);
+  if (kind == kinds.end()) {
+    return std::nullopt;
+  }
+  return kind->second;
+}
+
+// * Reads the directive whose '#' is right before `i`; returns the index of
+// * the newline ending it.
+size_t readDirective(std::string_view text, size_t i,
+                     std::vector<Directive> &directives) {
+  std::string line;
+  while (i < text.size() && text[i] != '\n') {
+    const char c = text[i];
+    if (const size_t splice = spliceLength(text, i)) {
+      i += splice;
+    } else if (c == '/' && i + 1 < text.size() && text[i + 1] == '/') {
+      i = skipLineComment(text, i);
+    } else if (c == '/' && i + 1 < text.size() && text[i + 1] == '*') {
+      i = skipBlockComment(text, i);
+      line += ' ';
+    } else if (c == '"' ||
+               (c == '\'' && (line.empty() || !isIdentChar(line.back())))) {
+      const size_t end = skipQuoted(text, i);
+      line.append(text.substr(i, end - i));
+      i = end;
+    } else {
+      line += c;
+      ++i;
+    }
+  }
+
+  const std::string_view content = trim(line);
+  const std::string_view name = leadingIdentifier(content);
+  const auto kind = directiveKind(name);
+  if (!kind) {
+    return i; // * #error, #line, # 1 "file" and such don't matter here
+  }
+  const std::string_view rest = trim(content.substr(name.size()));
+  if (kind == DirectiveKind::PRAGMA_ONCE && rest != "once") {
+    return i;
+  }
+  directives.push_back({kind.value(), std::string(rest)});
+  return i;
+}
+
+std::optional<IncludeTarget> literalTarget(std::string_view text) {
+  text = trim(text);
+  if (text.size() >= 2 && (text.front() == '"' || text.front() == '<')) {
+    const char close = text.front() == '"' ? '"' : '>';
+    const size_t end = text.find(close, 1);
+    if (end != std::string_view::npos) {
+      return IncludeTarget{std::string(text.substr(1, end - 1)),
+                           text.front() == '<'};
+    }
+  }
+  return std::nullopt;
+}
+
+bool isModuleName(std::string_view name) {
+  if (!name.empty() && name.front() == ':') {
+    name.remove_prefix(1); // * :P, a partition of the current module
+  }
+  bool expectIdentifier = true;
+  bool partition = false;
+  for (const char c : name) {
+    if (isIdentChar(c)) {
+      expectIdentifier = false;
+    } else if (c == '.' && !expectIdentifier) {
+      expectIdentifier = true;
+    } else if (c == ':' && !expectIdentifier && !partition) {
+      expectIdentifier = partition = true;
+    } else {
+      return false;
+    }
+  }
+  return !expectIdentifier;
+}
+
+/**
+ * @brief Reads a module or import declaration starting at `i` (the start
+ * of a line). Returns the index past its ';', or std::nullopt if the line
+ * isn't one (e.g. `export int f();` or an identifier named import).
+ */
+std::optional<size_t> readModuleDeclaration(std::string_view text, size_t i,
+                                            std::vector<Directive> &out) {
+  auto word = [&](size_t &at) {
+    while (at < text.size() && isBlank(text[at])) {
+      ++at;
+    }
+    const size_t start = at;
+    while (at < text.size() && isIdentChar(text[at])) {
+      ++at;
+    }
+    return text.substr(start, at - start);
+  };
+  size_t at = i;
+  auto keyword = word(at);
+  const bool exported = keyword == "export";
+  if (exported) {
+    keyword = word(at);
+  }
+  if (keyword != "module" && keyword != "import") {
+    return std::nullopt;
+  }
+  const size_t end = text.find(';', at);
+  if (end == std::string_view::npos || text.find('\n', at) < end) {
+    return std::nullopt;
+  }
+  std::string name;
+  for (const char c : text.substr(at, end - at)) {
+    if (!isBlank(c)) {
+      name += c;
+    }
+  }
+  if (keyword == "module") {
+    if (name.empty() || name == ":private") {
+      return end + 1; // * Global module fragment, private fragment
+    }
+    if (!isModuleName(name) || name.front() == ':') {
+      return std::nullopt;
+    }
+    out.push_back({exported ? DirectiveKind::EXPORT_MODULE
+                            : DirectiveKind::MODULE,
+                   name});
+    return end + 1;
+  }
+  const auto headerUnit = literalTarget(text.substr(at, end - at));
+  if (!headerUnit && !isModuleName(name)) {
+    return std::nullopt;
+  }
+  out.push_back({DirectiveKind::IMPORT,
+                 headerUnit ? std::string(trim(text.substr(at, end - at)))
+                            : name});
+  return end + 1;
+}
+
+std::string guardOf(const std::vector<Directive> &directives) {
+  if (directives.size() < 3 ||
+      directives.back().kind != DirectiveKind::ENDIF) {
+    return "";
+  }
+  std::string name;
+  const auto &first = directives.front();
+  if (first.kind == DirectiveKind::IFNDEF) {
+    name = leadingIdentifier(first.text);
+  } else if (first.kind == DirectiveKind::IF) {
+    // * #if !defined(GUARD) / #if !defined GUARD
+    std::string compact;
+    for (const char c : first.text) {
+      if (!isBlank(c)) {
+        compact += c;
+      }
+    }
+    if (compact.rfind("!defined", 0) == 0) {
+      std::string_view operand = std::string_view(compact).substr(8);
+      const bool parenthesized = !operand.empty() && operand.front() == '(';
+      if (parenthesized) {
+        operand.remove_prefix(1);
+      }
+      const auto identifier = leadingIdentifier(operand);
+      const auto after = operand.substr(identifier.size());
+      if (parenthesized ? after == ")" : after.empty()) {
+        name = identifier;
+      }
+    }
+  }
+  if (name.empty() || directives[1].kind != DirectiveKind::DEFINE ||
+      leadingIdentifier(directives[1].text) != name) {
+    return "";
+  }
+
+  // * The #endif closing the guard must be the last directive.
+  size_t depth = 0;
+  for (size_t i = 0; i < directives.size(); ++i) {
+    switch (directives[i].kind) {
+    case DirectiveKind::IF:
+    case DirectiveKind::IFDEF:
+    case DirectiveKind::IFNDEF:
+      ++depth;
+      break;
+    case DirectiveKind::ELIF:
+    case DirectiveKind::ELIFDEF:
+    case DirectiveKind::ELIFNDEF:
+    case DirectiveKind::ELSE:
+      if (depth == 1) {
+        return "";
+      }
+      break;
+    case DirectiveKind::ENDIF:
+      if (--depth == 0) {
+        return i + 1 == directives.size() ? name : "";
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  return "";
+}
+
+using Kind = PpToken::Kind;
+
+const std::vector<std::string_view> PUNCTUATORS = {
+    "%:%:", "...", "<<=", ">>=", "<=>", "##", "<<", ">>", "<=", ">=",
+    "==",   "!=",  "&&",  "||",  "->",  "++", "--", "::", "+=", "-=",
+    "*=",   "/=",  "%=",  "&=",  "|=",  "^=", "%:",
+};
+
+std::vector<PpToken> tokenize(std::string_view text) {
+  std::vector<PpToken> tokens;
+  size_t i = 0;
+  bool spaced = false;
+  while (i < text.size()) {
+    const char c = text[i];
+    if (isBlank(c) || c == '\n') {
+      spaced = true;
+      ++i;
+      continue;
+    }
+    size_t end = i + 1;
+    Kind kind = Kind::PUNCTUATOR;
+    if (isIdentStart(c)) {
+      while (end < text.size() && isIdentChar(text[end])) {
+        ++end;
+      }
+      kind = Kind::IDENTIFIER;
+      // * Encoding prefixes (u8"", L'x', R"(...)") belong to the literal.
+      const std::string_view word = text.substr(i, end - i);
+      if (end < text.size() && (text[end] == '"' || text[end] == '\'') &&
+          (word == "L" || word == "u" || word == "U" || word == "u8" ||
+           isRawPrefix(word))) {
+        kind = text[end] == '"' ? Kind::STRING : Kind::CHARACTER;
+        end = isRawPrefix(word) && text[end] == '"' ? skipRawString(text, end)
+                                                    : skipQuoted(text, end);
+      }
+    } else if (std::isdigit(static_cast<unsigned char>(c)) ||
+               (c == '.' && i + 1 < text.size() &&
+                std::isdigit(static_cast<unsigned char>(text[i + 1])))) {
+      kind = Kind::NUMBER;
+      while (end < text.size()) {
+        const char d = text[end];
+        if (isIdentChar(d) || d == '.') {
+          ++end;
+        } else if (d == '\'' && end + 1 < text.size() &&
+                   isIdentChar(text[end + 1])) {
+          end += 2;
+        } else if ((d == '+' || d == '-') &&
+                   std::string_view("eEpP").find(text[end - 1]) !=
+                       std::string_view::npos) {
+          ++end;
+        } else {
+          break;
+        }
+      }
+    } else if (c == '"' || c == '\'') {
+      kind = c == '"' ? Kind::STRING : Kind::CHARACTER;
+      end = skipQuoted(text, i);
+    } else {
+      for (const auto punctuator : PUNCTUATORS) {
+        if (text.substr(i, punctuator.size()) == punctuator) {
+          end = i + punctuator.size();
+          break;
+        }
+      }
+    }
+    tokens.push_back({kind, std::string(text.substr(i, end - i)), spaced});
+    spaced = false;
+    i = end;
+  }
+  return tokens;
+}
+
+bool isPunctuator(const PpToken &token, std::string_view text) {
+  return token.kind == Kind::PUNCTUATOR && token.text == text;
+}
+
+bool isIdentifier(const PpToken &token, std::string_view text) {
+  return token.kind == Kind::IDENTIFIER && token.text == text;
+}
+
+// * Index of the ')' closing the '(' at `open`, or tokens.size().
+size_t closingParen(const std::vector<PpToken> &tokens, size_t open) {
+  size_t depth = 0;
+  for (size_t i = open; i < tokens.size(); ++i) {
+    if (isPunctuator(tokens[i], "(")) {
+      ++depth;
+    } else if (isPunctuator(tokens[i], ")") && --depth == 0) {
+      return i;
+    }
+  }
+  return tokens.size();
+}
+
+std::string spell(const std::vector<PpToken> &tokens) {
+  std::string text;
+  for (const auto &token : tokens) {
+    if (token.spaced && !text.empty()) {
+      text += ' ';
+    }
+    text += token.text;
+  }
+  return text;
+}
+
+std::string stringize(const std::vector<PpToken> &tokens) {
+  std::string text = "\"";
+  for (const char c : spell(tokens)) {
+    if (c == '"' || c == '\\') {
+      text += '\\';
+    }
+    text += c;
+  }
+  return text + '"';
+}
+
+// * Glues the tokens around each ## together.
+std::vector<PpToken> paste(const std::vector<PpToken> &tokens) {
+  std::vector<PpToken> result;
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    if (!isPunctuator(tokens[i], "##")) {
+      result.push_back(tokens[i]);
+      continue;
+    }
+    if (i + 1 == tokens.size()) {
+      break;
+    }
+    std::string glued = result.empty() ? "" : result.back().text;
+    glued += tokens[++i].text;
+    if (!result.empty()) {
+      result.pop_back();
+    }
+    for (auto &token : tokenize(glued)) {
+      result.push_back(std::move(token));
+    }
+  }
+  return result;
+}
+
+std::optional<IncludeTarget> targetOf(const std::vector<PpToken> &tokens) {
+  if (tokens.empty()) {
+    return std::nullopt;
+  }
+  if (tokens.front().kind == Kind::STRING &&
+      tokens.front().text.front() == '"' && tokens.front().text.size() >= 2) {
+    const auto &text = tokens.front().text;
+    return IncludeTarget{text.substr(1, text.size() - 2), false};
+  }
+  if (isPunctuator(tokens.front(), "<")) {
+    std::string name;
+    for (size_t i = 1; i < tokens.size(); ++i) {
+      if (isPunctuator(tokens[i], ">")) {
+        return IncludeTarget{name, true};
+      }
+      if (tokens[i].spaced && i > 1) {
+        name += ' ';
+      }
+      name += tokens[i].text;
+    }
+  }
+  return std::nullopt;
+}
+
+std::optional<int64_t> integerValue(std::string_view text) {
+  std::string digits;
+  for (const char c : text) {
+    if (c != '\'') {
+      digits += c;
+    }
+  }
+  while (!digits.empty() &&
+         std::string_view("uUlLzZ").find(digits.back()) !=
+             std::string_view::npos) {
+    digits.pop_back();
+  }
+  int base = 10;
+  size_t start = 0;
+  if (digits.size() > 1 && digits[0] == '0') {
+    if (digits[1] == 'x' || digits[1] == 'X') {
+      base = 16;
+      start = 2;
+    } else if (digits[1] == 'b' || digits[1] == 'B') {
+      base = 2;
+      start = 2;
+    } else {
+      base = 8;
+      start = 1;
+    }
+  }
+  if (start == digits.size() && base != 8) {
+    return std::nullopt;
+  }
+  uint64_t value = 0;
+  for (size_t i = start; i < digits.size(); ++i) {
+    const char c = static_cast<char>(std::tolower(digits[i]));
+    int digit = 0;
+    if (c >= '0' && c <= '9') {
+      digit = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      digit = c - 'a' + 10;
+    } else {
+      return std::nullopt; // * Floating-point or malformed
+    }
+    if (digit >= base) {
+      return std::nullopt;
+    }
+    value = value * base + digit;
+  }
+  return static_cast<int64_t>(value);
+}
+
+std::optional<int64_t> characterValue(std::string_view text) {
+  const size_t quote = text.find('\'');
+  if (quote == std::string_view::npos || text.size() < quote + 3) {
+    return std::nullopt;
+  }
+  const std::string_view body = text.substr(quote + 1, text.size() - quote - 2);
+  if (body.empty()) {
+    return std::nullopt;
+  }
+  if (body[0] != '\\') {
+    return static_cast<unsigned char>(body[0]);
+  }
+  if (body.size() < 2) {
+    return std::nullopt;
+  }
+  switch (body[1]) {
+  case 'n':
+    return '\n';
+  case 't':
+    return '\t';
+  case 'r':
+    return '\r';
+  case 'a':
+    return '\a';
+  case 'b':
+    return '\b';
+  case 'f':
+    return '\f';
+  case 'v':
+    return '\v';
+  case 'x':
+    return integerValue("0x" + std::string(body.substr(2)));
+  default:
+    if (body[1] >= '0' && body[1] <= '7') {
+      return integerValue("0" + std::string(body.substr(1)));
+    }
+    return static_cast<unsigned char>(body[1]);
+  }
+}
+
+/**
+ * @brief #if arithmetic on intmax_t (wrapping instead of overflowing).
+ * Operands on the side not taken by &&, || and ?: aren't checked for
+ * division by zero.
+ */
+class ConditionParser {
+public:
+  explicit ConditionParser(const std::vector<PpToken> &tokens)
+      : tokens(tokens) {}
+
+  std::optional<int64_t> parse() {
+    const int64_t value = parseComma(true);
+    if (failed || position != tokens.size()) {
+      return std::nullopt;
+    }
+    return value;
+  }
+
+private:
+  const std::vector<PpToken> &tokens;
+  size_t position = 0;
+  bool failed = false;
+
+  bool accept(std::string_view text) {
+    if (position < tokens.size() && isPunctuator(tokens[position], text)) {
+      ++position;
+      return true;
+    }
+    return false;
+  }
+
+  int64_t fail() {
+    failed = true;
+    position = tokens.size();
+    return 0;
+  }
+
+  int64_t parseComma(bool live) {
+    int64_t value = parseConditional(live);
+    while (!failed && accept(",")) {
+      value = parseConditional(live);
+    }
+    return value;
+  }
+
+  int64_t parseConditional(bool live) {
+    const int64_t condition = parseBinary(1, live);
+    if (failed || !accept("?")) {
+      return condition;
+    }
+    const int64_t whenTrue = parseComma(live && condition != 0);
+    if (!accept(":")) {
+      return fail();
+    }
+    const int64_t whenFalse = parseConditional(live && condition == 0);
+    return condition != 0 ? whenTrue : whenFalse;
+  }
+
+  static int precedence(std::string_view op) {
+    static const std::unordered_map<std::string_view, int> precedences = {
+        {"||", 1}, {"&&", 2}, {"|", 3},   {"^", 4},   {"&", 5},
+        {"==", 6}, {"!=", 6}, {"<", 7},   {">", 7},   {"<=", 7},
+        {">=", 7}, {"<<", 8}, {">>", 8},  {"+", 9},   {"-", 9},
+        {"*", 10}, {"/", 10}, {"%", 10},
+    };
+    const auto found = precedences.find(op);
+    return found == precedences.end() ? 0 : found->second;
+  }
+
+  int64_t parseBinary(int minimum, bool live) {
+    int64_t left = parseUnary(live);
+    while (!failed && position < tokens.size() &&
+           tokens[position].kind == Kind::PUNCTUATOR) {
+      const std::string op = tokens[position].text;
+      const int level = precedence(op);
+      if (level == 0 || level < minimum) {
+        break;
+      }
+      ++position;
+      bool rightLive = live;
+      if (op == "&&") {
+        rightLive = live && left != 0;
+      } else if (op == "||") {
+        rightLive = live && left == 0;
+      }
+      const int64_t right = parseBinary(level + 1, rightLive);
+      left = apply(op, left, right, rightLive);
+    }
+    return left;
+  }
+
+  int64_t apply(const std::string &op, int64_t left, int64_t right,
+                bool live) {
+    const auto a = static_cast<uint64_t>(left);
+    const auto b = static_cast<uint64_t>(right);
+    if (op == "||")
+      return left != 0 || right != 0;
+    if (op == "&&")
+      return left != 0 && right != 0;
+    if (op == "|")
+      return static_cast<int64_t>(a | b);
+    if (op == "^")
+      return static_cast<int64_t>(a ^ b);
+    if (op == "&")
+      return static_cast<int64_t>(a & b);
+    if (op == "==")
+      return left == right;
+    if (op == "!=")
+      return left != right;
+    if (op == "<")
+      return left < right;
+    if (op == ">")
+      return left > right;
+    if (op == "<=")
+      return left <= right;
+    if (op == ">=")
+      return left >= right;
+    if (op == "<<")
+      return static_cast<int64_t>(a << (b & 63));
+    if (op == ">>")
+      return left >> (b & 63);
+    if (op == "+")
+      return static_cast<int64_t>(a + b);
+    if (op == "-")
+      return static_cast<int64_t>(a - b);
+    if (op == "*")
+      return static_cast<int64_t>(a * b);
+    if (right == 0 || (left == INT64_MIN && right == -1)) {
+      return live ? fail() : 0;
+    }
+    return op == "/" ? left / right : left % right;
+  }
+
+  int64_t parseUnary(bool live) {
+    if (position >= tokens.size()) {
+      return fail();
+    }
+    const PpToken &token = tokens[position++];
+    switch (token.kind) {
+    case Kind::NUMBER: {
+      const auto value = integerValue(token.text);
+      return value ? value.value() : fail();
+    }
+    case Kind::CHARACTER: {
+      const auto value = characterValue(token.text);
+      return value ? value.value() : fail();
+    }
+    case Kind::IDENTIFIER:
+      // * Identifiers left after expansion are 0 (true/false aside).
+      return token.text == "true" ? 1 : 0;
+    case Kind::STRING:
+      return fail();
+    case Kind::PUNCTUATOR:
+      break;
+    }
+    if (token.text == "(") {
+      const int64_t value = parseComma(live);
+      return accept(")") ? value : fail();
+    }
+    if (token.text == "+")
+      return parseUnary(live);
+    if (token.text == "-")
+      return static_cast<int64_t>(0 - static_cast<uint64_t>(parseUnary(live)));
+    if (token.text == "~")
+      return ~parseUnary(live);
+    if (token.text == "!")
+      return parseUnary(live) == 0;
+    return fail();
+  }
+};
+
+} // namespace
+
+MinimizedSource minimizeSource(std::string_view text, bool preambleOnly) {
+  MinimizedSource source;
+  bool lineHasCode = false;
+  size_t i = 0;
+  while (i < text.size()) {
+    const char c = text[i];
+    if (c == '\n') {
+      lineHasCode = false;
+      ++i;
+    } else if (isBlank(c)) {
+      ++i;
+    } else if (const size_t splice = spliceLength(text, i)) {
+      i += splice;
+    } else if (c == '/' && i + 1 < text.size() && text[i + 1] == '/') {
+      i = skipLineComment(text, i);
+    } else if (c == '/' && i + 1 < text.size() && text[i + 1] == '*') {
+      i = skipBlockComment(text, i);
+    } else if (c == '#' && !lineHasCode) {
+      i = readDirective(text, i + 1, source.directives);
+    } else if (const auto end =
+                   !lineHasCode && (c == 'e' || c == 'm' || c == 'i')
+                       ? readModuleDeclaration(text, i, source.directives)
+                       : std::nullopt) {
+      i = end.value();
+      lineHasCode = true;
+    } else if (preambleOnly) {
+      break;
+    } else {
+      lineHasCode = true;
+      if (c == '"') {
+        i = isRawPrefix(tokenBefore(text, i, false)) ? skipRawString(text, i)
+                                                     : skipQuoted(text, i);
+      } else if (c == '\'') {
+        // * A digit separator (1'000) rather than a character literal?
+        const auto before = tokenBefore(text, i, true);
+        const bool separator =
+            !before.empty() &&
+            std::isdigit(static_cast<unsigned char>(before.front()));
+        i = separator ? i + 1 : skipQuoted(text, i);
+      } else {
+        ++i;
+      }
+    }
+  }
+  source.guard = guardOf(source.directives);
+  return source;
+}
+
+void MacroTable::define(std::string_view text) {
+  text = trim(text);
+  const std::string_view name = leadingIdentifier(text);
+  if (name.empty()) {
+    return;
+  }
+  Macro macro;
+  std::string_view rest = text.substr(name.size());
+  // * Function-like only if '(' follows the name directly.
+  if (!rest.empty() && rest.front() == '(') {
+    const size_t close = rest.find(')');
+    if (close == std::string_view::npos) {
+      return;
+    }
+    macro.functionLike = true;
+    bool named = false; // * GNU named variadics: args...
+    for (const auto &token : tokenize(rest.substr(1, close - 1))) {
+      if (isPunctuator(token, "...")) {
+        macro.variadic = true;
+        if (!named) {
+          macro.params.push_back("__VA_ARGS__");
+        }
+      } else if (token.kind == Kind::IDENTIFIER) {
+        macro.params.push_back(token.text);
+      }
+      named = token.kind == Kind::IDENTIFIER;
+    }
+    rest = rest.substr(close + 1);
+  }
+  macro.body = tokenize(rest);
+  macros[std::string(name)] = std::move(macro);
+}
+
+void MacroTable::undefine(std::string_view name) {
+  macros.erase(std::string(trim(name)));
+}
+
+bool MacroTable::isDefined(std::string_view name) const {
+  return macros.count(std::string(trim(name))) > 0;
+}
+
+std::vector<PpToken> MacroTable::expand(const std::vector<PpToken> &tokens,
+                                        std::vector<std::string> &active,
+                                        size_t depth, bool inCondition) const {
+  if (depth > MAX_EXPANSION_DEPTH) {
+    return tokens;
+  }
+  std::vector<PpToken> result;
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    const PpToken &token = tokens[i];
+    if (token.kind != Kind::IDENTIFIER) {
+      result.push_back(token);
+      continue;
+    }
+
+    if (inCondition && token.text == "defined") {
+      // * defined X / defined(X) is answered later, unexpanded.
+      size_t last = i;
+      if (i + 1 < tokens.size() && isPunctuator(tokens[i + 1], "(")) {
+        last = std::min(i + 3, tokens.size() - 1);
+      } else if (i + 1 < tokens.size()) {
+        last = i + 1;
+      }
+      result.insert(result.end(), tokens.begin() + i,
+                    tokens.begin() + last + 1);
+      i = last;
+      continue;
+    }
+    if (inCondition && token.text.rfind("__has_", 0) == 0 &&
+        i + 1 < tokens.size() && isPunctuator(tokens[i + 1], "(")) {
+      const size_t last = std::min(closingParen(tokens, i + 1),
+                                   tokens.size() - 1);
+      result.insert(result.end(), tokens.begin() + i,
+                    tokens.begin() + last + 1);
+      i = last;
+      continue;
+    }
+
+    const auto found = macros.find(token.text);
+    if (found == macros.end() ||
+        std::find(active.begin(), active.end(), token.text) != active.end()) {
+      result.push_back(token);
+      continue;
+    }
+    const Macro &macro = found->second;
+
+    std::vector<PpToken> replacement;
+    if (!macro.functionLike) {
+      replacement = paste(macro.body);
+    } else {
+      if (i + 1 >= tokens.size() || !isPunctuator(tokens[i + 1], "(")) {
+        result.push_back(token); // * A function-like name on its own
+        continue;
+      }
+      const size_t close = closingParen(tokens, i + 1);
+      if (close == tokens.size()) {
+        result.push_back(token);
+        continue;
+      }
+      // * Split the arguments at top-level commas (the variadic one keeps
+      // * its commas).
+      std::vector<std::vector<PpToken>> args(1);
+      size_t nesting = 0;
+      for (size_t j = i + 2; j < close; ++j) {
+        if (isPunctuator(tokens[j], "(")) {
+          ++nesting;
+        } else if (isPunctuator(tokens[j], ")")) {
+          --nesting;
+        } else if (nesting == 0 && isPunctuator(tokens[j], ",") &&
+                   !(macro.variadic &&
+                     args.size() >= macro.params.size())) {
+          args.emplace_back();
+          continue;
+        }
+        args.back().push_back(tokens[j]);
+      }
+      i = close;
+
+      static const std::vector<PpToken> none;
+      auto argument =
+          [&](const std::string &name) -> const std::vector<PpToken> * {
+        for (size_t p = 0; p < macro.params.size(); ++p) {
+          if (macro.params[p] == name) {
+            return p < args.size() ? &args[p] : &none;
+          }
+        }
+        return nullptr;
+      };
+
+      const auto &body = macro.body;
+      for (size_t k = 0; k < body.size(); ++k) {
+        const PpToken &part = body[k];
+        if (isPunctuator(part, "#") && k + 1 < body.size()) {
+          if (const auto *arg = argument(body[k + 1].text)) {
+            replacement.push_back({Kind::STRING, stringize(*arg)});
+            ++k;
+            continue;
+          }
+        }
+        const auto *arg =
+            part.kind == Kind::IDENTIFIER ? argument(part.text) : nullptr;
+        if (!arg) {
+          replacement.push_back(part);
+          continue;
+        }
+        const bool pasted = (k > 0 && isPunctuator(body[k - 1], "##")) ||
+                            (k + 1 < body.size() &&
+                             isPunctuator(body[k + 1], "##"));
+        if (pasted) {
+          replacement.insert(replacement.end(), arg->begin(), arg->end());
+        } else {
+          const auto expanded = expand(*arg, active, depth + 1, inCondition);
+          replacement.insert(replacement.end(), expanded.begin(),
+                             expanded.end());
+        }
+      }
+      replacement = paste(replacement);
+    }
+
+    active.push_back(token.text);
+    const auto rescanned = expand(replacement, active, depth + 1, inCondition);
+    active.pop_back();
+    result.insert(result.end(), rescanned.begin(), rescanned.end());
+  }
+  return result;
+}
+
+std::optional<bool> MacroTable::evaluate(std::string_view expression,
+                                         const HasIncludeFn &hasInclude) const {
+  std::vector<std::string> active;
+  const auto expanded = expand(tokenize(expression), active, 0, true);
+
+  // * Answer defined and the __has_* checks; what's left is arithmetic.
+  std::vector<PpToken> tokens;
+  for (size_t i = 0; i < expanded.size(); ++i) {
+    const PpToken &token = expanded[i];
+    if (isIdentifier(token, "defined")) {
+      std::string name;
+      if (i + 1 < expanded.size() &&
+          expanded[i + 1].kind == Kind::IDENTIFIER) {
+        name = expanded[++i].text;
+      } else if (i + 3 < expanded.size() &&
+                 isPunctuator(expanded[i + 1], "(") &&
+                 expanded[i + 2].kind == Kind::IDENTIFIER &&
+                 isPunctuator(expanded[i + 3], ")")) {
+        name = expanded[i + 2].text;
+        i += 3;
+      } else {
+        return std::nullopt;
+      }
+      tokens.push_back({Kind::NUMBER, isDefined(name) ? "1" : "0"});
+    } else if (token.kind == Kind::IDENTIFIER &&
+               token.text.rfind("__has_", 0) == 0 && i + 1 < expanded.size() &&
+               isPunctuator(expanded[i + 1], "(")) {
+      const size_t close = closingParen(expanded, i + 1);
+      if (close == expanded.size()) {
+        return std::nullopt;
+      }
+      // * Other __has_* (attributes, builtins, features) depend on the
+      // * compiler, so the answer is unknown.
+      if (token.text != "__has_include" &&
+          token.text != "__has_include_next") {
+        return std::nullopt;
+      }
+      std::vector<PpToken> operand(expanded.begin() + i + 2,
+                                   expanded.begin() + close);
+      auto target = targetOf(operand);
+      if (!target) {
+        target = targetOf(expand(operand, active, 0, false));
+      }
+      if (!target) {
+        return std::nullopt;
+      }
+      const bool found = !hasInclude || hasInclude(target.value());
+      tokens.push_back({Kind::NUMBER, found ? "1" : "0"});
+      i = close;
+    } else {
+      tokens.push_back(token);
+    }
+  }
+
+  const auto value = ConditionParser(tokens).parse();
+  if (!value) {
+    return std::nullopt;
+  }
+  return value.value() != 0;
+}
+
+std::optional<IncludeTarget>
+MacroTable::includeTarget(std::string_view text) const {
+  if (auto target = literalTarget(text)) {
+    return target;
+  }
+  std::vector<std::string> active;
+  const auto expanded = expand(tokenize(text), active, 0, false);
+  if (!expanded.empty() && expanded.front().kind == Kind::STRING) {
+    return literalTarget(expanded.front().text);
+  }
+  return targetOf(expanded);
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Directive-level preprocessing, enough to tell which includes a
+ * translation unit really reaches: sources are reduced to the directives
+ * that matter for it (in the spirit of clang-scan-deps' minimization), and
+ * conditionals are evaluated against a macro table.
+ */
+enum class DirectiveKind {
+  DEFINE,
+  UNDEF,
+  IF,
+  IFDEF,
+  IFNDEF,
+  ELIF,
+  ELIFDEF,
+  ELIFNDEF,
+  ELSE,
+  ENDIF,
+  INCLUDE,
+  INCLUDE_NEXT,
+  PRAGMA_ONCE,
+  // * C++20 module declarations (text: the module name, or the header of
+  // * a header-unit import).
+  MODULE,        // * module M; / module M:P;
+  EXPORT_MODULE, // * export module M; / export module M:P;
+  IMPORT,        // * [export] import M; / import :P; / import <h>;
+};
+
+struct Directive {
+  DirectiveKind kind;
+  // * Everything after the directive name: comments removed, continued
+  // * lines joined.
+  std::string text;
+};
+
+struct MinimizedSource {
+  std::vector<Directive> directives;
+  // * Include guard macro, if every directive sits inside
+  // * #ifndef GUARD / #define GUARD ... #endif.
+  std::string guard;
+};
+
+/**
+ * @brief Keeps only the directives of a source (ignoring anything in
+ * comments and string literals), plus its module and import declarations.
+ * With preambleOnly it stops at the first other line of code.
+ */
+MinimizedSource minimizeSource(std::string_view text,
+                               bool preambleOnly = false);
+
+struct IncludeTarget {
+  std::string name;
+  bool angled = false; // * <name> rather than "name"
+};
+
+/**
+ * @brief Answers __has_include in conditionals.
+ */
+using HasIncludeFn = std::function<bool(const IncludeTarget &)>;
+
+struct PpToken {
+  enum class Kind { IDENTIFIER, NUMBER, STRING, CHARACTER, PUNCTUATOR };
+  Kind kind;
+  std::string text;
+  bool spaced = false; // * Preceded by whitespace (kept when stringizing)
+};
+
+class MacroTable {
+public:
+  /**
+   * @brief Applies a #define (its text, e.g. "MAX(a, b) ((a) > (b) ? a : b)").
+   */
+  void define(std::string_view text);
+  void undefine(std::string_view name);
+  bool isDefined(std::string_view name) const;
+
+  /**
+   * @brief Value of an #if/#elif condition after macro expansion, or
+   * std::nullopt if it isn't a valid constant expression or asks the
+   * compiler something only it knows (__has_builtin, __has_cpp_attribute,
+   * __has_feature and the other __has_* checks besides __has_include).
+   */
+  std::optional<bool> evaluate(std::string_view expression,
+                               const HasIncludeFn &hasInclude) const;
+
+  /**
+   * @brief What an #include line names, expanding macros if needed
+   * (#include CONFIG_HEADER).
+   */
+  std::optional<IncludeTarget> includeTarget(std::string_view text) const;
+
+private:
+  struct Macro {
+    bool functionLike = false;
+    bool variadic = false;
+    std::vector<std::string> params;
+    std::vector<PpToken> body;
+  };
+  std::unordered_map<std::string, Macro> macros;
+
+  // * `active` holds the macros being expanded (they aren't re-expanded);
+  // * in conditions, operands of defined and __has_include are kept as is.
+  std::vector<PpToken> expand(const std::vector<PpToken> &,
+                              std::vector<std::string> &active,
+                              size_t depth, bool inCondition) const;
+};
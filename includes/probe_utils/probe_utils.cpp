@@ -0,0 +1,235 @@
+#include "./probe_utils.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <unistd.h>
+
+#include "../file_utils/file_utils.hpp"
+#include "../simd_utils/simd_utils.hpp"
+#include "../system_utils/system_utils.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const std::string PROBE_HEADER = "ccomp-compiler-probe 1";
+
+std::mutex probeMutex;
+std::map<std::string, CompilerProbe> probes; // * By cache key
+
+/**
+ * @brief The flags that can change a probe: outputs, dependency files and
+ * diagnostics options don't.
+ */
+std::vector<std::string> probeFlags(const std::vector<std::string> &args) {
+  std::vector<std::string> flags;
+  for (size_t i = 1; i < args.size(); ++i) {
+    const auto &arg = args[i];
+    if (arg == "-o" || arg == "-MF" || arg == "-MT" || arg == "-MQ") {
+      ++i; // * Output options and their argument
+    } else if (arg != "-c" && arg.rfind("-M", 0) != 0 &&
+               arg.rfind("-W", 0) != 0 && arg.rfind("-ftime-", 0) != 0) {
+      flags.push_back(arg);
+    }
+  }
+  return flags;
+}
+
+std::string runCapturing(const std::vector<std::string> &args, bool mergeStderr,
+                         bool &ok) {
+  std::string output;
+  ProcessOptions options;
+  options.mergeStderr = mergeStderr;
+  options.onOutput = [&output](const char *data, size_t size) {
+    output.append(data, size);
+  };
+  ok = runProcess(args, options).exitCode == 0;
+  return output;
+}
+
+/**
+ * @brief Fills in the version and the <...> search list from `-v` output.
+ */
+void parseVerbose(const std::string &output, CompilerProbe &probe) {
+  std::istringstream lines(output);
+  std::string line;
+  bool inSearchList = false;
+  while (std::getline(lines, line)) {
+    if (line.rfind("#include <...> search starts here:", 0) == 0) {
+      inSearchList = true;
+    } else if (line.rfind("End of search list.", 0) == 0) {
+      inSearchList = false;
+    } else if (inSearchList && !line.empty() && line.front() == ' ') {
+      auto dir = line.substr(1);
+      const auto framework = dir.find(" (framework directory)");
+      if (framework != std::string::npos) {
+        dir.erase(framework);
+      }
+      probe.includeDirs.push_back(fs::path(dir).lexically_normal());
+    } else if (probe.version.empty() &&
+               line.find(" version ") != std::string::npos &&
+               line.rfind("Target:", 0) != 0) {
+      probe.version = line;
+    }
+  }
+}
+
+std::optional<CompilerProbe> loadProbe(const fs::path &file,
+                                       const std::string &key) {
+  std::ifstream in(file);
+  std::string line;
+  if (!std::getline(in, line) || line != PROBE_HEADER ||
+      !std::getline(in, line) || line != "key\t" + key) {
+    return std::nullopt;
+  }
+  // * Lines of "version\t...", "include\t<dir>" and "define\t<body>".
+  CompilerProbe probe;
+  while (std::getline(in, line)) {
+    const auto tab = line.find('\t');
+    if (tab == std::string::npos) {
+      continue;
+    }
+    const auto field = line.substr(0, tab);
+    auto value = line.substr(tab + 1);
+    if (field == "version") {
+      probe.version = std::move(value);
+    } else if (field == "include") {
+      probe.includeDirs.emplace_back(std::move(value));
+    } else if (field == "define") {
+      probe.macros.push_back(std::move(value));
+    }
+  }
+  return probe;
+}
+
+void saveProbe(const fs::path &file, const std::string &key,
+               const CompilerProbe &probe) {
+  const auto temporary =
+      fs::path(file).concat(".tmp" + std::to_string(getpid()));
+  {
+    std::ofstream out(temporary, std::ios::trunc);
+    out << PROBE_HEADER << '\n' << "key\t" << key << '\n';
+    out << "version\t" << probe.version << '\n';
+    for (const auto &dir : probe.includeDirs) {
+      out << "include\t" << dir.string() << '\n';
+    }
+    for (const auto &macro : probe.macros) {
+      out << "define\t" << macro << '\n';
+    }
+    if (!out) {
+      return;
+    }
+  }
+  std::error_code ec;
+  fs::rename(temporary, file, ec);
+  if (ec) {
+    fs::remove(temporary, ec);
+  }
+}
+
+} // namespace
+
+std::optional<fs::path>
+resolveCompilerBinary(const std::vector<std::string> &compilerArgs) {
+  if (compilerArgs.empty() || compilerArgs.front().empty()) {
+    return std::nullopt;
+  }
+  const auto &program = compilerArgs.front();
+  std::optional<fs::path> found;
+  if (program.find('/') != std::string::npos) {
+    found = program;
+  } else if (const char *path = std::getenv("PATH")) {
+    std::istringstream dirs(path);
+    std::string dir;
+    while (!found && std::getline(dirs, dir, ':')) {
+      const auto candidate = fs::path(dir.empty() ? "." : dir) / program;
+      if (access(candidate.c_str(), X_OK) == 0 && fileExists(candidate)) {
+        found = candidate;
+      }
+    }
+  }
+  std::error_code ec;
+  if (!found || access(found->c_str(), X_OK) != 0) {
+    return std::nullopt;
+  }
+  const auto canonical = fs::canonical(found.value(), ec);
+  return ec ? found : canonical;
+}
+
+std::optional<std::string>
+compilerCacheKey(const std::vector<std::string> &compilerArgs) {
+  const auto binary = resolveCompilerBinary(compilerArgs);
+  const auto stamp = binary ? statFile(binary.value()) : std::nullopt;
+  if (!stamp) {
+    return std::nullopt;
+  }
+  std::string key = binary->string() + '\t' + std::to_string(stamp->size) +
+                    '\t' + std::to_string(stamp->mtimeNs);
+  for (const auto &flag : probeFlags(compilerArgs)) {
+    key += '\t' + flag;
+  }
+  return key;
+}
+
+std::string cacheKeyName(const std::string &key) {
+  std::ostringstream name;
+  name << std::hex << std::setw(16) << std::setfill('0')
+       << hashBytes(key.data(), key.size());
+  return name.str();
+}
+
+std::optional<CompilerProbe>
+probeCompiler(const std::vector<std::string> &compilerArgs,
+              const fs::path &cacheDir) {
+  const auto cacheKey = compilerCacheKey(compilerArgs);
+  if (!cacheKey) {
+    return std::nullopt;
+  }
+  const auto &key = cacheKey.value();
+  const auto flags = probeFlags(compilerArgs);
+
+  std::lock_guard<std::mutex> lock(probeMutex);
+  if (const auto known = probes.find(key); known != probes.end()) {
+    return known->second;
+  }
+  const auto file = cacheDir / cacheKeyName(key);
+  if (auto probe = loadProbe(file, key)) {
+    return probes[key] = std::move(probe.value());
+  }
+
+  // * Two runs: the macros go to stdout, the -v details to stderr.
+  std::vector<std::string> args{compilerArgs.front()};
+  args.insert(args.end(), flags.begin(), flags.end());
+  args.insert(args.end(), {"-x", "c++", "-E", "/dev/null"});
+  auto macroArgs = args;
+  macroArgs.insert(macroArgs.end() - 1, "-dM");
+  auto verboseArgs = args;
+  verboseArgs.insert(verboseArgs.end() - 1, "-v");
+
+  bool ok = false;
+  CompilerProbe probe;
+  const auto macros = runCapturing(macroArgs, false, ok);
+  if (!ok) {
+    return std::nullopt;
+  }
+  std::istringstream lines(macros);
+  const std::string prefix = "#define ";
+  for (std::string line; std::getline(lines, line);) {
+    if (line.rfind(prefix, 0) == 0) {
+      probe.macros.push_back(line.substr(prefix.size()));
+    }
+  }
+  const auto verbose = runCapturing(verboseArgs, true, ok);
+  if (ok) {
+    parseVerbose(verbose, probe);
+  }
+
+  std::error_code ec;
+  fs::create_directories(cacheDir, ec);
+  saveProbe(file, key, probe);
+  return probes[key] = std::move(probe);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * @brief What a compiler command starts every compile with.
+ */
+struct CompilerProbe {
+  // * First line of `-v` naming the compiler, e.g. "gcc version 13.2.0".
+  std::string version;
+  // * #define bodies from `-dM -E`, e.g. "__GNUC__ 13".
+  std::vector<std::string> macros;
+  // * Directories searched for <...> includes, in order (from `-v`).
+  std::vector<std::filesystem::path> includeDirs;
+};
+
+/**
+ * @brief Probes the compiler a command line runs (its first word, looked up
+ * in PATH and through symlinks). Results are kept in `cacheDir`, keyed by
+ * the compiler binary's path, size and mtime plus the flags that can change
+ * them, so the compiler is only spawned the first time any project uses
+ * that combination. std::nullopt if the compiler can't be run.
+ */
+std::optional<CompilerProbe>
+probeCompiler(const std::vector<std::string> &compilerArgs,
+              const std::filesystem::path &cacheDir);
+
+/**
+ * @brief Identifies what a command line's compiler produces: the resolved
+ * binary, its size and mtime, and the flags that can change its output
+ * (not outputs, dependency files or warnings). std::nullopt if the compiler
+ * can't be found.
+ */
+std::optional<std::string>
+compilerCacheKey(const std::vector<std::string> &compilerArgs);
+
+/**
+ * @brief File name for a cache entry (hex digest of its key).
+ */
+std::string cacheKeyName(const std::string &key);
+
+/**
+ * @brief The resolved compiler binary of a command line, if found.
+ */
+std::optional<std::filesystem::path>
+resolveCompilerBinary(const std::vector<std::string> &compilerArgs);
@@ -0,0 +1,176 @@
+#include "./profile_utils.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+#include "../json_utils/json_utils.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+void addEntry(std::map<std::string, ProfileEntry> &entries,
+              std::set<std::string> &seenInUnit, const std::string &name,
+              double ms) {
+  auto &entry = entries[name];
+  entry.totalMs += ms;
+  ++entry.count;
+  if (seenInUnit.insert(name).second) {
+    ++entry.translationUnits;
+  }
+}
+
+void printRanking(std::ostream &out, const std::string &title,
+                  const std::map<std::string, ProfileEntry> &entries,
+                  size_t limit) {
+  std::vector<std::pair<std::string, ProfileEntry>> ranked(entries.begin(),
+                                                           entries.end());
+  std::sort(ranked.begin(), ranked.end(), [](const auto &a, const auto &b) {
+    return a.second.totalMs > b.second.totalMs;
+  });
+  if (ranked.size() > limit) {
+    ranked.resize(limit);
+  }
+
+  out << title << ":\n";
+  if (ranked.empty()) {
+    out << "  (no data)\n";
+  }
+  for (const auto &[name, entry] : ranked) {
+    out << std::fixed << std::setprecision(1) << std::setw(10)
+        << entry.totalMs << " ms" << std::setw(6) << entry.count << "x"
+        << std::setw(5) << entry.translationUnits << " TUs  " << name << '\n';
+  }
+  out << '\n';
+}
+
+} // namespace
+
+/**
+ * @brief Folds one clang -ftime-trace file into the profile. "Source" events
+ * give (inclusive) header parse times, "Instantiate*" events template
+ * instantiation times and the "Total *" events the per-TU phase split.
+ */
+void addClangTimeTrace(CompileProfile &profile, const fs::path &source,
+                       const fs::path &traceFile) {
+  std::ifstream file(traceFile);
+  if (!file.is_open()) {
+    throw std::runtime_error("Unable to open file: " + traceFile.string());
+  }
+  std::stringstream content;
+  content << file.rdbuf();
+  const JsonValue trace = parseJson(content.str());
+  const JsonValue *events = trace.get("traceEvents");
+  if (!events) {
+    return;
+  }
+
+  UnitProfile unit;
+  unit.source = source;
+  std::set<std::string> seenHeaders;
+  std::set<std::string> seenTemplates;
+  for (const auto &event : events->array) {
+    const std::string name = event.stringOr("name", "");
+    const double ms = event.numberOr("dur", 0) / 1000.0;
+    const JsonValue *args = event.get("args");
+    const std::string detail = args ? args->stringOr("detail", "") : "";
+
+    if (name == "Source" && !detail.empty()) {
+      addEntry(profile.headers, seenHeaders, detail, ms);
+    } else if ((name == "InstantiateClass" ||
+                name == "InstantiateFunction") &&
+               !detail.empty()) {
+      addEntry(profile.templates, seenTemplates, detail, ms);
+    } else if (name == "Total Frontend") {
+      unit.frontendMs = ms;
+    } else if (name == "Total InstantiateFunction" ||
+               name == "Total InstantiateClass") {
+      unit.templatesMs += ms;
+    } else if (name == "Total Backend") {
+      unit.backendMs = ms;
+    }
+  }
+  profile.units.push_back(unit);
+}
+
+/**
+ * @brief Folds one gcc -ftime-report block into the profile. gcc only
+ * reports per-phase totals, so this contributes to the per-TU split only.
+ */
+void addGccTimeReport(CompileProfile &profile, const fs::path &source,
+                      const std::string &report) {
+  UnitProfile unit;
+  unit.source = source;
+
+  std::istringstream lines(report);
+  std::string line;
+  while (std::getline(lines, line)) {
+    const auto colon = line.find(':');
+    if (colon == std::string::npos) {
+      continue;
+    }
+    std::string name = line.substr(0, colon);
+    name.erase(0, name.find_first_not_of(" |"));
+    name.erase(name.find_last_not_of(' ') + 1);
+
+    // * Columns: usr (pct) sys (pct) wall (pct) mem (pct); we want wall.
+    std::istringstream columns(line.substr(colon + 1));
+    std::string token;
+    std::vector<double> numbers;
+    bool inParens = false;
+    while (columns >> token) {
+      if (token.front() == '(')
+        inParens = true;
+      if (!inParens) {
+        try {
+          size_t used = 0;
+          const double number = std::stod(token, &used);
+          if (used == token.size())
+            numbers.push_back(number);
+        } catch (const std::exception &) {
+        }
+      }
+      if (token.back() == ')')
+        inParens = false;
+    }
+    if (numbers.size() < 3) {
+      continue;
+    }
+    const double wallMs = numbers[2] * 1000.0;
+
+    if (name == "phase parsing" || name == "phase lang. deferred") {
+      unit.frontendMs += wallMs;
+    } else if (name == "template instantiation") {
+      unit.templatesMs = wallMs;
+    } else if (name == "phase opt and generate") {
+      unit.backendMs = wallMs;
+    }
+  }
+  profile.units.push_back(unit);
+}
+
+void printCompileProfile(std::ostream &out, const CompileProfile &profile,
+                         size_t limit) {
+  out << "\nCompile profile of " << profile.units.size()
+      << " translation unit(s)\n\n";
+  printRanking(out, "Most expensive headers (inclusive parse time)",
+               profile.headers, limit);
+  printRanking(out, "Slowest template instantiations", profile.templates,
+               limit);
+
+  auto units = profile.units;
+  std::sort(units.begin(), units.end(), [](const auto &a, const auto &b) {
+    return a.backendMs > b.backendMs;
+  });
+  out << "Time per TU (frontend / templates / backend):\n";
+  for (const auto &unit : units) {
+    out << std::fixed << std::setprecision(1) << std::setw(10)
+        << unit.frontendMs << " ms" << std::setw(10) << unit.templatesMs
+        << " ms" << std::setw(10) << unit.backendMs << " ms  "
+        << unit.source.string() << '\n';
+  }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct ProfileEntry {
+  double totalMs = 0;
+  size_t count = 0;
+  size_t translationUnits = 0;
+};
+
+struct UnitProfile {
+  std::filesystem::path source;
+  double frontendMs = 0;
+  double templatesMs = 0;
+  double backendMs = 0;
+};
+
+/**
+ * @brief Compile-time profile aggregated across translation units, built
+ * from clang -ftime-trace JSON files and/or gcc -ftime-report output.
+ */
+struct CompileProfile {
+  std::map<std::string, ProfileEntry> headers;
+  std::map<std::string, ProfileEntry> templates;
+  std::vector<UnitProfile> units;
+};
+
+void addClangTimeTrace(CompileProfile &, const std::filesystem::path &,
+                       const std::filesystem::path &);
+void addGccTimeReport(CompileProfile &, const std::filesystem::path &,
+                      const std::string &);
+void printCompileProfile(std::ostream &, const CompileProfile &, size_t);
@@ -0,0 +1,312 @@
+#include "./remote_utils.hpp"
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+#include "../socket_utils/socket_utils.hpp"
+#include "../system_utils/system_utils.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const std::string COMPILE_REQUEST = "compile";
+
+bool splitHostPort(const std::string &address, std::string &host, int &port) {
+  const auto colon = address.rfind(':');
+  if (colon == std::string::npos) {
+    return false;
+  }
+  host = address.substr(0, colon);
+  try {
+    port = std::stoi(address.substr(colon + 1));
+  } catch (const std::exception &) {
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Flags a worker passes to its compiler. Workers accept requests from
+ * anyone who can reach them, so this is an allow-list of code-generation
+ * flags: nothing that names a file or program (-o, -B, -specs, @file,
+ * plugins, profiles, paths) or passes options on to other tools
+ * (-wrapper, -Wl, -Wa, -Wp, -Xlinker).
+ */
+bool isCodegenFlag(const std::string &flag) {
+  if (flag.size() < 2 || flag[0] != '-' ||
+      flag.find('/') != std::string::npos) {
+    return false;
+  }
+  for (const std::string denied :
+       {"-fplugin", "-fprofile", "-fauto-profile", "-fdump", "-fopt-info",
+        "-fmodule", "-fuse-"}) {
+    if (flag.rfind(denied, 0) == 0) {
+      return false;
+    }
+  }
+  if (flag.rfind("-W", 0) == 0) {
+    return flag.find(',') == std::string::npos;
+  }
+  for (const std::string exact :
+       {"-w", "-pedantic", "-pedantic-errors", "-pthread", "-ansi"}) {
+    if (flag == exact) {
+      return true;
+    }
+  }
+  for (const std::string prefix : {"-O", "-g", "-std=", "-f", "-m"}) {
+    if (flag.rfind(prefix, 0) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Flags that only matter while preprocessing, which the client does;
+ * the ones listed take their value as a separate argument when given alone.
+ */
+bool isPreprocessorFlag(const std::string &flag, bool &takesValue) {
+  for (const std::string option :
+       {"-I", "-D", "-U", "-isystem", "-iquote", "-idirafter", "-include",
+        "-imacros"}) {
+    if (flag.rfind(option, 0) == 0) {
+      takesValue = flag == option;
+      return true;
+    }
+  }
+  takesValue = false;
+  return flag.rfind("-nostdinc", 0) == 0;
+}
+
+std::optional<size_t> parseCount(const std::string &field) {
+  if (field.empty() || field.find_first_not_of("0123456789") != std::string::npos) {
+    return std::nullopt;
+  }
+  try {
+    return std::stoul(field);
+  } catch (const std::exception &) {
+    return std::nullopt;
+  }
+}
+
+std::string readFile(const fs::path &path) {
+  std::ifstream file(path, std::ios::binary);
+  std::stringstream content;
+  content << file.rdbuf();
+  return content.str();
+}
+
+/**
+ * @brief Name of the compiler driver in an expanded compiler spec: the last
+ * of its leading non-flag tokens, past any launcher (e.g. "ccache g++").
+ */
+std::string driverName(const std::vector<std::string> &compilerArgs) {
+  std::string driver;
+  for (size_t i = 0;
+       i < compilerArgs.size() && compilerArgs[i].rfind("-", 0) != 0; ++i) {
+    driver = fs::path(compilerArgs[i]).filename().string();
+  }
+  return driver;
+}
+
+/**
+ * @brief Compiles one preprocessed TU with the worker's own compiler, or
+ * returns the reason the request was refused.
+ */
+RemoteCompileResult compileLocally(const std::vector<std::string> &compilerArgs,
+                                   const RemoteCommand &command,
+                                   const std::string &preprocessedSource,
+                                   std::string &refusal) {
+  RemoteCompileResult result;
+  const std::string driver = driverName(compilerArgs);
+  if (command.compiler != driver) {
+    refusal = "this worker compiles with " + driver;
+    return result;
+  }
+  for (const auto &flag : command.flags) {
+    if (!isCodegenFlag(flag)) {
+      refusal = "flag not accepted: " + flag;
+      return result;
+    }
+  }
+
+  char directoryTemplate[] = "/tmp/ccomp-worker-XXXXXX";
+  if (!mkdtemp(directoryTemplate)) {
+    result.exitCode = 1;
+    result.output = "ccomp worker: could not create a temporary directory\n";
+    return result;
+  }
+  const fs::path directory = directoryTemplate;
+  const fs::path input = directory / "input.ii";
+  const fs::path object = directory / "output.o";
+  std::ofstream inputFile(input, std::ios::binary);
+  if (!(inputFile << preprocessedSource << std::flush)) {
+    refusal = "could not write the source to " + directory.string();
+    std::error_code ec;
+    fs::remove_all(directory, ec);
+    return result;
+  }
+  inputFile.close();
+
+  auto args = compilerArgs;
+  args.insert(args.end(), command.flags.begin(), command.flags.end());
+  args.insert(args.end(), {"-x", "c++-cpp-output", "-c", input.string(), "-o",
+                           object.string()});
+  ProcessOptions options;
+  options.mergeStderr = true;
+  options.onOutput = [&result](const char *data, size_t size) {
+    result.output.append(data, size);
+  };
+  try {
+    result.exitCode = runProcess(args, options).exitCode;
+  } catch (const std::exception &e) {
+    result.exitCode = 1;
+    result.output += e.what();
+  }
+  if (result.exitCode == 0) {
+    result.object = readFile(object);
+  }
+
+  std::error_code ec;
+  fs::remove_all(directory, ec);
+  return result;
+}
+
+void serveConnection(int fd, const std::vector<std::string> &compilerArgs) {
+  while (const auto request = receiveMessage(fd)) {
+    const auto fields = splitFields(request.value());
+    // * Request: "compile", compiler name, flag count, flags..., preprocessed
+    // * source.
+    if (fields.size() < 4 || fields[0] != COMPILE_REQUEST) {
+      break;
+    }
+    const auto flagCount = parseCount(fields[2]);
+    if (!flagCount || flagCount.value() != fields.size() - 4) {
+      break;
+    }
+    const RemoteCommand command{
+        fields[1], std::vector<std::string>(fields.begin() + 3,
+                                            fields.end() - 1)};
+    std::string refusal;
+    const auto result =
+        compileLocally(compilerArgs, command, fields.back(), refusal);
+    // * Reply: "refused", reason; or exit code, output, object.
+    const std::string reply =
+        refusal.empty() ? joinFields({std::to_string(result.exitCode),
+                                      result.output, result.object})
+                        : joinFields({"refused", refusal});
+    if (!sendMessage(fd, reply)) {
+      break;
+    }
+  }
+  close(fd);
+}
+
+} // namespace
+
+int connectWorker(const std::string &address) {
+  if (address.rfind("unix:", 0) == 0) {
+    return connectUnix(address.substr(5));
+  }
+  std::string host;
+  int port;
+  const std::string hostPort =
+      address.rfind("tcp:", 0) == 0 ? address.substr(4) : address;
+  return splitHostPort(hostPort, host, port) ? connectTcp(host, port) : -1;
+}
+
+int listenWorker(const std::string &address) {
+  if (address.rfind("unix:", 0) == 0) {
+    unlink(address.substr(5).c_str());
+    return listenUnix(address.substr(5));
+  }
+  std::string host;
+  int port;
+  const std::string hostPort =
+      address.rfind("tcp:", 0) == 0 ? address.substr(4) : address;
+  return splitHostPort(hostPort, host, port) ? listenTcp(host, port) : -1;
+}
+
+/**
+ * @brief Splits a compiler command line (driver plus flags) into what a
+ * worker is sent. Preprocessor flags are dropped, since the source arrives
+ * preprocessed; nullopt if any other flag isn't one workers accept, so the
+ * TU is compiled locally.
+ */
+std::optional<RemoteCommand>
+remoteCommandFor(const std::vector<std::string> &compilerArgs) {
+  RemoteCommand command;
+  command.compiler = driverName(compilerArgs);
+  size_t i = 0;
+  while (i < compilerArgs.size() && compilerArgs[i].rfind("-", 0) != 0) {
+    ++i;
+  }
+  for (; i < compilerArgs.size(); ++i) {
+    bool takesValue = false;
+    if (isPreprocessorFlag(compilerArgs[i], takesValue)) {
+      i += takesValue;
+    } else if (isCodegenFlag(compilerArgs[i])) {
+      command.flags.push_back(compilerArgs[i]);
+    } else {
+      return std::nullopt;
+    }
+  }
+  if (command.compiler.empty()) {
+    return std::nullopt;
+  }
+  return command;
+}
+
+/**
+ * @brief Sends one preprocessed TU to a worker. Returns nullopt when the
+ * worker can't be reached, refuses the request or sends a malformed reply,
+ * so the caller can compile locally instead.
+ */
+std::optional<RemoteCompileResult>
+compileRemotely(const std::string &address, const RemoteCommand &command,
+                const std::string &preprocessedSource) {
+  const int fd = connectWorker(address);
+  if (fd < 0) {
+    return std::nullopt;
+  }
+
+  std::vector<std::string> fields{COMPILE_REQUEST, command.compiler,
+                                  std::to_string(command.flags.size())};
+  fields.insert(fields.end(), command.flags.begin(), command.flags.end());
+  fields.push_back(preprocessedSource);
+
+  std::optional<RemoteCompileResult> result;
+  if (sendMessage(fd, joinFields(fields))) {
+    if (const auto reply = receiveMessage(fd)) {
+      const auto replyFields = splitFields(reply.value());
+      const auto exitCode =
+          replyFields.size() == 3 ? parseCount(replyFields[0]) : std::nullopt;
+      if (exitCode && exitCode.value() <= 255) {
+        result = RemoteCompileResult{static_cast<int>(exitCode.value()),
+                                     replyFields[1], replyFields[2]};
+      }
+    }
+  }
+  close(fd);
+  return result;
+}
+
+/**
+ * @brief Worker loop: one thread per client connection. Every TU is
+ * compiled with `compilerArgs` (the worker's own compiler), never with a
+ * program named by the client.
+ */
+void serveCompileRequests(int listenFd,
+                          const std::vector<std::string> &compilerArgs) {
+  while (true) {
+    const int fd = acceptConnection(listenFd);
+    if (fd >= 0) {
+      std::thread(serveConnection, fd, compilerArgs).detach();
+    }
+  }
+}
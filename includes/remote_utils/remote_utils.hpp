@@ -0,0 +1,37 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * @brief distcc-style remote compilation: the client preprocesses locally and
+ * ships the preprocessed source to a worker, which compiles it and returns
+ * the object file. Workers are addressed as "unix:/path/to/socket",
+ * "tcp:host:port" or "host:port".
+ */
+struct RemoteCompileResult {
+  int exitCode = 0;
+  std::string output;
+  std::string object;
+};
+
+/**
+ * @brief What a worker is told about a TU's compile: the file name of the
+ * client's compiler driver (the worker compiles with its own) and the
+ * code-generation flags.
+ */
+struct RemoteCommand {
+  std::string compiler;
+  std::vector<std::string> flags;
+};
+
+int connectWorker(const std::string &address);
+int listenWorker(const std::string &address);
+std::optional<RemoteCommand>
+remoteCommandFor(const std::vector<std::string> &compilerArgs);
+std::optional<RemoteCompileResult>
+compileRemotely(const std::string &address, const RemoteCommand &command,
+                const std::string &preprocessedSource);
+void serveCompileRequests(int listenFd,
+                          const std::vector<std::string> &compilerArgs);
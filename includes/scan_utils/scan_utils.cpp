@@ -0,0 +1,1686 @@
+#include "./scan_utils.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <dirent.h>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "../file_utils/file_utils.hpp"
+#include "../io_utils/io_utils.hpp"
+#include "../pp_utils/pp_utils.hpp"
+#include "../simd_utils/simd_utils.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct ScanCacheEntry {
+  FileStamp stamp;
+  std::vector<std::string> includes;
+  bool dirty = false;
+  bool preambleOnly = false;
+};
+
+struct DirectoryCacheEntry {
+  FileStamp stamp;
+  std::vector<fs::path> sources;
+  std::vector<fs::path> subdirectories;
+  bool dirty = false;
+};
+
+struct DirectiveCacheEntry {
+  FileStamp stamp;
+  std::shared_ptr<const MinimizedSource> source;
+  uint64_t hash = 0; // * Of the contents it was minimized from
+  bool dirty = false;
+};
+
+std::atomic<bool> scanPreambleOnly{false};
+std::mutex cacheMutex;
+std::map<fs::path, ScanCacheEntry> scanCache;
+std::map<fs::path, DirectoryCacheEntry> directoryCache;
+// * Minimized directive streams, by path (while its stamp holds) and by
+// * content hash (so a touched but unchanged file isn't minimized again).
+std::map<fs::path, DirectiveCacheEntry> directiveCache;
+std::unordered_map<uint64_t, std::shared_ptr<const MinimizedSource>>
+    minimizedByHash;
+// * Guarded by cacheMutex.
+std::shared_ptr<const MacroTable> scanMacros;
+std::vector<fs::path> scanSystemDirs;
+
+// * Like the compiler's #include nesting limit; stops unguarded cycles.
+constexpr size_t MAX_INCLUDE_DEPTH = 200;
+
+// * Below this size one read() into a reused buffer beats mmap's setup and
+// * page faults.
+constexpr size_t MMAP_THRESHOLD = 64 * 1024;
+
+/**
+ * @brief The whole contents of a file as one view: mmap'd (read
+ * sequentially) for large files, read into a per-thread buffer otherwise.
+ */
+class SourceText {
+public:
+  explicit SourceText(const fs::path &filePath) {
+    const int fd = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+      if (fd >= 0)
+        close(fd);
+      throw std::runtime_error("Unable to open file: " + filePath.string());
+    }
+    const size_t size = static_cast<size_t>(info.st_size);
+
+    if (size >= MMAP_THRESHOLD) {
+      void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapped != MAP_FAILED) {
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        mapping = mapped;
+        mappedSize = size;
+        text = std::string_view(static_cast<const char *>(mapped), size);
+        close(fd);
+        return;
+      }
+    }
+
+    thread_local std::string buffer;
+    buffer.resize(std::max<size_t>(size, 4096));
+    size_t length = 0;
+    ssize_t got;
+    // * Loop until EOF: the file may have grown since fstat().
+    while ((got = read(fd, buffer.data() + length, buffer.size() - length)) >
+           0) {
+      length += static_cast<size_t>(got);
+      if (length == buffer.size()) {
+        buffer.resize(buffer.size() * 2);
+      }
+    }
+    close(fd);
+    if (got < 0) {
+      throw std::runtime_error("Unable to read file: " + filePath.string());
+    }
+    text = std::string_view(buffer.data(), length);
+  }
+
+  ~SourceText() {
+    if (mapping) {
+      munmap(mapping, mappedSize);
+    }
+  }
+
+  SourceText(const SourceText &) = delete;
+  SourceText &operator=(const SourceText &) = delete;
+
+  std::string_view view() const { return text; }
+
+private:
+  void *mapping = nullptr;
+  size_t mappedSize = 0;
+  std::string_view text;
+};
+
+bool isBlank(char c) {
+  return c == ' ' || c == '\t' || c == '\v' || c == '\f' || c == '\r';
+}
+
+/**
+ * @brief Matches one line against `^\s*#include\s*"([^"]+)"\s*$` and
+ * returns the quoted name (a view into the line).
+ */
+std::optional<std::string_view> matchQuotedInclude(std::string_view line) {
+  constexpr std::string_view directive = "#include";
+  size_t pos = 0;
+  while (pos < line.size() && isBlank(line[pos]))
+    ++pos;
+  if (line.compare(pos, directive.size(), directive) != 0) {
+    return std::nullopt;
+  }
+  pos += directive.size();
+  while (pos < line.size() && isBlank(line[pos]))
+    ++pos;
+  if (pos == line.size() || line[pos] != '"') {
+    return std::nullopt;
+  }
+  const size_t nameStart = ++pos;
+  const size_t nameEnd = line.find('"', nameStart);
+  if (nameEnd == std::string_view::npos || nameEnd == nameStart) {
+    return std::nullopt;
+  }
+  for (pos = nameEnd + 1; pos < line.size(); ++pos) {
+    if (!isBlank(line[pos])) {
+      return std::nullopt;
+    }
+  }
+  return line.substr(nameStart, nameEnd - nameStart);
+}
+
+/**
+ * @brief Whether a line still belongs to the preamble: blank, a comment or
+ * a directive. inComment carries an open block comment across lines.
+ */
+bool isPreambleLine(std::string_view line, bool &inComment) {
+  size_t pos = 0;
+  while (true) {
+    if (inComment) {
+      const size_t close = line.find("*/", pos);
+      if (close == std::string_view::npos) {
+        return true;
+      }
+      inComment = false;
+      pos = close + 2;
+    }
+    while (pos < line.size() && isBlank(line[pos]))
+      ++pos;
+    if (pos == line.size() || line[pos] == '#' ||
+        line.compare(pos, 2, "//") == 0) {
+      return true;
+    }
+    if (line.compare(pos, 2, "/*") != 0) {
+      return false;
+    }
+    inComment = true;
+    pos += 2;
+  }
+}
+
+struct ScanResult {
+  fs::path file;
+  std::vector<std::string> names;
+  std::vector<fs::path> edges;
+  std::vector<std::string> unresolved;
+  std::string error;
+};
+
+/**
+ * @brief Set of already-queued files, sharded so scanner threads rarely
+ * contend on the same lock.
+ */
+class VisitedSet {
+public:
+  bool insert(const fs::path &path) {
+    auto &shard = shards[std::hash<std::string>{}(path.native()) % SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.paths.insert(path.native()).second;
+  }
+
+private:
+  static constexpr size_t SHARDS = 64;
+  struct Shard {
+    std::mutex mutex;
+    std::unordered_set<std::string> paths;
+  };
+  std::array<Shard, SHARDS> shards;
+};
+
+/**
+ * @brief One scanner thread's queue: the owner works LIFO (depth first,
+ * cache friendly), thieves take the oldest entry from the other end.
+ */
+class WorkQueue {
+public:
+  void push(fs::path path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    paths.push_back(std::move(path));
+  }
+
+  std::optional<fs::path> pop() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (paths.empty()) {
+      return std::nullopt;
+    }
+    auto path = std::move(paths.back());
+    paths.pop_back();
+    return path;
+  }
+
+  std::optional<fs::path> steal() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (paths.empty()) {
+      return std::nullopt;
+    }
+    auto path = std::move(paths.front());
+    paths.pop_front();
+    return path;
+  }
+
+private:
+  std::mutex mutex;
+  std::deque<fs::path> paths;
+};
+
+/**
+ * @brief Counts the tasks pushed to a pool's WorkQueues and not yet
+ * finished, so a worker that finds every queue empty sleeps until a task
+ * is pushed or the last one finishes instead of spinning.
+ */
+class WorkTracker {
+public:
+  void push(WorkQueue &queue, fs::path path) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      ++outstanding;
+      ++pushes;
+      queue.push(std::move(path));
+    }
+    wake.notify_one();
+  }
+
+  void finished() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--outstanding == 0) {
+      wake.notify_all();
+    }
+  }
+
+  // * Read before looking through the queues, then passed to waitForWork(),
+  // * so a push in between isn't slept through.
+  size_t pushCount() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return pushes;
+  }
+
+  // * False once every task is finished.
+  bool waitForWork(size_t seenPushes) {
+    std::unique_lock<std::mutex> lock(mutex);
+    wake.wait(lock, [&] { return pushes != seenPushes || outstanding == 0; });
+    return outstanding != 0;
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable wake;
+  size_t outstanding = 0;
+  size_t pushes = 0;
+};
+
+// * Layout of the records getdents64 returns (glibc has no declaration for
+// * the raw syscall).
+struct LinuxDirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+constexpr size_t DIRENT_BUFFER_SIZE = 64 * 1024;
+
+bool isSourceName(std::string_view name) {
+  return (name.size() > 4 && name.substr(name.size() - 4) == ".cpp") ||
+         isModuleInterfaceName(name);
+}
+
+/**
+ * @brief Lists an open directory with getdents64. Entries are classified by
+ * d_type, so only symlinks and filesystems that don't report types cost a
+ * stat. Symlinked directories aren't followed; symlinked sources are kept.
+ */
+DirectoryCacheEntry readDirectory(int fd, const fs::path &directory) {
+  thread_local std::vector<char> buffer(DIRENT_BUFFER_SIZE);
+  DirectoryCacheEntry entry;
+  while (true) {
+    const long read =
+        syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+    if (read <= 0) {
+      break;
+    }
+    for (long offset = 0; offset < read;) {
+      const auto *dirent =
+          reinterpret_cast<const LinuxDirent64 *>(buffer.data() + offset);
+      offset += dirent->d_reclen;
+      const std::string_view name = dirent->d_name;
+      if (name == "." || name == "..") {
+        continue;
+      }
+
+      unsigned char type = dirent->d_type;
+      struct stat info;
+      if (type == DT_UNKNOWN) {
+        if (fstatat(fd, dirent->d_name, &info, AT_SYMLINK_NOFOLLOW) != 0) {
+          continue;
+        }
+        type = S_ISDIR(info.st_mode)   ? DT_DIR
+               : S_ISLNK(info.st_mode) ? DT_LNK
+               : S_ISREG(info.st_mode) ? DT_REG
+                                       : DT_UNKNOWN;
+      }
+      if (type == DT_DIR) {
+        entry.subdirectories.push_back(directory / name);
+      } else if (isSourceName(name) &&
+                 (type == DT_REG ||
+                  (type == DT_LNK &&
+                   fstatat(fd, dirent->d_name, &info, 0) == 0 &&
+                   S_ISREG(info.st_mode)))) {
+        entry.sources.push_back(directory / name);
+      }
+    }
+  }
+  std::sort(entry.sources.begin(), entry.sources.end());
+  std::sort(entry.subdirectories.begin(), entry.subdirectories.end());
+  return entry;
+}
+
+/**
+ * @brief Brings the cached listing of a directory up to date: it's re-read
+ * only when its mtime changed (entries were added, removed or renamed).
+ * Returns its subdirectories, or nothing if it can't be opened.
+ */
+std::vector<fs::path> refreshDirectory(const fs::path &directory) {
+  const int fd =
+      open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  struct stat info;
+  if (fd < 0 || fstat(fd, &info) != 0) {
+    if (fd >= 0)
+      close(fd);
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    directoryCache.erase(directory);
+    return {};
+  }
+  FileStamp stamp;
+  stamp.mtimeNs = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 +
+                  info.st_mtim.tv_nsec;
+  stamp.size = info.st_size;
+
+  {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    const auto cached = directoryCache.find(directory);
+    if (cached != directoryCache.end() &&
+        cached->second.stamp.mtimeNs == stamp.mtimeNs) {
+      close(fd);
+      return cached->second.subdirectories;
+    }
+  }
+  auto entry = readDirectory(fd, directory);
+  close(fd);
+  entry.stamp = stamp;
+  entry.dirty = true;
+  auto subdirectories = entry.subdirectories;
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  directoryCache.insert_or_assign(directory, std::move(entry));
+  return subdirectories;
+}
+
+/**
+ * @brief Appends the cached sources of a directory tree, depth first in
+ * sorted order. Expects cacheMutex to be held.
+ */
+void collectSources(const fs::path &directory, std::vector<fs::path> &out) {
+  const auto cached = directoryCache.find(directory);
+  if (cached == directoryCache.end()) {
+    return;
+  }
+  out.insert(out.end(), cached->second.sources.begin(),
+             cached->second.sources.end());
+  for (const auto &subdirectory : cached->second.subdirectories) {
+    collectSources(subdirectory, out);
+  }
+}
+
+/**
+ * @brief The directives of a file, minimized once per content.
+ */
+std::shared_ptr<const MinimizedSource> minimizedSource(const fs::path &file) {
+  const auto stamp = statFile(file);
+  if (!stamp) {
+    throw std::runtime_error("Unable to open file: " + file.string());
+  }
+  {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    const auto cached = directiveCache.find(file);
+    if (cached != directiveCache.end() && cached->second.stamp == stamp) {
+      return cached->second.source;
+    }
+  }
+
+  const SourceText text(file);
+  const uint64_t hash = hashBytes(text.view().data(), text.view().size());
+  std::shared_ptr<const MinimizedSource> source;
+  {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    const auto known = minimizedByHash.find(hash);
+    if (known != minimizedByHash.end()) {
+      source = known->second;
+    }
+  }
+  if (!source) {
+    source = std::make_shared<const MinimizedSource>(
+        minimizeSource(text.view()));
+  }
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  minimizedByHash.emplace(hash, source);
+  directiveCache[file] = DirectiveCacheEntry{stamp.value(), source, hash, true};
+  return source;
+}
+
+/**
+ * @brief The files reached by the walks of one addToIncludeGraph() call:
+ * each is loaded, and each of its includes resolved, once however many
+ * units reach it. Files are numbered as they're first reached.
+ */
+class UnitScanContext {
+public:
+  struct File {
+    explicit File(fs::path path) : path(std::move(path)) {}
+
+    fs::path path;
+    std::once_flag loaded;
+    std::shared_ptr<const MinimizedSource> source; // * Null if unreadable
+    std::string error;
+    // * Per directive: what a plain #include "x" / <x> names, and the file
+    // * it resolves to.
+    std::vector<std::optional<IncludeTarget>> targets;
+    std::vector<std::optional<size_t>> targetIds;
+  };
+
+  UnitScanContext(const std::vector<fs::path> &searchDirs,
+                  const std::vector<fs::path> &systemDirs)
+      : searchDirs(searchDirs), systemDirs(systemDirs) {}
+
+  size_t fileId(const fs::path &path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto [known, inserted] = ids.emplace(path.native(), files.size());
+    if (inserted) {
+      files.emplace_back(path);
+    }
+    return known->second;
+  }
+
+  // * Files live in a deque, so the reference stays valid.
+  const File &file(size_t id) {
+    File *file;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      file = &files[id];
+    }
+    std::call_once(file->loaded, [&] { load(*file); });
+    return *file;
+  }
+
+  const fs::path &path(size_t id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return files[id].path;
+  }
+
+  /**
+   * @brief The file an include names: quoted ones are looked up like
+   * resolveInclude(), angled ones along the search directories only.
+   */
+  std::optional<size_t> resolve(const fs::path &including,
+                                const IncludeTarget &target) {
+    const std::string key =
+        target.angled ? '<' + target.name
+                      : including.parent_path().native() + '"' + target.name;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      const auto known = resolved.find(key);
+      if (known != resolved.end()) {
+        return known->second;
+      }
+    }
+    std::optional<size_t> id;
+    if (const auto path = target.angled
+                              ? resolveAngled(target.name)
+                              : resolveInclude(target.name, including,
+                                               searchDirs)) {
+      id = fileId(path.value());
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    resolved.emplace(key, id);
+    return id;
+  }
+
+  /**
+   * @brief Whether __has_include(<name>) holds: the project or one of the
+   * compiler's directories has it (assumed when those aren't known).
+   */
+  bool hasAngled(const fs::path &including, const IncludeTarget &target) {
+    if (systemDirs.empty() || resolve(including, target)) {
+      return true;
+    }
+    const std::string key = '>' + target.name;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      const auto known = systemHeaders.find(key);
+      if (known != systemHeaders.end()) {
+        return known->second;
+      }
+    }
+    std::vector<fs::path> candidates;
+    for (const auto &dir : systemDirs) {
+      candidates.push_back(dir / target.name);
+    }
+    const auto exist = regularFilesExist(candidates);
+    const bool found =
+        std::find(exist.begin(), exist.end(), true) != exist.end();
+    std::lock_guard<std::mutex> lock(mutex);
+    systemHeaders.emplace(key, found);
+    return found;
+  }
+
+private:
+  const std::vector<fs::path> &searchDirs;
+  const std::vector<fs::path> &systemDirs;
+  std::mutex mutex;
+  std::unordered_map<std::string, bool> systemHeaders;
+  std::deque<File> files;
+  std::unordered_map<std::string, size_t> ids;
+  std::unordered_map<std::string, std::optional<size_t>> resolved;
+
+  std::optional<fs::path> resolveAngled(const std::string &name) {
+    std::vector<fs::path> candidates;
+    for (const auto &dir : searchDirs) {
+      candidates.push_back(dir / name);
+    }
+    const auto exist = regularFilesExist(candidates);
+    for (size_t i = 0; i < candidates.size(); ++i) {
+      if (exist[i]) {
+        return normalizePath(candidates[i]);
+      }
+    }
+    return std::nullopt;
+  }
+
+  void load(File &file) {
+    try {
+      file.source = minimizedSource(file.path);
+    } catch (const std::exception &e) {
+      file.error = e.what();
+      return;
+    }
+    // * Plain includes are resolved up front, the quoted ones of the file
+    // * as one batch (see resolveIncludes).
+    const auto &directives = file.source->directives;
+    file.targets.resize(directives.size());
+    file.targetIds.resize(directives.size());
+    const MacroTable noMacros;
+    std::vector<size_t> quoted;
+    std::vector<std::string> quotedNames;
+    for (size_t i = 0; i < directives.size(); ++i) {
+      const auto &text = directives[i].text;
+      if (directives[i].kind != DirectiveKind::INCLUDE || text.empty() ||
+          (text.front() != '"' && text.front() != '<')) {
+        continue;
+      }
+      file.targets[i] = noMacros.includeTarget(text);
+      if (!file.targets[i]) {
+        continue;
+      }
+      if (file.targets[i]->angled) {
+        file.targetIds[i] = resolve(file.path, file.targets[i].value());
+      } else {
+        quoted.push_back(i);
+        quotedNames.push_back(file.targets[i]->name);
+      }
+    }
+    const auto paths = resolveIncludes(quotedNames, file.path, searchDirs);
+    for (size_t q = 0; q < quoted.size(); ++q) {
+      if (paths[q]) {
+        file.targetIds[quoted[q]] = fileId(paths[q].value());
+      }
+    }
+  }
+};
+
+/**
+ * @brief Loads (minimizes and resolves the plain includes of) every file
+ * the units can reach, following each include whatever the conditionals
+ * around it say, on a pool shaped like addToIncludeGraph()'s. The walks
+ * then only evaluate macros, so a single unit isn't read file by file.
+ */
+void preloadFiles(UnitScanContext &context, const std::vector<fs::path> &units,
+                  size_t threads) {
+  const size_t workerCount = std::max<size_t>(1, threads);
+  std::vector<WorkQueue> queues(workerCount);
+  WorkTracker tracker;
+  VisitedSet visited;
+  size_t nextQueue = 0;
+  for (const auto &unit : units) {
+    if (visited.insert(unit)) {
+      tracker.push(queues[nextQueue++ % workerCount], unit);
+    }
+  }
+
+  auto worker = [&](size_t id) {
+    while (true) {
+      const size_t seenPushes = tracker.pushCount();
+      auto task = queues[id].pop();
+      for (size_t i = 1; !task && i < workerCount; ++i) {
+        task = queues[(id + i) % workerCount].steal();
+      }
+      if (!task) {
+        if (!tracker.waitForWork(seenPushes)) {
+          return;
+        }
+        continue;
+      }
+
+      const auto &file = context.file(context.fileId(task.value()));
+      for (const auto &target : file.targetIds) {
+        if (target && visited.insert(context.path(target.value()))) {
+          tracker.push(queues[id], context.path(target.value()));
+        }
+      }
+      tracker.finished();
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < workerCount; ++i) {
+    workers.emplace_back(worker, i);
+  }
+  worker(0);
+  for (auto &thread : workers) {
+    thread.join();
+  }
+}
+
+/**
+ * @brief What one translation unit includes once its conditionals are
+ * evaluated. Files are listed in the order they're first reached.
+ */
+struct UnitScan {
+  std::optional<ModuleInfo> module;
+  std::vector<size_t> files;
+  std::vector<size_t> errors;
+  std::unordered_map<size_t, std::vector<size_t>> edges;
+  std::unordered_map<size_t, std::vector<std::string>> unresolved;
+};
+
+/**
+ * @brief Preprocesses a translation unit at the directive level, starting
+ * from the predefined macros. Quoted includes are followed and recorded;
+ * angled ones are followed only when they resolve in the project, for the
+ * macros they define.
+ */
+class UnitWalker {
+public:
+  UnitWalker(const MacroTable &predefined, UnitScanContext &context)
+      : macros(predefined), context(context) {}
+
+  UnitScan walk(size_t unit) {
+    visit(unit, true, 0);
+    return std::move(scan);
+  }
+
+private:
+  struct Conditional {
+    bool parentActive; // * The enclosing block is being included
+    bool taken;        // * Some branch so far was certainly the one taken
+    bool active;       // * The current branch is included
+  };
+
+  MacroTable macros;
+  UnitScanContext &context;
+  std::unordered_set<size_t> onceFiles;
+  UnitScan scan;
+
+  void visit(size_t id, bool recorded, size_t depth) {
+    if (depth > MAX_INCLUDE_DEPTH || onceFiles.count(id)) {
+      return;
+    }
+    const auto &file = context.file(id);
+    if (!file.source) {
+      if (recorded) {
+        scan.errors.push_back(id);
+      }
+      return;
+    }
+    const MinimizedSource &source = *file.source;
+    if (!source.guard.empty() && macros.isDefined(source.guard)) {
+      return;
+    }
+    if (recorded && scan.edges.emplace(id, std::vector<size_t>{}).second) {
+      scan.files.push_back(id);
+    }
+
+    const HasIncludeFn hasInclude = [&](const IncludeTarget &target) {
+      return target.angled ? context.hasAngled(file.path, target)
+                           : context.resolve(file.path, target).has_value();
+    };
+    std::vector<Conditional> conditionals;
+    bool active = true;
+    for (size_t index = 0; index < source.directives.size(); ++index) {
+      const auto &directive = source.directives[index];
+      switch (directive.kind) {
+      case DirectiveKind::IF:
+      case DirectiveKind::IFDEF:
+      case DirectiveKind::IFNDEF: {
+        const auto value = condition(directive, hasInclude);
+        conditionals.push_back(
+            {active, active && value == true, active && value != false});
+        active = conditionals.back().active;
+        continue;
+      }
+      case DirectiveKind::ELIF:
+      case DirectiveKind::ELIFDEF:
+      case DirectiveKind::ELIFNDEF:
+      case DirectiveKind::ELSE: {
+        if (conditionals.empty()) {
+          continue;
+        }
+        auto &block = conditionals.back();
+        const auto value = directive.kind == DirectiveKind::ELSE
+                               ? std::optional<bool>(true)
+                               : condition(directive, hasInclude);
+        block.active = block.parentActive && !block.taken && value != false;
+        block.taken = block.taken || (block.active && value == true);
+        active = block.active;
+        continue;
+      }
+      case DirectiveKind::ENDIF:
+        if (!conditionals.empty()) {
+          active = conditionals.back().parentActive;
+          conditionals.pop_back();
+        }
+        continue;
+      default:
+        break;
+      }
+      if (!active) {
+        continue;
+      }
+
+      switch (directive.kind) {
+      case DirectiveKind::DEFINE:
+        macros.define(directive.text);
+        break;
+      case DirectiveKind::UNDEF:
+        macros.undefine(directive.text);
+        break;
+      case DirectiveKind::PRAGMA_ONCE:
+        onceFiles.insert(id);
+        break;
+      case DirectiveKind::MODULE:
+      case DirectiveKind::EXPORT_MODULE:
+        if (depth == 0) {
+          auto &module = unitModule();
+          module.name = directive.text;
+          module.interface = directive.kind == DirectiveKind::EXPORT_MODULE;
+        }
+        break;
+      case DirectiveKind::IMPORT: {
+        auto &module = unitModule();
+        std::string name = directive.text;
+        if (name.front() == ':') {
+          name.insert(0, module.name.substr(0, module.name.find(':')));
+        }
+        if (std::find(module.imports.begin(), module.imports.end(), name) ==
+            module.imports.end()) {
+          module.imports.push_back(std::move(name));
+        }
+        break;
+      }
+      case DirectiveKind::INCLUDE:
+        if (const auto &target = file.targets[index]) {
+          include(id, target.value(), file.targetIds[index], recorded, depth);
+        } else if (const auto expanded =
+                       macros.includeTarget(directive.text)) {
+          include(id, expanded.value(),
+                  context.resolve(file.path, expanded.value()), recorded,
+                  depth);
+        }
+        break;
+      default:
+        break; // * #include_next only reaches system headers in practice
+      }
+    }
+  }
+
+  ModuleInfo &unitModule() {
+    if (!scan.module) {
+      scan.module.emplace();
+    }
+    return scan.module.value();
+  }
+
+  /**
+   * @brief The branch's condition, or nullopt when it can't be known here
+   * (e.g. __has_builtin). When in doubt the block is included, and so are
+   * the branches after it: a spurious edge only costs a pairing, a missing
+   * one a broken link.
+   */
+  std::optional<bool> condition(const Directive &directive,
+                                const HasIncludeFn &hasInclude) {
+    switch (directive.kind) {
+    case DirectiveKind::IFDEF:
+    case DirectiveKind::ELIFDEF:
+      return macros.isDefined(directive.text);
+    case DirectiveKind::IFNDEF:
+    case DirectiveKind::ELIFNDEF:
+      return !macros.isDefined(directive.text);
+    default:
+      return macros.evaluate(directive.text, hasInclude);
+    }
+  }
+
+  void include(size_t id, const IncludeTarget &target,
+               const std::optional<size_t> &resolved, bool recorded,
+               size_t depth) {
+    if (target.angled) {
+      if (resolved) {
+        visit(resolved.value(), false, depth + 1);
+      }
+      return;
+    }
+    if (recorded) {
+      if (resolved) {
+        auto &edges = scan.edges[id];
+        if (std::find(edges.begin(), edges.end(), resolved.value()) ==
+            edges.end()) {
+          edges.push_back(resolved.value());
+        }
+      } else {
+        auto &names = scan.unresolved[id];
+        if (std::find(names.begin(), names.end(), target.name) ==
+            names.end()) {
+          names.push_back(target.name);
+        }
+      }
+    }
+    if (resolved) {
+      visit(resolved.value(), recorded, depth + 1);
+    }
+  }
+};
+
+/**
+ * @brief addToIncludeGraph() once macros are set: the files the new units
+ * reach are loaded on the pool, then each unit is walked (the units in
+ * parallel), and the per-unit results are merged in file order.
+ */
+void addUnitsToIncludeGraph(IncludeGraph &graph,
+                            const std::vector<fs::path> &files,
+                            const std::vector<fs::path> &searchDirs,
+                            size_t threads, const MacroTable &predefined,
+                            const std::vector<fs::path> &systemDirs) {
+  std::vector<fs::path> units;
+  std::unordered_set<std::string> seen;
+  for (const auto &file : files) {
+    auto path = normalizePath(file);
+    if (!graph.edges.count(path) && !graph.errors.count(path) &&
+        seen.insert(path.native()).second) {
+      units.push_back(std::move(path));
+    }
+  }
+
+  UnitScanContext context(searchDirs, systemDirs);
+  preloadFiles(context, units, threads);
+  std::vector<UnitScan> scans(units.size());
+  std::atomic<size_t> next{0};
+  auto worker = [&]() {
+    for (size_t i = next++; i < units.size(); i = next++) {
+      scans[i] =
+          UnitWalker(predefined, context).walk(context.fileId(units[i]));
+    }
+  };
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < std::min(threads, units.size()); ++i) {
+    workers.emplace_back(worker);
+  }
+  worker();
+  for (auto &thread : workers) {
+    thread.join();
+  }
+
+  // * A header can include more under one unit's macros than another's;
+  // * the graph gets the union (merged by file number, then added).
+  std::vector<size_t> order;
+  std::unordered_map<size_t, std::vector<size_t>> edges;
+  std::unordered_map<size_t, std::vector<std::string>> unresolved;
+  auto unite = [](auto &into, const auto &from) {
+    for (const auto &item : from) {
+      if (std::find(into.begin(), into.end(), item) == into.end()) {
+        into.push_back(item);
+      }
+    }
+  };
+  for (size_t i = 0; i < units.size(); ++i) {
+    auto &module = scans[i].module;
+    if (!module) {
+      continue;
+    }
+    // * An implementation unit implicitly imports its interface.
+    if (!module->name.empty() && !module->importable()) {
+      module->imports.insert(module->imports.begin(), module->name);
+    }
+    graph.modules[units[i]] = std::move(module.value());
+  }
+  for (auto &scan : scans) {
+    for (const size_t id : scan.errors) {
+      const auto &file = context.file(id);
+      graph.errors.emplace(file.path, file.error);
+    }
+    for (const size_t id : scan.files) {
+      const auto [merged, inserted] = edges.try_emplace(id);
+      if (inserted) {
+        order.push_back(id);
+      }
+      unite(merged->second, scan.edges[id]);
+      const auto names = scan.unresolved.find(id);
+      if (names != scan.unresolved.end()) {
+        unite(unresolved[id], names->second);
+      }
+    }
+  }
+  for (const size_t id : order) {
+    std::vector<fs::path> paths;
+    for (const size_t header : edges[id]) {
+      paths.push_back(context.file(header).path);
+    }
+    const auto &path = context.file(id).path;
+    unite(graph.edges[path], paths);
+    const auto names = unresolved.find(id);
+    if (names != unresolved.end()) {
+      unite(graph.unresolved[path], names->second);
+    }
+  }
+}
+
+} // namespace
+
+void setScanPreambleOnly(bool preambleOnly) {
+  scanPreambleOnly = preambleOnly;
+}
+
+void setScanMacros(const std::vector<std::string> &defines,
+                   const std::vector<fs::path> &systemIncludeDirs) {
+  auto macros = std::make_shared<MacroTable>();
+  for (const auto &define : defines) {
+    macros->define(define);
+  }
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  scanMacros = std::move(macros);
+  scanSystemDirs = systemIncludeDirs;
+}
+
+fs::path normalizePath(const fs::path &path) {
+  return fs::absolute(path).lexically_normal();
+}
+
+/**
+ * @brief Returns the names of all quoted #include lines in a source text.
+ * The text is searched for '#' (vectorized); only lines where it's the first
+ * non-blank character are parsed. With preambleOnly the scan instead goes
+ * line by line and stops at the first line that isn't blank, a comment or a
+ * directive. Only the names found are copied out.
+ */
+std::vector<std::string> parseIncludes(std::string_view text,
+                                       bool preambleOnly) {
+  std::vector<std::string> includes;
+  const char *const begin = text.data();
+  const char *const end = begin + text.size();
+  auto match = [&](const char *lineStart, const char *lineEnd) {
+    if (const auto name = matchQuotedInclude(
+            std::string_view(lineStart, lineEnd - lineStart))) {
+      includes.emplace_back(name.value());
+    }
+  };
+
+  if (preambleOnly) {
+    bool inComment = false;
+    bool continued = false;
+    for (const char *line = begin; line < end;) {
+      const char *lineEnd = findByte(line, end, '\n');
+      const std::string_view view(line, lineEnd - line);
+      if (!continued && !isPreambleLine(view, inComment)) {
+        break;
+      }
+      match(line, lineEnd);
+      // * A backslash-continued directive spans the next line too.
+      const auto last = view.find_last_not_of("\r");
+      continued = last != std::string_view::npos && view[last] == '\\';
+      line = lineEnd == end ? end : lineEnd + 1;
+    }
+    return includes;
+  }
+
+  const char *cursor = begin;
+  while (cursor < end) {
+    const char *hash = findByte(cursor, end, '#');
+    if (hash == end) {
+      break;
+    }
+    const char *lineStart = hash;
+    while (lineStart > begin && isBlank(lineStart[-1])) {
+      --lineStart;
+    }
+    const char *lineEnd = findByte(hash, end, '\n');
+    if (lineStart == begin || lineStart[-1] == '\n') {
+      match(lineStart, lineEnd);
+    }
+    // * Nothing else on this line can start a directive.
+    cursor = lineEnd == end ? end : lineEnd + 1;
+  }
+  return includes;
+}
+
+/**
+ * @brief Returns the names of all quoted #include directives in a file.
+ */
+std::vector<std::string> scanIncludes(const fs::path &filePath) {
+  const auto stamp = statFile(filePath);
+  if (!stamp) {
+    throw std::runtime_error("Unable to open file: " + filePath.string());
+  }
+  const fs::path key = normalizePath(filePath);
+  {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    const auto cached = scanCache.find(key);
+    // * A full scan also answers preamble-only requests, not vice versa.
+    if (cached != scanCache.end() && cached->second.stamp == stamp.value() &&
+        (scanPreambleOnly || !cached->second.preambleOnly)) {
+      return cached->second.includes;
+    }
+  }
+
+  const bool preambleOnly = scanPreambleOnly;
+  auto includes = parseIncludes(SourceText(filePath).view(), preambleOnly);
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  scanCache[key] = ScanCacheEntry{stamp.value(), includes, true, preambleOnly};
+  return includes;
+}
+
+/**
+ * @brief Where quoted includes are looked up after the including file's own
+ * directory, in the compiler's order: -iquote, -I, -isystem and -idirafter
+ * directories from the flags, then (unlike the compiler) the project root.
+ */
+std::vector<fs::path> includeSearchDirs(const std::vector<std::string> &flags,
+                                        const fs::path &rootDir) {
+  const std::vector<std::string> options{"-iquote", "-I", "-isystem",
+                                         "-idirafter"};
+  std::vector<std::vector<fs::path>> dirsByOption(options.size());
+  for (size_t i = 0; i < flags.size(); ++i) {
+    for (size_t option = 0; option < options.size(); ++option) {
+      const auto &name = options[option];
+      if (flags[i].rfind(name, 0) != 0) {
+        continue;
+      }
+      if (flags[i].size() > name.size()) {
+        dirsByOption[option].push_back(flags[i].substr(name.size()));
+      } else if (i + 1 < flags.size()) {
+        dirsByOption[option].push_back(flags[++i]);
+      }
+      break;
+    }
+  }
+
+  std::vector<fs::path> searchDirs;
+  for (const auto &dirs : dirsByOption) {
+    for (const auto &dir : dirs) {
+      searchDirs.push_back(normalizePath(dir));
+    }
+  }
+  searchDirs.push_back(normalizePath(rootDir));
+  return searchDirs;
+}
+
+/**
+ * @brief Resolves quoted includes relative to the including file, then
+ * along the search directories. Lookups go in rounds, one batch of statx
+ * calls per search location, for the names still unresolved.
+ */
+std::vector<std::optional<fs::path>>
+resolveIncludes(const std::vector<std::string> &includeNames,
+                const fs::path &includingFile,
+                const std::vector<fs::path> &searchDirs) {
+  std::vector<std::optional<fs::path>> resolved(includeNames.size());
+  std::vector<size_t> unresolved(includeNames.size());
+  for (size_t i = 0; i < unresolved.size(); ++i) {
+    unresolved[i] = i;
+  }
+  for (size_t location = 0;
+       location <= searchDirs.size() && !unresolved.empty(); ++location) {
+    const auto &base = location == 0 ? includingFile.parent_path()
+                                     : searchDirs[location - 1];
+    std::vector<fs::path> candidates;
+    for (const size_t i : unresolved) {
+      candidates.push_back(base / includeNames[i]);
+    }
+    const auto exist = regularFilesExist(candidates);
+    std::vector<size_t> remaining;
+    for (size_t c = 0; c < candidates.size(); ++c) {
+      if (exist[c]) {
+        resolved[unresolved[c]] = normalizePath(candidates[c]);
+      } else {
+        remaining.push_back(unresolved[c]);
+      }
+    }
+    unresolved = std::move(remaining);
+  }
+  return resolved;
+}
+
+std::optional<fs::path> resolveInclude(const std::string &includeName,
+                                       const fs::path &includingFile,
+                                       const std::vector<fs::path> &searchDirs) {
+  return resolveIncludes({includeName}, includingFile, searchDirs).front();
+}
+
+/**
+ * @brief Finds the .cpp implementing a header with a few stat calls: next to
+ * the header, then in a sibling src/, source/ or lib/ directory of the
+ * header's directory or of the search directory it was found under (keeping
+ * its relative path, then by file name alone).
+ */
+std::optional<fs::path>
+findPairedSource(const fs::path &header,
+                 const std::vector<fs::path> &searchDirs) {
+  const auto sourceName = fs::path(header.filename()).replace_extension("cpp");
+  const auto besideHeader = header.parent_path() / sourceName;
+  if (fileExists(besideHeader)) {
+    return besideHeader;
+  }
+
+  std::vector<std::pair<fs::path, fs::path>> roots{
+      {header.parent_path().parent_path(), sourceName}};
+  for (const auto &dir : searchDirs) {
+    const auto relative = header.lexically_relative(dir);
+    if (!relative.empty() && *relative.begin() != "..") {
+      roots.emplace_back(dir.parent_path(),
+                         fs::path(relative).replace_extension("cpp"));
+    }
+  }
+  // * The other candidates are probed as one batch; the first in order wins.
+  std::vector<fs::path> candidates;
+  for (const auto &[root, relative] : roots) {
+    for (const char *sourceDir : {"src", "source", "lib"}) {
+      candidates.push_back(root / sourceDir / relative);
+      candidates.push_back(root / sourceDir / sourceName);
+    }
+  }
+  const auto exist = regularFilesExist(candidates);
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    if (exist[i]) {
+      return normalizePath(candidates[i]);
+    }
+  }
+  return std::nullopt;
+}
+
+/**
+ * @brief Adds the files and everything they transitively include to the
+ * graph, scanning on up to `threads` threads. Each thread works through its
+ * own queue of newly found headers and steals from the others when it runs
+ * dry. The graph is the same whatever the scheduling. Files that can't be
+ * read end up in graph.errors.
+ */
+void addToIncludeGraph(IncludeGraph &graph, const std::vector<fs::path> &files,
+                       const std::vector<fs::path> &searchDirs,
+                       size_t threads) {
+  std::shared_ptr<const MacroTable> macros;
+  std::vector<fs::path> systemDirs;
+  {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    macros = scanMacros;
+    systemDirs = scanSystemDirs;
+  }
+  if (macros && !scanPreambleOnly) {
+    addUnitsToIncludeGraph(graph, files, searchDirs, threads, *macros,
+                           systemDirs);
+    return;
+  }
+
+  VisitedSet visited;
+  for (const auto &[file, edges] : graph.edges) {
+    visited.insert(file);
+  }
+  for (const auto &file : graph.errors) {
+    visited.insert(file.first);
+  }
+
+  const size_t workerCount = std::max<size_t>(1, threads);
+  std::vector<WorkQueue> queues(workerCount);
+  WorkTracker tracker;
+  size_t nextQueue = 0;
+  for (const auto &file : files) {
+    const auto path = normalizePath(file);
+    if (visited.insert(path)) {
+      tracker.push(queues[nextQueue++ % workerCount], path);
+    }
+  }
+
+  std::vector<std::vector<ScanResult>> results(workerCount);
+  auto worker = [&](size_t id) {
+    while (true) {
+      const size_t seenPushes = tracker.pushCount();
+      auto task = queues[id].pop();
+      for (size_t i = 1; !task && i < workerCount; ++i) {
+        task = queues[(id + i) % workerCount].steal();
+      }
+      if (!task) {
+        if (!tracker.waitForWork(seenPushes)) {
+          return;
+        }
+        continue;
+      }
+
+      ScanResult result;
+      result.file = std::move(task.value());
+      try {
+        result.names = scanIncludes(result.file);
+      } catch (const std::exception &e) {
+        result.error = e.what();
+      }
+      const auto resolvedNames =
+          resolveIncludes(result.names, result.file, searchDirs);
+      for (size_t i = 0; i < result.names.size(); ++i) {
+        const auto &resolved = resolvedNames[i];
+        if (!resolved) {
+          result.unresolved.push_back(result.names[i]);
+          continue;
+        }
+        result.edges.push_back(resolved.value());
+        if (visited.insert(resolved.value())) {
+          tracker.push(queues[id], resolved.value());
+        }
+      }
+      results[id].push_back(std::move(result));
+      tracker.finished();
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < workerCount; ++i) {
+    workers.emplace_back(worker, i);
+  }
+  worker(0);
+  for (auto &thread : workers) {
+    thread.join();
+  }
+
+  // * std::map keys keep the merged graph sorted.
+  for (auto &workerResults : results) {
+    for (auto &result : workerResults) {
+      if (!result.error.empty()) {
+        graph.errors[result.file] = result.error;
+        continue;
+      }
+      graph.edges[result.file] = std::move(result.edges);
+      if (!result.unresolved.empty()) {
+        graph.unresolved[result.file] = std::move(result.unresolved);
+      }
+    }
+  }
+}
+
+/**
+ * @brief Adds a file and everything it transitively includes to the graph.
+ * Throws if the file itself can't be read.
+ */
+void addToIncludeGraph(IncludeGraph &graph, const fs::path &filePath,
+                       const std::vector<fs::path> &searchDirs) {
+  addToIncludeGraph(graph, std::vector<fs::path>{filePath}, searchDirs, 1);
+  const auto error = graph.errors.find(normalizePath(filePath));
+  if (error != graph.errors.end()) {
+    throw std::runtime_error(error->second);
+  }
+}
+
+/**
+ * @brief Extensions compilers use for module interface units.
+ */
+bool isModuleInterfaceName(std::string_view name) {
+  for (const std::string_view extension :
+       {".cppm", ".ixx", ".mpp", ".cxxm", ".c++m"}) {
+    if (name.size() > extension.size() &&
+        name.substr(name.size() - extension.size()) == extension) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief The module declaration of every project source that has one (its
+ * name and whether it's an interface; imports aren't read), taken from its
+ * directives.
+ */
+std::map<fs::path, ModuleInfo> listModuleUnits(const fs::path &rootDir,
+                                               size_t threads) {
+  const auto sources = listSourceFiles(rootDir, threads);
+  std::vector<std::optional<ModuleInfo>> declared(sources.size());
+  std::atomic<size_t> next{0};
+  auto worker = [&]() {
+    for (size_t i = next++; i < sources.size(); i = next++) {
+      try {
+        for (const auto &directive : minimizedSource(sources[i])->directives) {
+          if (directive.kind == DirectiveKind::MODULE ||
+              directive.kind == DirectiveKind::EXPORT_MODULE) {
+            declared[i] = ModuleInfo{
+                directive.text,
+                directive.kind == DirectiveKind::EXPORT_MODULE, {}};
+            break;
+          }
+        }
+      } catch (const std::exception &) {
+        // * Unreadable sources provide nothing
+      }
+    }
+  };
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < std::min(threads, sources.size()); ++i) {
+    workers.emplace_back(worker);
+  }
+  worker();
+  for (auto &thread : workers) {
+    thread.join();
+  }
+
+  std::map<fs::path, ModuleInfo> units;
+  for (size_t i = 0; i < sources.size(); ++i) {
+    if (declared[i]) {
+      units.emplace(normalizePath(sources[i]), std::move(declared[i].value()));
+    }
+  }
+  return units;
+}
+
+/**
+ * @brief All .cpp files and module interface units (.cppm, .ixx, ...)
+ * under rootDir (symlinked directories aren't followed, like
+ * std::filesystem::recursive_directory_iterator), in a stable order.
+ * Directories are listed concurrently on up to `threads` threads.
+ */
+std::vector<fs::path> listSourceFiles(const fs::path &rootDir,
+                                      size_t threads) {
+  const size_t workerCount = std::max<size_t>(1, threads);
+  std::vector<WorkQueue> queues(workerCount);
+  WorkTracker tracker;
+  tracker.push(queues[0], rootDir);
+
+  auto worker = [&](size_t id) {
+    while (true) {
+      const size_t seenPushes = tracker.pushCount();
+      auto task = queues[id].pop();
+      for (size_t i = 1; !task && i < workerCount; ++i) {
+        task = queues[(id + i) % workerCount].steal();
+      }
+      if (!task) {
+        if (!tracker.waitForWork(seenPushes)) {
+          return;
+        }
+        continue;
+      }
+      for (auto &subdirectory : refreshDirectory(task.value())) {
+        tracker.push(queues[id], std::move(subdirectory));
+      }
+      tracker.finished();
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < workerCount; ++i) {
+    workers.emplace_back(worker, i);
+  }
+  worker(0);
+  for (auto &thread : workers) {
+    thread.join();
+  }
+
+  std::vector<fs::path> sources;
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  collectSources(rootDir, sources);
+  return sources;
+}
+
+/**
+ * @brief Serializes the scan caches, one record per line: include scans as
+ * "S\tpath\tmtime\tsize\tinclude\tinclude..." and directive streams as
+ * "D\tpath\tmtime\tsize\thash\t<length>:<guard><count>:" followed by
+ * "<kind>:<length>:<text>" per directive (so their text may hold any byte),
+ * and directory listings as "R\tpath\tmtime\tsize\t<count>:" followed by
+ * "<length>:<path>" per source, then the same for its subdirectories.
+ */
+std::string exportScanCache(bool dirtyOnly) {
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  std::ostringstream out;
+  for (const auto &[path, entry] : scanCache) {
+    if ((dirtyOnly && !entry.dirty) || entry.preambleOnly) {
+      continue;
+    }
+    out << "S\t" << path.string() << '\t' << entry.stamp.mtimeNs << '\t'
+        << entry.stamp.size;
+    for (const auto &include : entry.includes) {
+      out << '\t' << include;
+    }
+    out << '\n';
+  }
+  for (const auto &[path, entry] : directiveCache) {
+    if (dirtyOnly && !entry.dirty) {
+      continue;
+    }
+    const MinimizedSource &source = *entry.source;
+    out << "D\t" << path.string() << '\t' << entry.stamp.mtimeNs << '\t'
+        << entry.stamp.size << '\t' << entry.hash << '\t'
+        << source.guard.size() << ':' << source.guard
+        << source.directives.size() << ':';
+    for (const auto &directive : source.directives) {
+      out << static_cast<int>(directive.kind) << ':' << directive.text.size()
+          << ':' << directive.text;
+    }
+    out << '\n';
+  }
+  const auto writePaths = [&](const std::vector<fs::path> &paths) {
+    out << paths.size() << ':';
+    for (const auto &path : paths) {
+      out << path.string().size() << ':' << path.string();
+    }
+  };
+  for (const auto &[path, entry] : directoryCache) {
+    if (dirtyOnly && !entry.dirty) {
+      continue;
+    }
+    out << "R\t" << path.string() << '\t' << entry.stamp.mtimeNs << '\t'
+        << entry.stamp.size << '\t';
+    writePaths(entry.sources);
+    writePaths(entry.subdirectories);
+    out << '\n';
+  }
+  return out.str();
+}
+
+namespace {
+
+/**
+ * @brief Reads the records exportScanCache() writes, field by field.
+ */
+class CacheRecordReader {
+public:
+  explicit CacheRecordReader(const std::string &text) : text(text) {}
+
+  bool done() const { return pos >= text.size(); }
+
+  // * The text up to the next `end` (consumed), if there is one.
+  std::optional<std::string> until(char end) {
+    const size_t found = text.find(end, pos);
+    if (found == std::string::npos) {
+      return std::nullopt;
+    }
+    std::string field = text.substr(pos, found - pos);
+    pos = found + 1;
+    return field;
+  }
+
+  std::optional<long long> number(char end) {
+    const auto field = until(end);
+    if (!field || field->empty() ||
+        field->find_first_not_of("0123456789", field->front() == '-') !=
+            std::string::npos) {
+      return std::nullopt;
+    }
+    try {
+      return std::stoll(field.value());
+    } catch (const std::exception &) {
+      return std::nullopt;
+    }
+  }
+
+  // * A "<length>:<bytes>" field.
+  std::optional<std::string> counted() {
+    const auto length = number(':');
+    if (!length || static_cast<size_t>(length.value()) > text.size() - pos) {
+      return std::nullopt;
+    }
+    std::string field = text.substr(pos, length.value());
+    pos += length.value();
+    return field;
+  }
+
+  // * Skips the rest of a malformed record.
+  void skipLine() {
+    if (!until('\n')) {
+      pos = text.size();
+    }
+  }
+
+private:
+  const std::string &text;
+  size_t pos = 0;
+};
+
+std::optional<std::pair<fs::path, DirectiveCacheEntry>>
+readDirectiveRecord(CacheRecordReader &reader) {
+  const auto path = reader.until('\t');
+  const auto mtime = reader.number('\t');
+  const auto size = reader.number('\t');
+  const auto hash = reader.until('\t');
+  auto guard = reader.counted();
+  const auto count = reader.number(':');
+  if (!path || !mtime || !size || !hash || !guard || !count) {
+    return std::nullopt;
+  }
+  MinimizedSource source;
+  source.guard = std::move(guard.value());
+  for (long long i = 0; i < count.value(); ++i) {
+    const auto kind = reader.number(':');
+    auto directiveText = reader.counted();
+    if (!kind || kind.value() < 0 ||
+        kind.value() > static_cast<int>(DirectiveKind::IMPORT) ||
+        !directiveText) {
+      return std::nullopt;
+    }
+    source.directives.push_back({static_cast<DirectiveKind>(kind.value()),
+                                 std::move(directiveText.value())});
+  }
+  if (!reader.until('\n')) {
+    return std::nullopt;
+  }
+
+  DirectiveCacheEntry entry;
+  entry.stamp.mtimeNs = mtime.value();
+  entry.stamp.size = size.value();
+  try {
+    entry.hash = std::stoull(hash.value());
+  } catch (const std::exception &) {
+    return std::nullopt;
+  }
+  entry.source = std::make_shared<const MinimizedSource>(std::move(source));
+  return std::make_pair(fs::path(path.value()), std::move(entry));
+}
+
+std::optional<std::vector<fs::path>> readPaths(CacheRecordReader &reader) {
+  const auto count = reader.number(':');
+  if (!count || count.value() < 0) {
+    return std::nullopt;
+  }
+  std::vector<fs::path> paths;
+  for (long long i = 0; i < count.value(); ++i) {
+    const auto path = reader.counted();
+    if (!path) {
+      return std::nullopt;
+    }
+    paths.emplace_back(path.value());
+  }
+  return paths;
+}
+
+std::optional<std::pair<fs::path, DirectoryCacheEntry>>
+readDirectoryRecord(CacheRecordReader &reader) {
+  const auto path = reader.until('\t');
+  const auto mtime = reader.number('\t');
+  const auto size = reader.number('\t');
+  if (!path || !mtime || !size) {
+    return std::nullopt;
+  }
+  auto sources = readPaths(reader);
+  auto subdirectories = sources ? readPaths(reader) : std::nullopt;
+  if (!subdirectories || !reader.until('\n')) {
+    return std::nullopt;
+  }
+  DirectoryCacheEntry entry;
+  entry.stamp.mtimeNs = mtime.value();
+  entry.stamp.size = size.value();
+  entry.sources = std::move(sources.value());
+  entry.subdirectories = std::move(subdirectories.value());
+  return std::make_pair(fs::path(path.value()), std::move(entry));
+}
+
+} // namespace
+
+void importScanCache(const std::string &serialized) {
+  CacheRecordReader reader(serialized);
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  while (!reader.done()) {
+    const auto tag = reader.until('\t');
+    if (tag == "D") {
+      if (auto record = readDirectiveRecord(reader)) {
+        auto &[path, entry] = record.value();
+        // * Share the stream with a file of the same contents, if any.
+        const auto known =
+            minimizedByHash.emplace(entry.hash, entry.source).first;
+        entry.source = known->second;
+        directiveCache[path] = std::move(entry);
+      } else {
+        reader.skipLine();
+      }
+      continue;
+    }
+    if (tag == "R") {
+      if (auto record = readDirectoryRecord(reader)) {
+        directoryCache[record->first] = std::move(record->second);
+      } else {
+        reader.skipLine();
+      }
+      continue;
+    }
+    const auto line = reader.until('\n');
+    if (tag != "S" || !line) {
+      reader.skipLine();
+      continue;
+    }
+    std::istringstream fields(line.value());
+    std::string path, mtime, size, include;
+    if (!std::getline(fields, path, '\t') ||
+        !std::getline(fields, mtime, '\t') ||
+        !std::getline(fields, size, '\t')) {
+      continue;
+    }
+    ScanCacheEntry entry;
+    try {
+      entry.stamp.mtimeNs = std::stoll(mtime);
+      entry.stamp.size = std::stoll(size);
+    } catch (const std::exception &) {
+      continue;
+    }
+    while (std::getline(fields, include, '\t')) {
+      entry.includes.push_back(include);
+    }
+    scanCache[path] = std::move(entry);
+  }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief A translation unit's C++20 module declarations: the module (or
+ * partition, "M:P") it belongs to, whether it's an interface unit, and the
+ * modules it imports (partitions qualified; header units as "<h>"/"\"h\"").
+ */
+struct ModuleInfo {
+  std::string name;
+  bool interface = false;
+  std::vector<std::string> imports;
+
+  // * Whether other units can import it (interfaces and partitions).
+  bool importable() const {
+    return interface || name.find(':') != std::string::npos;
+  }
+};
+
+/**
+ * @brief Quoted-include graph of a project. Includes that resolve to a file
+ * on disk become edges; the names of those that don't are kept in
+ * unresolved. Files that couldn't be read are listed in errors (with the
+ * reason).
+ */
+struct IncludeGraph {
+  std::map<std::filesystem::path, std::vector<std::filesystem::path>> edges;
+  std::map<std::filesystem::path, std::vector<std::string>> unresolved;
+  std::map<std::filesystem::path, std::string> errors;
+  // * Units that declare or import modules (directive-level scans only).
+  std::map<std::filesystem::path, ModuleInfo> modules;
+};
+
+std::filesystem::path normalizePath(const std::filesystem::path &);
+std::vector<std::string> parseIncludes(std::string_view,
+                                       bool preambleOnly = false);
+// * Makes scanIncludes() stop at each file's first line of code. Faster on
+// * big sources, but misses includes placed further down (e.g. .inl files).
+void setScanPreambleOnly(bool);
+// * Switches addToIncludeGraph() from scanning every #include line to
+// * preprocessing each file as a translation unit: conditionals are
+// * evaluated against these macros (#define bodies, e.g. "NDEBUG 1") and
+// * the ones the sources define, and macro includes are expanded. The
+// * compiler's <...> directories answer __has_include for system headers.
+// * Preamble-only scans stay lexical.
+void setScanMacros(const std::vector<std::string> &defines,
+                   const std::vector<std::filesystem::path> &systemIncludeDirs);
+std::vector<std::string> scanIncludes(const std::filesystem::path &);
+std::vector<std::filesystem::path>
+includeSearchDirs(const std::vector<std::string> &flags,
+                  const std::filesystem::path &rootDir);
+std::vector<std::optional<std::filesystem::path>>
+resolveIncludes(const std::vector<std::string> &,
+                const std::filesystem::path &,
+                const std::vector<std::filesystem::path> &searchDirs);
+std::optional<std::filesystem::path>
+resolveInclude(const std::string &, const std::filesystem::path &,
+               const std::vector<std::filesystem::path> &searchDirs);
+std::optional<std::filesystem::path>
+findPairedSource(const std::filesystem::path &header,
+                 const std::vector<std::filesystem::path> &searchDirs);
+void addToIncludeGraph(IncludeGraph &,
+                       const std::vector<std::filesystem::path> &,
+                       const std::vector<std::filesystem::path> &searchDirs,
+                       size_t threads);
+void addToIncludeGraph(IncludeGraph &, const std::filesystem::path &,
+                       const std::vector<std::filesystem::path> &searchDirs);
+std::vector<std::filesystem::path>
+listSourceFiles(const std::filesystem::path &, size_t threads);
+bool isModuleInterfaceName(std::string_view fileName);
+std::map<std::filesystem::path, ModuleInfo>
+listModuleUnits(const std::filesystem::path &rootDir, size_t threads);
+
+// * Include scans and minimized directive streams are cached per file (keyed
+// * by its stat stamp) for the life of the process; a long-lived daemon can
+// * ship new entries between processes with these.
+std::string exportScanCache(bool dirtyOnly);
+void importScanCache(const std::string &);
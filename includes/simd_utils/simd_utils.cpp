@@ -0,0 +1,274 @@
+#include "./simd_utils.hpp"
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CCOMP_X86_SIMD 1
+#endif
+
+namespace {
+
+using FindByteFn = const char *(*)(const char *, const char *, char);
+// * Folds `stripes` 64-byte stripes into the accumulators, the n-th one
+// * keyed with the secret at 8 * n bytes.
+using AccumulateFn = void (*)(uint64_t *, const char *, const uint8_t *,
+                              size_t stripes);
+using ScrambleFn = void (*)(uint64_t *, const uint8_t *);
+
+constexpr size_t STRIPE_SIZE = 64;
+constexpr size_t LANES = 8;
+constexpr size_t SECRET_SIZE = 192;
+constexpr size_t STRIPES_PER_BLOCK = (SECRET_SIZE - STRIPE_SIZE) / 8;
+constexpr uint64_t PRIME32_1 = 0x9E3779B1u;
+constexpr uint64_t PRIME64_1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t PRIME64_3 = 0x165667B19E3779F9ull;
+
+/**
+ * @brief Key material of the hash, expanded from a fixed seed.
+ */
+const std::array<uint8_t, SECRET_SIZE> &secret() {
+  static const auto bytes = [] {
+    std::array<uint8_t, SECRET_SIZE> expanded{};
+    uint64_t state = PRIME64_3;
+    for (size_t i = 0; i < SECRET_SIZE; i += 8) {
+      // * splitmix64
+      uint64_t word = (state += 0x9E3779B97F4A7C15ull);
+      word = (word ^ (word >> 30)) * 0xBF58476D1CE4E5B9ull;
+      word = (word ^ (word >> 27)) * 0x94D049BB133111EBull;
+      word ^= word >> 31;
+      std::memcpy(expanded.data() + i, &word, 8);
+    }
+    return expanded;
+  }();
+  return bytes;
+}
+
+uint64_t load64(const void *data) {
+  uint64_t value;
+  std::memcpy(&value, data, 8);
+  return value;
+}
+
+void accumulatePortable(uint64_t *acc, const char *data, const uint8_t *key,
+                        size_t stripes) {
+  for (size_t n = 0; n < stripes; ++n) {
+    const char *stripe = data + n * STRIPE_SIZE;
+    const uint8_t *stripeKey = key + n * 8;
+    for (size_t lane = 0; lane < LANES; ++lane) {
+      const uint64_t value = load64(stripe + lane * 8);
+      const uint64_t keyed = value ^ load64(stripeKey + lane * 8);
+      acc[lane ^ 1] += value;
+      acc[lane] += (keyed & 0xFFFFFFFFu) * (keyed >> 32);
+    }
+  }
+}
+
+void scramblePortable(uint64_t *acc, const uint8_t *key) {
+  for (size_t lane = 0; lane < LANES; ++lane) {
+    uint64_t value = acc[lane];
+    value ^= value >> 47;
+    value ^= load64(key + lane * 8);
+    acc[lane] = value * PRIME32_1;
+  }
+}
+
+const char *findBytePortable(const char *begin, const char *end, char byte) {
+  const void *found = std::memchr(begin, byte, end - begin);
+  return found ? static_cast<const char *>(found) : end;
+}
+
+#ifdef CCOMP_X86_SIMD
+
+__attribute__((target("sse2"))) const char *
+findByteSse2(const char *begin, const char *end, char byte) {
+  const __m128i needle = _mm_set1_epi8(byte);
+  for (; end - begin >= 16; begin += 16) {
+    const __m128i chunk =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+    const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+    if (mask != 0) {
+      return begin + __builtin_ctz(static_cast<unsigned>(mask));
+    }
+  }
+  for (; begin < end; ++begin) {
+    if (*begin == byte)
+      return begin;
+  }
+  return end;
+}
+
+__attribute__((target("avx2"))) const char *
+findByteAvx2(const char *begin, const char *end, char byte) {
+  const __m256i needle = _mm256_set1_epi8(byte);
+  for (; end - begin >= 32; begin += 32) {
+    const __m256i chunk =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin));
+    const int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+    if (mask != 0) {
+      return begin + __builtin_ctz(static_cast<unsigned>(mask));
+    }
+  }
+  // * The 0-31 byte tail goes through the 16-byte path.
+  return findByteSse2(begin, end, byte);
+}
+
+__attribute__((target("sse2"))) void
+accumulateSse2(uint64_t *acc, const char *data, const uint8_t *key,
+               size_t stripes) {
+  auto *lanes = reinterpret_cast<__m128i *>(acc);
+  for (size_t n = 0; n < stripes; ++n) {
+    const char *stripe = data + n * STRIPE_SIZE;
+    const uint8_t *stripeKey = key + n * 8;
+    for (size_t i = 0; i < 4; ++i) {
+      const __m128i value = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(stripe + i * 16));
+      const __m128i keyed = _mm_xor_si128(
+          value, _mm_loadu_si128(
+                     reinterpret_cast<const __m128i *>(stripeKey + i * 16)));
+      const __m128i product =
+          _mm_mul_epu32(keyed, _mm_srli_epi64(keyed, 32));
+      // * Swap the two 64-bit lanes: acc[lane ^ 1] += value.
+      const __m128i swapped = _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+      const __m128i sum = _mm_add_epi64(_mm_loadu_si128(lanes + i),
+                                        _mm_add_epi64(product, swapped));
+      _mm_storeu_si128(lanes + i, sum);
+    }
+  }
+}
+
+__attribute__((target("sse2"))) void scrambleSse2(uint64_t *acc,
+                                                  const uint8_t *key) {
+  auto *lanes = reinterpret_cast<__m128i *>(acc);
+  const __m128i prime = _mm_set1_epi32(static_cast<int>(PRIME32_1));
+  for (size_t i = 0; i < 4; ++i) {
+    __m128i value = _mm_loadu_si128(lanes + i);
+    value = _mm_xor_si128(value, _mm_srli_epi64(value, 47));
+    value = _mm_xor_si128(
+        value,
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(key + i * 16)));
+    // * 64x32-bit multiply from two 32x32 products.
+    const __m128i low = _mm_mul_epu32(value, prime);
+    const __m128i high = _mm_mul_epu32(_mm_srli_epi64(value, 32), prime);
+    _mm_storeu_si128(lanes + i,
+                     _mm_add_epi64(low, _mm_slli_epi64(high, 32)));
+  }
+}
+
+__attribute__((target("avx2"))) void
+accumulateAvx2(uint64_t *acc, const char *data, const uint8_t *key,
+               size_t stripes) {
+  auto *lanes = reinterpret_cast<__m256i *>(acc);
+  __m256i sums[2] = {_mm256_loadu_si256(lanes), _mm256_loadu_si256(lanes + 1)};
+  for (size_t n = 0; n < stripes; ++n) {
+    const char *stripe = data + n * STRIPE_SIZE;
+    const uint8_t *stripeKey = key + n * 8;
+    for (size_t i = 0; i < 2; ++i) {
+      const __m256i value = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(stripe + i * 32));
+      const __m256i keyed = _mm256_xor_si256(
+          value, _mm256_loadu_si256(
+                     reinterpret_cast<const __m256i *>(stripeKey + i * 32)));
+      const __m256i product =
+          _mm256_mul_epu32(keyed, _mm256_srli_epi64(keyed, 32));
+      const __m256i swapped =
+          _mm256_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+      sums[i] =
+          _mm256_add_epi64(sums[i], _mm256_add_epi64(product, swapped));
+    }
+  }
+  _mm256_storeu_si256(lanes, sums[0]);
+  _mm256_storeu_si256(lanes + 1, sums[1]);
+}
+
+__attribute__((target("avx2"))) void scrambleAvx2(uint64_t *acc,
+                                                  const uint8_t *key) {
+  auto *lanes = reinterpret_cast<__m256i *>(acc);
+  const __m256i prime = _mm256_set1_epi32(static_cast<int>(PRIME32_1));
+  for (size_t i = 0; i < 2; ++i) {
+    __m256i value = _mm256_loadu_si256(lanes + i);
+    value = _mm256_xor_si256(value, _mm256_srli_epi64(value, 47));
+    value = _mm256_xor_si256(
+        value, _mm256_loadu_si256(
+                   reinterpret_cast<const __m256i *>(key + i * 32)));
+    const __m256i low = _mm256_mul_epu32(value, prime);
+    const __m256i high = _mm256_mul_epu32(_mm256_srli_epi64(value, 32), prime);
+    _mm256_storeu_si256(lanes + i,
+                        _mm256_add_epi64(low, _mm256_slli_epi64(high, 32)));
+  }
+}
+
+#endif
+
+struct Implementation {
+  FindByteFn findByte;
+  AccumulateFn accumulate;
+  ScrambleFn scramble;
+  const char *name;
+};
+
+Implementation selectImplementation() {
+#ifdef CCOMP_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return {findByteAvx2, accumulateAvx2, scrambleAvx2, "avx2"};
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return {findByteSse2, accumulateSse2, scrambleSse2, "sse2"};
+  }
+#endif
+  return {findBytePortable, accumulatePortable, scramblePortable, "portable"};
+}
+
+const Implementation &implementation() {
+  static const Implementation selected = selectImplementation();
+  return selected;
+}
+
+} // namespace
+
+const char *findByte(const char *begin, const char *end, char byte) {
+  return implementation().findByte(begin, end, byte);
+}
+
+uint64_t hashBytes(const char *data, size_t size) {
+  const auto &impl = implementation();
+  const uint8_t *key = secret().data();
+  alignas(32) uint64_t acc[LANES] = {PRIME32_1, PRIME64_1, PRIME64_2,
+                                     PRIME64_3, PRIME64_1 ^ PRIME64_2,
+                                     PRIME64_2 ^ PRIME64_3, PRIME64_3 ^ PRIME32_1,
+                                     PRIME64_1 ^ PRIME32_1};
+
+  const size_t blockSize = STRIPES_PER_BLOCK * STRIPE_SIZE;
+  size_t offset = 0;
+  for (; size - offset > blockSize; offset += blockSize) {
+    impl.accumulate(acc, data + offset, key, STRIPES_PER_BLOCK);
+    impl.scramble(acc, key + SECRET_SIZE - STRIPE_SIZE);
+  }
+  const size_t fullStripes = (size - offset) / STRIPE_SIZE;
+  impl.accumulate(acc, data + offset, key, fullStripes);
+  offset += fullStripes * STRIPE_SIZE;
+  // * The last (partial) stripe is zero-padded, so every input, including
+  // * the empty one, feeds at least one stripe.
+  alignas(32) char last[STRIPE_SIZE] = {};
+  if (size > offset) {
+    std::memcpy(last, data + offset, size - offset);
+  }
+  impl.accumulate(acc, last, key + SECRET_SIZE - STRIPE_SIZE - 7, 1);
+
+  uint64_t result = static_cast<uint64_t>(size) * PRIME64_1;
+  for (size_t lane = 0; lane < LANES; lane += 2) {
+    const __uint128_t product =
+        static_cast<__uint128_t>(acc[lane] ^ load64(key + 11 + lane * 8)) *
+        (acc[lane + 1] ^ load64(key + 19 + lane * 8));
+    result += static_cast<uint64_t>(product) ^
+              static_cast<uint64_t>(product >> 64);
+  }
+  result ^= result >> 37;
+  result *= 0x165667919E3779F9ull;
+  return result ^ (result >> 32);
+}
+
+const char *simdLevel() { return implementation().name; }
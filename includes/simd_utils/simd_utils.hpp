@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Byte search used by the source scanners. Picks the widest vector
+ * unit the CPU has (AVX2, SSE2) at first use, with a portable fallback.
+ */
+const char *findByte(const char *begin, const char *end, char byte);
+
+/**
+ * @brief Fast non-cryptographic 64-bit hash, used to fingerprint file
+ * contents. Built like XXH3 (64-byte stripes folded into eight 64-bit
+ * accumulators), vectorized the same way as findByte; every implementation
+ * gives the same value.
+ */
+uint64_t hashBytes(const char *data, size_t size);
+
+/**
+ * @brief Name of the implementation findByte() and hashBytes() dispatch to.
+ */
+const char *simdLevel();
@@ -0,0 +1,287 @@
+#include "./socket_utils.hpp"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+const size_t MAX_MESSAGE_SIZE = 1u << 30;
+
+bool fillUnixAddress(const std::string &path, sockaddr_un &address) {
+  if (path.size() >= sizeof(address.sun_path)) {
+    return false;
+  }
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  return true;
+}
+
+bool writeAll(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    const ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += written;
+    size -= static_cast<size_t>(written);
+  }
+  return true;
+}
+
+bool readAll(int fd, char *data, size_t size) {
+  while (size > 0) {
+    const ssize_t count = recv(fd, data, size, 0);
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count <= 0)
+      return false;
+    data += count;
+    size -= static_cast<size_t>(count);
+  }
+  return true;
+}
+
+std::string lengthPrefix(size_t size) {
+  const uint32_t length = htonl(static_cast<uint32_t>(size));
+  return std::string(reinterpret_cast<const char *>(&length), sizeof(length));
+}
+
+std::optional<std::string> readBody(int fd, const char *prefix) {
+  uint32_t length;
+  std::memcpy(&length, prefix, sizeof(length));
+  length = ntohl(length);
+  if (length > MAX_MESSAGE_SIZE) {
+    return std::nullopt;
+  }
+  std::string payload(length, '\0');
+  if (!readAll(fd, payload.data(), payload.size())) {
+    return std::nullopt;
+  }
+  return payload;
+}
+
+addrinfo *resolve(const std::string &host, int port, bool passive) {
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = passive ? AI_PASSIVE : 0;
+  addrinfo *result = nullptr;
+  const std::string service = std::to_string(port);
+  if (getaddrinfo(host.empty() ? nullptr : host.c_str(), service.c_str(),
+                  &hints, &result) != 0) {
+    return nullptr;
+  }
+  return result;
+}
+
+} // namespace
+
+int listenUnix(const std::string &path) {
+  sockaddr_un address;
+  if (!fillUnixAddress(path, address)) {
+    return -1;
+  }
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+      listen(fd, 64) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int connectUnix(const std::string &path) {
+  sockaddr_un address;
+  if (!fillUnixAddress(path, address)) {
+    return -1;
+  }
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) !=
+      0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int listenTcp(const std::string &host, int port) {
+  addrinfo *addresses = resolve(host, port, true);
+  int fd = -1;
+  for (addrinfo *it = addresses; it && fd < 0; it = it->ai_next) {
+    fd = socket(it->ai_family, it->ai_socktype | SOCK_CLOEXEC, it->ai_protocol);
+    if (fd < 0)
+      continue;
+    const int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(fd, it->ai_addr, it->ai_addrlen) != 0 || listen(fd, 64) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  if (addresses)
+    freeaddrinfo(addresses);
+  return fd;
+}
+
+int connectTcp(const std::string &host, int port) {
+  addrinfo *addresses = resolve(host, port, false);
+  int fd = -1;
+  for (addrinfo *it = addresses; it && fd < 0; it = it->ai_next) {
+    fd = socket(it->ai_family, it->ai_socktype | SOCK_CLOEXEC, it->ai_protocol);
+    if (fd < 0)
+      continue;
+    if (connect(fd, it->ai_addr, it->ai_addrlen) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  if (addresses)
+    freeaddrinfo(addresses);
+  return fd;
+}
+
+int acceptConnection(int listenFd) {
+  int fd;
+  do {
+    fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+  } while (fd < 0 && errno == EINTR);
+  return fd;
+}
+
+std::optional<uid_t> peerUid(int fd) {
+  ucred credentials{};
+  socklen_t length = sizeof(credentials);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0) {
+    return std::nullopt;
+  }
+  return credentials.uid;
+}
+
+bool setReceiveTimeout(int fd, int milliseconds) {
+  timeval timeout{};
+  timeout.tv_sec = milliseconds / 1000;
+  timeout.tv_usec = (milliseconds % 1000) * 1000;
+  return setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) ==
+         0;
+}
+
+bool sendMessage(int fd, const std::string &payload) {
+  const std::string frame = lengthPrefix(payload.size()) + payload;
+  return writeAll(fd, frame.data(), frame.size());
+}
+
+std::optional<std::string> receiveMessage(int fd) {
+  char prefix[4];
+  if (!readAll(fd, prefix, sizeof(prefix))) {
+    return std::nullopt;
+  }
+  return readBody(fd, prefix);
+}
+
+bool sendMessageWithFds(int fd, const std::string &payload,
+                        const std::vector<int> &fds) {
+  std::string prefix = lengthPrefix(payload.size());
+  iovec io{prefix.data(), prefix.size()};
+  std::vector<char> control(CMSG_SPACE(sizeof(int) * fds.size()));
+
+  msghdr message{};
+  message.msg_iov = &io;
+  message.msg_iovlen = 1;
+  message.msg_control = control.data();
+  message.msg_controllen = control.size();
+  cmsghdr *header = CMSG_FIRSTHDR(&message);
+  header->cmsg_level = SOL_SOCKET;
+  header->cmsg_type = SCM_RIGHTS;
+  header->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+  std::memcpy(CMSG_DATA(header), fds.data(), sizeof(int) * fds.size());
+
+  ssize_t sent;
+  do {
+    sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+  } while (sent < 0 && errno == EINTR);
+  if (sent != static_cast<ssize_t>(prefix.size())) {
+    return false;
+  }
+  return writeAll(fd, payload.data(), payload.size());
+}
+
+std::optional<std::string> receiveMessageWithFds(int fd, std::vector<int> &fds,
+                                                 size_t maxFds) {
+  char prefix[4];
+  iovec io{prefix, sizeof(prefix)};
+  std::vector<char> control(CMSG_SPACE(sizeof(int) * maxFds));
+
+  msghdr message{};
+  message.msg_iov = &io;
+  message.msg_iovlen = 1;
+  message.msg_control = control.data();
+  message.msg_controllen = control.size();
+
+  ssize_t count;
+  do {
+    count = recvmsg(fd, &message, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+  } while (count < 0 && errno == EINTR);
+  if (count != static_cast<ssize_t>(sizeof(prefix))) {
+    return std::nullopt;
+  }
+
+  for (cmsghdr *header = CMSG_FIRSTHDR(&message); header;
+       header = CMSG_NXTHDR(&message, header)) {
+    if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+      const size_t received = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      const int *data = reinterpret_cast<const int *>(CMSG_DATA(header));
+      fds.insert(fds.end(), data, data + received);
+    }
+  }
+  return readBody(fd, prefix);
+}
+
+/**
+ * @brief Packs fields as "<length>:<bytes>" so they may contain any byte.
+ */
+std::string joinFields(const std::vector<std::string> &fields) {
+  std::string joined;
+  for (const auto &field : fields) {
+    joined += std::to_string(field.size());
+    joined += ':';
+    joined += field;
+  }
+  return joined;
+}
+
+std::vector<std::string> splitFields(const std::string &joined) {
+  std::vector<std::string> fields;
+  size_t pos = 0;
+  while (pos < joined.size()) {
+    const size_t colon = joined.find(':', pos);
+    if (colon == std::string::npos) {
+      break;
+    }
+    size_t length;
+    try {
+      length = std::stoul(joined.substr(pos, colon - pos));
+    } catch (const std::exception &) {
+      break;
+    }
+    if (length > joined.size() - colon - 1) {
+      break;
+    }
+    fields.push_back(joined.substr(colon + 1, length));
+    pos = colon + 1 + length;
+  }
+  return fields;
+}
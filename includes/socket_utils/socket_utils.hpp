@@ -0,0 +1,32 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+/**
+ * @brief Stream-socket helpers. Messages are framed with a 4-byte big-endian
+ * length prefix. All functions return -1/false/nullopt on failure.
+ */
+int listenUnix(const std::string &path);
+int connectUnix(const std::string &path);
+int listenTcp(const std::string &host, int port);
+int connectTcp(const std::string &host, int port);
+int acceptConnection(int listenFd);
+// * User id of the process at the other end of a Unix socket (SO_PEERCRED).
+std::optional<uid_t> peerUid(int fd);
+// * Makes reads on the socket fail after `milliseconds` without data.
+bool setReceiveTimeout(int fd, int milliseconds);
+
+bool sendMessage(int fd, const std::string &payload);
+std::optional<std::string> receiveMessage(int fd);
+
+// * Same framing, with file descriptors attached via SCM_RIGHTS.
+bool sendMessageWithFds(int fd, const std::string &payload,
+                        const std::vector<int> &fds);
+std::optional<std::string> receiveMessageWithFds(int fd, std::vector<int> &fds,
+                                                 size_t maxFds);
+
+std::string joinFields(const std::vector<std::string> &);
+std::vector<std::string> splitFields(const std::string &);
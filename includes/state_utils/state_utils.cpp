@@ -0,0 +1,240 @@
+#include "./state_utils.hpp"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+
+#include "../file_utils/file_utils.hpp"
+#include "../io_utils/io_utils.hpp"
+#include "../simd_utils/simd_utils.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const std::string TABLE_HEADER = "ccomp-file-state 1";
+// * Changed files read per batch (bounds the memory held at once).
+constexpr size_t READ_BATCH = 64;
+
+struct StateEntry {
+  FileState state;
+  bool checked = false; // * Verified against the file in this process
+};
+
+std::mutex stateMutex;
+std::unordered_map<std::string, StateEntry> states;
+bool statesDirty = false;
+
+int64_t toNs(const statx_timestamp &time) {
+  return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+std::optional<FileState> toFileState(const std::optional<struct statx> &info) {
+  if (!info || !S_ISREG(info->stx_mode)) {
+    return std::nullopt;
+  }
+  FileState state;
+  state.inode = info->stx_ino;
+  state.size = static_cast<int64_t>(info->stx_size);
+  state.mtimeNs = toNs(info->stx_mtime);
+  state.ctimeNs = toNs(info->stx_ctime);
+  return state;
+}
+
+std::optional<FileState> statxFile(const fs::path &path) {
+  struct statx info;
+  if (statx(AT_FDCWD, path.c_str(), AT_STATX_SYNC_AS_STAT,
+            STATX_INO | STATX_SIZE | STATX_MTIME | STATX_CTIME, &info) != 0) {
+    return std::nullopt;
+  }
+  return toFileState(info);
+}
+
+bool sameStat(const FileState &a, const FileState &b) {
+  return a.inode == b.inode && a.size == b.size && a.mtimeNs == b.mtimeNs &&
+         a.ctimeNs == b.ctimeNs;
+}
+
+std::optional<uint64_t> hashFile(const fs::path &path) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat info;
+  if (fd < 0 || fstat(fd, &info) != 0) {
+    if (fd >= 0)
+      close(fd);
+    return std::nullopt;
+  }
+  const size_t size = static_cast<size_t>(info.st_size);
+  if (size == 0) {
+    close(fd);
+    return hashBytes(nullptr, 0);
+  }
+  void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    return std::nullopt;
+  }
+  madvise(mapped, size, MADV_SEQUENTIAL);
+  const uint64_t hash = hashBytes(static_cast<const char *>(mapped), size);
+  munmap(mapped, size);
+  return hash;
+}
+
+} // namespace
+
+void loadFileStates(const fs::path &table) {
+  const auto tableStamp = statFile(table);
+  std::ifstream file(table);
+  std::string line;
+  if (!tableStamp || !std::getline(file, line) || line != TABLE_HEADER) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(stateMutex);
+  // * Lines of "hash\tinode\tsize\tmtime\tctime\tpath".
+  while (std::getline(file, line)) {
+    std::istringstream fields(line);
+    FileState state;
+    std::string path;
+    fields >> std::hex >> state.hash >> std::dec >> state.inode >>
+        state.size >> state.mtimeNs >> state.ctimeNs;
+    if (!fields || fields.get() != '\t' || !std::getline(fields, path) ||
+        path.empty()) {
+      continue;
+    }
+    if (state.mtimeNs >= tableStamp->mtimeNs) {
+      continue; // * Racily clean: may have changed since it was hashed
+    }
+    states.emplace(path, StateEntry{state, false});
+  }
+}
+
+void saveFileStates(const fs::path &table) {
+  std::lock_guard<std::mutex> lock(stateMutex);
+  if (!statesDirty) {
+    return;
+  }
+  const auto temporary = fs::path(table).concat(".tmp");
+  {
+    std::ofstream file(temporary, std::ios::trunc);
+    file << TABLE_HEADER << '\n';
+    for (const auto &[path, entry] : states) {
+      const auto &state = entry.state;
+      file << std::hex << state.hash << std::dec << '\t' << state.inode
+           << '\t' << state.size << '\t' << state.mtimeNs << '\t'
+           << state.ctimeNs << '\t' << path << '\n';
+    }
+    if (!file) {
+      return;
+    }
+  }
+  std::error_code ec;
+  fs::rename(temporary, table, ec);
+  if (!ec) {
+    statesDirty = false;
+  }
+}
+
+std::optional<FileState> fileState(const fs::path &path) {
+  const std::string key = path.lexically_normal().string();
+  {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    const auto known = states.find(key);
+    if (known != states.end() && known->second.checked) {
+      return known->second.state;
+    }
+  }
+
+  auto current = statxFile(path);
+  if (!current) {
+    return std::nullopt;
+  }
+  {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    auto known = states.find(key);
+    if (known != states.end() && sameStat(known->second.state, *current)) {
+      known->second.checked = true;
+      return known->second.state;
+    }
+  }
+
+  const auto hash = hashFile(path);
+  if (!hash) {
+    return std::nullopt;
+  }
+  current->hash = hash.value();
+  std::lock_guard<std::mutex> lock(stateMutex);
+  states[key] = StateEntry{current.value(), true};
+  statesDirty = true;
+  return current;
+}
+
+void refreshFileStates(const std::vector<fs::path> &paths, size_t threads) {
+  // * Each thread takes a share of the files: one batch of statx calls,
+  // * then batched reads of the ones that changed.
+  const size_t workerCount =
+      std::max<size_t>(1, std::min(threads, paths.size()));
+  auto worker = [&](size_t id) {
+    const size_t first = paths.size() * id / workerCount;
+    const size_t last = paths.size() * (id + 1) / workerCount;
+    const std::vector<fs::path> share(paths.begin() + first,
+                                      paths.begin() + last);
+    const auto infos = statxFiles(share);
+
+    std::vector<fs::path> changed;
+    std::vector<FileState> changedStates;
+    {
+      std::lock_guard<std::mutex> lock(stateMutex);
+      for (size_t i = 0; i < share.size(); ++i) {
+        const auto current = toFileState(infos[i]);
+        if (!current) {
+          continue;
+        }
+        auto known = states.find(share[i].lexically_normal().string());
+        if (known != states.end() &&
+            sameStat(known->second.state, current.value())) {
+          known->second.checked = true;
+        } else {
+          changed.push_back(share[i]);
+          changedStates.push_back(current.value());
+        }
+      }
+    }
+
+    for (size_t begin = 0; begin < changed.size(); begin += READ_BATCH) {
+      const size_t end = std::min(changed.size(), begin + READ_BATCH);
+      const auto contents = readFiles(std::vector<fs::path>(
+          changed.begin() + begin, changed.begin() + end));
+      std::vector<bool> hashed(end - begin);
+      for (size_t i = begin; i < end; ++i) {
+        if (const auto &content = contents[i - begin]) {
+          changedStates[i].hash = hashBytes(content->data(), content->size());
+          hashed[i - begin] = true;
+        }
+      }
+      std::lock_guard<std::mutex> lock(stateMutex);
+      for (size_t i = begin; i < end; ++i) {
+        if (hashed[i - begin]) {
+          states[changed[i].lexically_normal().string()] =
+              StateEntry{changedStates[i], true};
+          statesDirty = true;
+        }
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < workerCount; ++i) {
+    workers.emplace_back(worker, i);
+  }
+  worker(0);
+  for (auto &thread : workers) {
+    thread.join();
+  }
+}
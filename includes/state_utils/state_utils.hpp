@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+/**
+ * @brief What ccomp knows about a file: its stat tuple and the hash of its
+ * contents (see hashBytes), recomputed only when the tuple changes.
+ */
+struct FileState {
+  uint64_t inode = 0;
+  int64_t size = 0;
+  int64_t mtimeNs = 0;
+  int64_t ctimeNs = 0;
+  uint64_t hash = 0;
+};
+
+/**
+ * @brief The file-state table persists between runs, like git's index.
+ * Entries modified no earlier than the table itself was written are
+ * dropped on load, since they may have changed again within the same
+ * timestamp tick.
+ */
+void loadFileStates(const std::filesystem::path &table);
+void saveFileStates(const std::filesystem::path &table);
+
+/**
+ * @brief Current state of a file: one statx call, plus a hash of the file
+ * if its stat tuple differs from the table's. Each file is checked once
+ * per process. std::nullopt if the file can't be read.
+ */
+std::optional<FileState> fileState(const std::filesystem::path &);
+
+/**
+ * @brief Checks many files at once (on up to `threads` threads), so later
+ * fileState() calls for them are answered from memory.
+ */
+void refreshFileStates(const std::vector<std::filesystem::path> &,
+                       size_t threads);
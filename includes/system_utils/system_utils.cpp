@@ -1,6 +1,26 @@
 #include "./system_utils.hpp"
-#include <iostream>
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <pthread.h>
+#include <stdexcept>
+#include <string_view>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+extern char **environ;
 
 int safeSystemCall(const std::string &command) {
   std::array<char, 128> buffer;
@@ -19,4 +39,382 @@ int safeSystemCall(const std::string &command) {
   std::cout << result;
 
   return returnCode;
-}
\ No newline at end of file
+}
+
+namespace {
+
+/**
+ * @brief A per-run cgroup v2 leaf used to enforce and measure the memory
+ * limit. Falls back to setrlimit() when cgroup v2 isn't delegated to us.
+ */
+class MemoryCgroup {
+public:
+  explicit MemoryCgroup(size_t limitBytes) {
+    std::ifstream self("/proc/self/cgroup");
+    std::string own;
+    std::string line;
+    while (std::getline(self, line)) {
+      if (line.rfind("0::", 0) == 0) {
+        own = line.substr(3);
+      }
+    }
+    if (own.empty() || !std::ifstream("/sys/fs/cgroup/cgroup.controllers")) {
+      return;
+    }
+
+    // * A cgroup holding processes (ours holds ccomp) can't enable
+    // * controllers for children of its own, so the leaf is created next to
+    // * ours, in the cgroup that delegated it.
+    static std::atomic<int> counter{0};
+    path = "/sys/fs/cgroup" + own.substr(0, own.rfind('/')) + "/ccomp-" +
+           std::to_string(getpid()) + "-" + std::to_string(counter++);
+    if (mkdir(path.c_str(), 0755) != 0) {
+      path.clear();
+      return;
+    }
+    if (!writeFile("memory.max", std::to_string(limitBytes))) {
+      rmdir(path.c_str());
+      path.clear();
+      return;
+    }
+    writeFile("memory.swap.max", "0");
+  }
+
+  ~MemoryCgroup() {
+    if (!path.empty())
+      rmdir(path.c_str());
+  }
+
+  /**
+   * @brief Moves `pid` into the leaf; false when it can't be (e.g. no write
+   * access to the common ancestor), in which case nothing is measured.
+   */
+  bool adopt(pid_t pid) {
+    adopted = !path.empty() && writeFile("cgroup.procs", std::to_string(pid));
+    return adopted;
+  }
+
+  bool active() const { return adopted; }
+
+  long peakKb() const { return readValue("memory.peak", "") / 1024; }
+  bool oomKilled() const { return readValue("memory.events", "oom_kill") > 0; }
+
+private:
+  bool writeFile(const std::string &name, const std::string &value) const {
+    std::ofstream file(path + "/" + name);
+    return static_cast<bool>(file << value << std::flush);
+  }
+
+  long readValue(const std::string &name, const std::string &key) const {
+    std::ifstream file(path + "/" + name);
+    std::string token;
+    long value = 0;
+    while (file >> token) {
+      if (key.empty() || token == key) {
+        if (!key.empty())
+          file >> token;
+        try {
+          value = std::stol(token);
+        } catch (const std::exception &) {
+        }
+        break;
+      }
+    }
+    return value;
+  }
+
+  std::string path;
+  bool adopted = false;
+};
+
+/**
+ * @brief Makes `group` the foreground process group of the terminal on
+ * stdin. SIGTTOU is blocked meanwhile, since ccomp itself is in the
+ * background while handing the terminal back.
+ */
+void setForegroundGroup(pid_t group) {
+  sigset_t ttou;
+  sigset_t previous;
+  sigemptyset(&ttou);
+  sigaddset(&ttou, SIGTTOU);
+  pthread_sigmask(SIG_BLOCK, &ttou, &previous);
+  tcsetpgrp(STDIN_FILENO, group);
+  pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+}
+
+} // namespace
+
+/**
+ * @brief Runs argv[0] directly (no shell), optionally wiring stdin to a file
+ * and stdout to a callback, and reports its exit status and resource usage.
+ * A run with limits gets a process group of its own, which is killed as a
+ * whole when the timeout expires or the program exits; when it runs on
+ * ccomp's terminal, that group is the terminal's foreground group meanwhile.
+ */
+ProcessResult runProcess(const std::vector<std::string> &args,
+                         const ProcessOptions &options) {
+  if (args.empty()) {
+    throw std::invalid_argument("runProcess() called without a program");
+  }
+
+  int stdinFd = -1;
+  if (!options.stdinPath.empty()) {
+    stdinFd = open(options.stdinPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (stdinFd < 0) {
+      throw std::runtime_error("Unable to open file: " + options.stdinPath);
+    }
+  }
+
+  // * Unlimited runs (compilers, plain -r) stay in ccomp's group, so they
+  // * keep the terminal and receive Ctrl-C along with ccomp.
+  const bool ownGroup = options.timeoutSeconds > 0 ||
+                        options.cpuLimitSeconds > 0 ||
+                        options.memoryLimitBytes > 0;
+  // * A background group reading the terminal is stopped by SIGTTIN, so a
+  // * limited run on ccomp's own stdin is handed the terminal. Test cases
+  // * read their input from files and are never handed it.
+  const bool handTerminal = ownGroup && stdinFd < 0 &&
+                            isatty(STDIN_FILENO) &&
+                            tcgetpgrp(STDIN_FILENO) == getpgrp();
+
+  int outPipe[2] = {-1, -1};
+  // * The child waits on this pipe until its group, terminal and cgroup are
+  // * set up, and reads whether the cgroup took it.
+  int goPipe[2] = {-1, -1};
+  if ((options.onOutput && pipe2(outPipe, O_CLOEXEC) != 0) ||
+      (ownGroup && pipe2(goPipe, O_CLOEXEC) != 0)) {
+    for (const int fd : {stdinFd, outPipe[0], outPipe[1]}) {
+      if (fd >= 0)
+        close(fd);
+    }
+    throw std::runtime_error("pipe() failed!");
+  }
+
+  std::vector<char *> argv;
+  for (const auto &arg : args) {
+    argv.push_back(const_cast<char *>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+
+  // * Built before fork(): setenv() isn't safe in the child of a threaded
+  // * process.
+  std::vector<char *> envp;
+  if (!options.environment.empty()) {
+    for (char **variable = environ; *variable; ++variable) {
+      const std::string_view entry(*variable);
+      const bool overridden = std::any_of(
+          options.environment.begin(), options.environment.end(),
+          [&](const std::string &extra) {
+            const auto name = extra.substr(0, extra.find('=') + 1);
+            return entry.substr(0, name.size()) == name;
+          });
+      if (!overridden)
+        envp.push_back(*variable);
+    }
+    for (const auto &extra : options.environment) {
+      envp.push_back(const_cast<char *>(extra.c_str()));
+    }
+    envp.push_back(nullptr);
+  }
+
+  std::optional<MemoryCgroup> cgroup;
+  if (options.memoryLimitBytes) {
+    cgroup.emplace(options.memoryLimitBytes);
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  const pid_t pid = fork();
+  if (pid < 0) {
+    for (const int fd : {stdinFd, outPipe[0], outPipe[1], goPipe[0], goPipe[1]}) {
+      if (fd >= 0)
+        close(fd);
+    }
+    throw std::runtime_error("fork() failed!");
+  }
+
+  if (pid == 0) {
+    char inCgroup = 0;
+    if (ownGroup) {
+      setpgid(0, 0);
+      close(goPipe[1]);
+      while (read(goPipe[0], &inCgroup, 1) < 0 && errno == EINTR) {
+      }
+    }
+    if (options.cpuLimitSeconds > 0) {
+      const rlim_t seconds = options.cpuLimitSeconds;
+      const struct rlimit limit = {seconds, seconds + 1};
+      setrlimit(RLIMIT_CPU, &limit);
+    }
+    if (options.memoryLimitBytes && !inCgroup) {
+      const struct rlimit limit = {options.memoryLimitBytes,
+                                   options.memoryLimitBytes};
+      setrlimit(RLIMIT_AS, &limit);
+    }
+    if (stdinFd >= 0)
+      dup2(stdinFd, STDIN_FILENO);
+    if (outPipe[1] >= 0)
+      dup2(outPipe[1], STDOUT_FILENO);
+    if (outPipe[1] >= 0 && options.mergeStderr)
+      dup2(outPipe[1], STDERR_FILENO);
+    for (const int fd : options.inheritedFds) {
+      fcntl(fd, F_SETFD, 0);
+    }
+    if (envp.empty())
+      execvp(argv[0], argv.data());
+    else
+      execvpe(argv[0], argv.data(), envp.data());
+    _exit(127);
+  }
+
+  if (ownGroup) {
+    // * Both sides call setpgid(), so the group exists whichever runs first.
+    setpgid(pid, pid);
+    if (handTerminal)
+      setForegroundGroup(pid);
+    const char inCgroup = cgroup && cgroup->adopt(pid);
+    close(goPipe[0]);
+    (void)!write(goPipe[1], &inCgroup, 1);
+    close(goPipe[1]);
+  }
+
+  if (stdinFd >= 0)
+    close(stdinFd);
+
+  // * Watchdog: kills the whole process group once the timeout expires. The
+  // * child isn't reaped before the watchdog is stopped, so its pid (and
+  // * group id) can't be reused while the watchdog may still use it.
+  std::mutex watchdogMutex;
+  std::condition_variable watchdogWake;
+  bool finished = false;
+  bool timedOut = false;
+  std::thread watchdog;
+  if (options.timeoutSeconds > 0) {
+    watchdog = std::thread([&]() {
+      std::unique_lock<std::mutex> lock(watchdogMutex);
+      const auto deadline =
+          start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                      std::chrono::duration<double>(options.timeoutSeconds));
+      if (!watchdogWake.wait_until(lock, deadline, [&] { return finished; })) {
+        // * A program that exited before the deadline didn't time out, even
+        // * if the main thread hasn't seen it yet.
+        siginfo_t info{};
+        if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 &&
+            info.si_pid == 0) {
+          timedOut = true;
+          kill(-pid, SIGKILL);
+        }
+      }
+    });
+  }
+
+  if (options.onOutput) {
+    close(outPipe[1]);
+    std::array<char, 65536> buffer;
+    ssize_t count;
+    while ((count = read(outPipe[0], buffer.data(), buffer.size())) != 0) {
+      if (count < 0) {
+        if (errno == EINTR)
+          continue;
+        break;
+      }
+      options.onOutput(buffer.data(), static_cast<size_t>(count));
+    }
+    close(outPipe[0]);
+  }
+
+  // * Wait for the exit without reaping it yet (WNOWAIT); stops are
+  // * consumed and handled along the way.
+  siginfo_t info{};
+  while (true) {
+    if (waitid(P_PID, pid, &info, WEXITED | WSTOPPED | WNOWAIT) != 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (info.si_code != CLD_STOPPED)
+      break;
+    waitid(P_PID, pid, &info, WSTOPPED | WNOHANG);
+    if (!ownGroup) {
+      // * Stopped along with ccomp's group; it resumes along with it too.
+      continue;
+    }
+    if (info.si_status == SIGTTIN || info.si_status == SIGTTOU) {
+      // * It touched a terminal it doesn't own and can't go on.
+      kill(-pid, SIGKILL);
+    } else {
+      // * Ctrl-Z (or SIGSTOP): suspend ccomp with it, resume both together.
+      if (handTerminal)
+        setForegroundGroup(getpgrp());
+      raise(SIGTSTP);
+      if (handTerminal)
+        setForegroundGroup(pid);
+      kill(-pid, SIGCONT);
+    }
+  }
+
+  if (watchdog.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(watchdogMutex);
+      finished = true;
+    }
+    watchdogWake.notify_one();
+    watchdog.join();
+  }
+  if (handTerminal)
+    setForegroundGroup(getpgrp());
+
+  // * Take down anything the child left behind in its process group, while
+  // * the unreaped child still holds the group id.
+  if (ownGroup)
+    kill(-pid, SIGKILL);
+
+  int status = 0;
+  struct rusage usage {};
+  while (wait4(pid, &status, 0, &usage) < 0 && errno == EINTR) {
+  }
+
+  ProcessResult result;
+  result.wallSeconds = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+  result.cpuSeconds = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+                      (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+  result.maxRssKb = usage.ru_maxrss;
+  if (WIFEXITED(status)) {
+    result.exitCode = WEXITSTATUS(status);
+  } else if (WIFSIGNALED(status)) {
+    result.termSignal = WTERMSIG(status);
+    result.exitCode = 128 + result.termSignal;
+  }
+
+  if (timedOut) {
+    result.limitHit = ResourceLimit::TIMEOUT;
+  } else if (result.termSignal == SIGXCPU ||
+             (options.cpuLimitSeconds > 0 && result.termSignal == SIGKILL &&
+              result.cpuSeconds >= options.cpuLimitSeconds)) {
+    result.limitHit = ResourceLimit::CPU;
+  } else if (cgroup && cgroup->active()) {
+    result.maxRssKb = std::max(result.maxRssKb, cgroup->peakKb());
+    if (cgroup->oomKilled())
+      result.limitHit = ResourceLimit::MEMORY;
+  } else if (options.memoryLimitBytes && result.termSignal != 0) {
+    // * Without a cgroup, an allocation failure under RLIMIT_AS usually ends
+    // * in SIGABRT (std::bad_alloc) or SIGSEGV.
+    if (result.termSignal == SIGABRT || result.termSignal == SIGSEGV)
+      result.limitHit = ResourceLimit::MEMORY;
+  }
+  return result;
+}
+
+std::string limitName(ResourceLimit limit) {
+  switch (limit) {
+  case ResourceLimit::TIMEOUT:
+    return "timeout";
+  case ResourceLimit::CPU:
+    return "cpu limit";
+  case ResourceLimit::MEMORY:
+    return "memory limit";
+  default:
+    return "none";
+  }
+}
@@ -1,4 +1,37 @@
 #pragma once
+#include <functional>
 #include <string>
+#include <vector>
 
-int safeSystemCall(const std::string &);
\ No newline at end of file
+enum class ResourceLimit { NONE, TIMEOUT, CPU, MEMORY };
+
+struct ProcessOptions {
+  // * Path of a file to feed to the child's stdin (inherited when empty).
+  std::string stdinPath;
+  // * Receives the child's stdout in chunks (inherited when unset).
+  std::function<void(const char *, size_t)> onOutput;
+  // * Sends stderr to onOutput as well (e.g. compiler diagnostics).
+  bool mergeStderr = false;
+  // * Limits applied to the child (0 = unlimited).
+  double timeoutSeconds = 0;
+  long cpuLimitSeconds = 0;
+  size_t memoryLimitBytes = 0;
+  // * Descriptors the child keeps across exec despite O_CLOEXEC, and
+  // * "NAME=value" variables set in its environment only.
+  std::vector<int> inheritedFds;
+  std::vector<std::string> environment;
+};
+
+struct ProcessResult {
+  int exitCode = 0;
+  int termSignal = 0;
+  double wallSeconds = 0;
+  double cpuSeconds = 0;
+  long maxRssKb = 0;
+  ResourceLimit limitHit = ResourceLimit::NONE;
+};
+
+int safeSystemCall(const std::string &);
+ProcessResult runProcess(const std::vector<std::string> &,
+                         const ProcessOptions & = {});
+std::string limitName(ResourceLimit);
@@ -0,0 +1,123 @@
+#include "./trace_utils.hpp"
+
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <unistd.h>
+#include <vector>
+
+#include "../json_utils/json_utils.hpp"
+
+namespace {
+
+struct TraceEvent {
+  std::string name;
+  std::string category;
+  std::string detail;
+  long long startUs;
+  long long durationUs;
+  int threadId;
+};
+
+std::atomic<bool> enabled{false};
+std::mutex eventsMutex;
+std::vector<TraceEvent> events;
+std::map<int, std::string> threadNames;
+const TraceClock::time_point origin = TraceClock::now();
+
+int currentThreadId() {
+  static std::atomic<int> nextId{1};
+  thread_local const int id = nextId++;
+  return id;
+}
+
+long long sinceOrigin(TraceClock::time_point time) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(time - origin)
+      .count();
+}
+
+} // namespace
+
+void traceEnable() {
+  enabled = true;
+  traceNameThread("main");
+}
+
+bool traceEnabled() { return enabled; }
+
+void traceRecord(const std::string &name, const std::string &category,
+                 TraceClock::time_point start, TraceClock::time_point end,
+                 const std::string &detail) {
+  if (!enabled) {
+    return;
+  }
+  TraceEvent event{name,
+                   category,
+                   detail,
+                   sinceOrigin(start),
+                   sinceOrigin(end) - sinceOrigin(start),
+                   currentThreadId()};
+  std::lock_guard<std::mutex> lock(eventsMutex);
+  events.push_back(std::move(event));
+}
+
+void traceNameThread(const std::string &name) {
+  if (!enabled) {
+    return;
+  }
+  const int id = currentThreadId();
+  std::lock_guard<std::mutex> lock(eventsMutex);
+  threadNames.emplace(id, name);
+}
+
+bool traceWrite(const std::filesystem::path &path) {
+  std::ofstream file(path);
+  if (!file.is_open()) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(eventsMutex);
+  const int pid = static_cast<int>(getpid());
+  JsonWriter json(file);
+  json.beginObject().field("displayTimeUnit", "ms");
+  json.key("traceEvents").beginArray();
+  for (const auto &[id, name] : threadNames) {
+    json.beginObject()
+        .field("ph", "M")
+        .field("name", "thread_name")
+        .field("pid", pid)
+        .field("tid", id);
+    json.key("args").beginObject().field("name", name).endObject();
+    json.endObject();
+  }
+  for (const auto &event : events) {
+    json.beginObject()
+        .field("ph", "X")
+        .field("name", event.name)
+        .field("cat", event.category)
+        .field("ts", event.startUs)
+        .field("dur", event.durationUs)
+        .field("pid", pid)
+        .field("tid", event.threadId);
+    if (!event.detail.empty()) {
+      json.key("args").beginObject().field("detail", event.detail).endObject();
+    }
+    json.endObject();
+  }
+  json.endArray().endObject();
+  file << '\n';
+  return static_cast<bool>(file);
+}
+
+TraceScope::TraceScope(std::string name, std::string category,
+                       std::string detail)
+    : name(std::move(name)), category(std::move(category)),
+      detail(std::move(detail)), start(TraceClock::now()),
+      active(traceEnabled()) {}
+
+TraceScope::~TraceScope() {
+  if (active) {
+    traceRecord(name, category, start, TraceClock::now(), detail);
+  }
+}
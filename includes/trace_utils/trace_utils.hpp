@@ -0,0 +1,36 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+
+/**
+ * @brief Records ccomp's own phases as Chrome trace events (viewable in
+ * Perfetto / chrome://tracing). Each thread gets its own track. Recording is
+ * a no-op until traceEnable() is called.
+ */
+using TraceClock = std::chrono::steady_clock;
+
+void traceEnable();
+bool traceEnabled();
+void traceRecord(const std::string &name, const std::string &category,
+                 TraceClock::time_point start, TraceClock::time_point end,
+                 const std::string &detail = "");
+void traceNameThread(const std::string &);
+bool traceWrite(const std::filesystem::path &);
+
+class TraceScope {
+public:
+  TraceScope(std::string name, std::string category, std::string detail = "");
+  ~TraceScope();
+
+  TraceScope(const TraceScope &) = delete;
+  TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+  std::string name;
+  std::string category;
+  std::string detail;
+  TraceClock::time_point start;
+  bool active;
+};
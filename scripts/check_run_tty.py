@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+"""Checks that a program run with -r can read the terminal, with and without
+run limits: each run gets a pseudo-terminal, types a line into it and expects
+the program to echo it back. Usage: check_run_tty.py [path/to/ccomp]"""
+
+import os
+import pty
+import select
+import sys
+import tempfile
+import time
+
+PROGRAM = r"""
+#include <iostream>
+#include <string>
+int main() {
+  std::string line;
+  std::getline(std::cin, line);
+  std::cout << "read: " << line << std::endl;
+}
+"""
+
+
+def run_on_pty(args, cwd, timeout=120):
+    """Runs args on a new pty, typing a line once the build is done."""
+    pid, fd = pty.fork()
+    if pid == 0:
+        os.chdir(cwd)
+        os.execv(args[0], args)
+    output = b""
+    typed = False
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        ready, _, _ = select.select([fd], [], [], 0.2)
+        if ready:
+            try:
+                chunk = os.read(fd, 4096)
+            except OSError:
+                break
+            if not chunk:
+                break
+            output += chunk
+        elif not typed and os.path.exists(os.path.join(cwd, "out", "main")):
+            time.sleep(0.5)
+            os.write(fd, b"hello\n")
+            typed = True
+    else:
+        os.kill(pid, 9)
+    _, status = os.waitpid(pid, 0)
+    return os.waitstatus_to_exitcode(status), output.decode(errors="replace")
+
+
+def main():
+    ccomp = os.path.abspath(sys.argv[1] if len(sys.argv) > 1 else "./ccomp")
+    failed = 0
+    for limits in ([], ["--timeout", "30"], ["--memory-limit", "512M"]):
+        with tempfile.TemporaryDirectory() as cwd:
+            os.mkdir(os.path.join(cwd, "out"))
+            with open(os.path.join(cwd, "main.cpp"), "w") as source:
+                source.write(PROGRAM)
+            code, output = run_on_pty([ccomp, *limits, "main.cpp", "-r"], cwd)
+            ok = code == 0 and "read: hello" in output
+            failed += not ok
+            print(("ok  " if ok else "FAIL") + " -r " + " ".join(limits))
+            if not ok:
+                print(output)
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,50 @@
+#include <csignal>
+
+#include "./ccomp.hpp"
+#include "includes/remote_utils/remote_utils.hpp"
+
+/**
+ * @brief `ccomp worker`: compiles preprocessed sources sent by `ccomp
+ * --workers ...` with its own compiler and returns the objects. Requests
+ * aren't authenticated, so only expose it to trusted hosts.
+ */
+int run_worker(int argc, char **argv) {
+  argparse::ArgumentParser program("ccomp worker");
+  program.add_description(
+      "Compile worker for distributed builds. Receives preprocessed sources, "
+      "compiles them and sends back the objects.");
+  program.add_argument("--listen")
+      .help("Address to listen on (unix:/path/to/socket or tcp:host:port).")
+      .required();
+  program.add_argument("-c", "--compiler")
+      .help("Compiler to build with (e.g., gnu-20, clang++, g++-12); clients "
+            "using another compiler build locally.")
+      .default_value(std::string("g++"));
+
+  try {
+    program.parse_args(argc, argv);
+  } catch (const std::exception &e) {
+    return exitError(ErrorType::ARGUMENT_PARSING_ERROR, e.what());
+  }
+
+  std::vector<std::string> compilerArgs;
+  try {
+    compilerArgs =
+        splitCommand(resolveCompilerArg(program.get<std::string>("--compiler")));
+  } catch (const std::exception &e) {
+    return exitError(ErrorType::ARGUMENT_PARSING_ERROR, e.what());
+  }
+  if (compilerArgs.empty()) {
+    return exitError(ErrorType::ARGUMENT_PARSING_ERROR, "No compiler given");
+  }
+
+  const auto address = program.get<std::string>("--listen");
+  const int listenFd = listenWorker(address);
+  if (listenFd < 0) {
+    return exitError(ErrorType::FILE_IO_ERROR, "Could not listen", address);
+  }
+  signal(SIGPIPE, SIG_IGN);
+  std::cout << "ccomp worker listening on " << address << std::endl;
+  serveCompileRequests(listenFd, compilerArgs);
+  return 0;
+}